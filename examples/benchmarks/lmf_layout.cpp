@@ -0,0 +1,161 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file lmf_layout.cpp
+ *
+ * @brief Throughput of LMF gradient steps with the old and the new layout of
+ *     the factors
+ *
+ * The old layout maps each factor as a (rowDim x maxRank) column-major
+ * matrix, so a latent vector is a row whose values are rowDim apart. The new
+ * layout (see LMFModel in src/modules/convex/type/model.hpp) stores each
+ * latent vector as a contiguous column, padded with zeros to a multiple of 4
+ * values. Both variants run the update code of the respective version of
+ * LMF::gradientInPlace() on a synthetic matrix, and the throughput of the
+ * second pass is reported.
+ *
+ * Only Eigen is needed:
+ *
+ *     g++ -O2 -I<eigen> -o lmf_layout lmf_layout.cpp
+ *     ./lmf_layout [num_ratings [row_dim [column_dim]]]
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#include <Eigen/Core>
+
+#include <sys/time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using Eigen::Dynamic;
+using Eigen::Map;
+using Eigen::Matrix;
+
+typedef Matrix<double, Dynamic, Dynamic> Mat;
+typedef Matrix<double, 1, Dynamic> RowVector;
+typedef Mat::Index Index;
+
+namespace {
+
+struct Rating {
+    Index i;
+    Index j;
+    double value;
+};
+
+/**
+ * @brief Deterministic pseudo-random numbers (so both layouts see the same
+ *     ratings)
+ */
+class LinearCongruential {
+public:
+    explicit LinearCongruential(unsigned long inSeed) : mState(inSeed) { }
+
+    unsigned long next() {
+        mState = mState * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<unsigned long>(mState >> 33);
+    }
+
+private:
+    unsigned long long mState;
+};
+
+double
+now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/**
+ * @brief Old layout: Latent vectors are rows of column-major matrices
+ */
+double
+runRowLayout(const std::vector<Rating> &inRatings, Index inRowDim,
+        Index inColDim, Index inRank, double inStepsize) {
+    std::vector<double> storage((inRowDim + inColDim) * inRank, 0.1);
+    Map<Mat> U(&storage[0], inRowDim, inRank);
+    Map<Mat> V(&storage[inRowDim * inRank], inColDim, inRank);
+
+    double seconds = 0.;
+    for (int pass = 0; pass < 2; pass++) {
+        double start = now();
+        for (size_t k = 0; k < inRatings.size(); k++) {
+            const Rating &r = inRatings[k];
+            double e = U.row(r.i).dot(V.row(r.j)) - r.value;
+            RowVector temp = U.row(r.i) - inStepsize * e * V.row(r.j);
+            V.row(r.j) -= inStepsize * e * U.row(r.i);
+            U.row(r.i) = temp;
+        }
+        seconds = now() - start;
+    }
+    return seconds;
+}
+
+/**
+ * @brief New layout: Latent vectors are contiguous, padded columns
+ */
+double
+runColumnLayout(const std::vector<Rating> &inRatings, Index inRowDim,
+        Index inColDim, Index inRank, double inStepsize) {
+    Index paddedRank = (inRank + 3) / 4 * 4;
+    std::vector<double> storage((inRowDim + inColDim) * paddedRank, 0.);
+    Map<Mat> U(&storage[0], paddedRank, inRowDim);
+    Map<Mat> V(&storage[inRowDim * paddedRank], paddedRank, inColDim);
+    U.topRows(inRank).setConstant(0.1);
+    V.topRows(inRank).setConstant(0.1);
+
+    double seconds = 0.;
+    for (int pass = 0; pass < 2; pass++) {
+        double start = now();
+        for (size_t k = 0; k < inRatings.size(); k++) {
+            const Rating &r = inRatings[k];
+            double *u = U.col(r.i).data();
+            double *v = V.col(r.j).data();
+            double e = U.col(r.i).dot(V.col(r.j)) - r.value;
+            double scale = inStepsize * e;
+            for (Index c = 0; c < paddedRank; c++) {
+                double uc = u[c];
+                u[c] = uc - scale * v[c];
+                v[c] -= scale * uc;
+            }
+        }
+        seconds = now() - start;
+    }
+    return seconds;
+}
+
+} // namespace
+
+int
+main(int argc, char **argv) {
+    size_t numRatings = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1000000;
+    Index rowDim = argc > 2 ? std::strtol(argv[2], NULL, 10) : 100000;
+    Index colDim = argc > 3 ? std::strtol(argv[3], NULL, 10) : 20000;
+    const Index ranks[] = { 4, 10, 20, 50 };
+    const double stepsize = 0.001;
+
+    LinearCongruential rng(42);
+    std::vector<Rating> ratings(numRatings);
+    for (size_t k = 0; k < numRatings; k++) {
+        ratings[k].i = static_cast<Index>(rng.next() % rowDim);
+        ratings[k].j = static_cast<Index>(rng.next() % colDim);
+        ratings[k].value = 1. + static_cast<double>(rng.next() % 5);
+    }
+
+    std::printf("%lu ratings, %ld rows, %ld columns "
+        "(million updates per second, second pass)\n",
+        static_cast<unsigned long>(numRatings), static_cast<long>(rowDim),
+        static_cast<long>(colDim));
+    std::printf("%6s %10s %10s\n", "rank", "before", "after");
+    for (size_t r = 0; r < sizeof(ranks) / sizeof(ranks[0]); r++) {
+        double before = runRowLayout(ratings, rowDim, colDim, ranks[r],
+            stepsize);
+        double after = runColumnLayout(ratings, rowDim, colDim, ranks[r],
+            stepsize);
+        std::printf("%6ld %10.2f %10.2f\n", static_cast<long>(ranks[r]),
+            numRatings / before * 1e-6, numRatings / after * 1e-6);
+    }
+    return 0;
+}
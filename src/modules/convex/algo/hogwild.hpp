@@ -0,0 +1,160 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file hogwild.hpp
+ *
+ * Lock-free multithreaded incremental gradient descent on buffered tuples,
+ * after: F. Niu, B. Recht, C. Ré, and S. J. Wright. "Hogwild!: A Lock-Free
+ * Approach to Parallelizing Stochastic Gradient Descent." In: NIPS 2011.
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_MODULES_CONVEX_ALGO_HOGWILD_HPP_
+#define MADLIB_MODULES_CONVEX_ALGO_HOGWILD_HPP_
+
+#include <pthread.h>
+#include <signal.h>
+
+namespace madlib {
+
+namespace modules {
+
+namespace convex {
+
+/**
+ * @brief Apply the gradient steps of all buffered tuples with several threads
+ *
+ * The transition function of an aggregate copies its tuples into a buffer in
+ * the state. Once the buffer is full (and in the final and merge functions),
+ * flush() splits the buffer into one contiguous slice per thread, and all
+ * threads update the shared model in place without any locking. When the
+ * gradient of a tuple only touches a small part of the model (as for
+ * low-rank matrix factorization), conflicting writes are rare and hardly
+ * affect convergence.
+ *
+ * Worker threads must not call any backend function: They only run
+ * Algorithm::lossAndTransition(), which has to be free of memory allocation
+ * and exceptions, and read buffered tuples with
+ * <tt>state.bufferedTuple()</tt>. All allocation, argument parsing, and
+ * error checking happens in the backend thread before a tuple is buffered.
+ *
+ * The state has to provide:
+ * - <tt>numThreads()</tt>: The number of threads to use
+ * - <tt>algo.numBuffered</tt>: The number of buffered tuples
+ * - <tt>algo.loss</tt>: The loss accumulated in this iteration
+ * - <tt>bufferedTuple(uint64_t, tuple_type &) const</tt>: Decode a
+ *   buffered tuple
+ */
+template <class Algorithm>
+class Hogwild {
+public:
+    typedef typename Algorithm::state_type state_type;
+    typedef typename Algorithm::tuple_type tuple_type;
+
+    /**
+     * @brief Maximum number of threads
+     */
+    static const uint16_t kMaxNumThreads = 256;
+
+    /**
+     * @brief Whether flush() behaves as if no thread could be created
+     *
+     * The backend thread then processes all slices in order. This is only
+     * used to test that fallback, see internal_lmf_igd_disable_threads().
+     */
+    static bool isThreadCreationDisabled;
+
+    static void flush(state_type &state);
+
+private:
+    struct Worker {
+        state_type *state;
+        uint64_t begin;
+        uint64_t end;
+        double loss;
+    };
+
+    static void *work(void *inWorker);
+};
+
+template <class Algorithm>
+bool Hogwild<Algorithm>::isThreadCreationDisabled = false;
+
+/**
+ * @brief Process all buffered tuples, add their loss to the state, and empty
+ *     the buffer
+ */
+template <class Algorithm>
+void
+Hogwild<Algorithm>::flush(state_type &state) {
+    uint64_t numBuffered = state.algo.numBuffered;
+    if (numBuffered == 0)
+        return;
+
+    uint64_t numThreads = std::min(
+        static_cast<uint64_t>(state.numThreads()), numBuffered);
+    // The backend thread processes the first slice itself
+    Worker workers[kMaxNumThreads];
+    pthread_t threads[kMaxNumThreads];
+    bool isStarted[kMaxNumThreads];
+    for (uint64_t t = 0; t < numThreads; t++) {
+        workers[t].state = &state;
+        workers[t].begin = numBuffered * t / numThreads;
+        workers[t].end = numBuffered * (t + 1) / numThreads;
+        workers[t].loss = 0.;
+        isStarted[t] = false;
+    }
+
+    // Signal handlers of the backend are not thread-safe, so all signals
+    // have to be delivered to the backend thread. New threads inherit the
+    // signal mask.
+    sigset_t allSignals, oldSignals;
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_SETMASK, &allSignals, &oldSignals);
+    for (uint64_t t = 1; t < numThreads; t++) {
+        // If no thread can be created, the slice is processed below
+        isStarted[t] = !isThreadCreationDisabled
+            && pthread_create(&threads[t], NULL, work, &workers[t]) == 0;
+    }
+    pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+
+    work(&workers[0]);
+    for (uint64_t t = 1; t < numThreads; t++) {
+        if (isStarted[t])
+            pthread_join(threads[t], NULL);
+        else
+            work(&workers[t]);
+    }
+
+    double loss = 0.;
+    for (uint64_t t = 0; t < numThreads; t++)
+        loss += workers[t].loss;
+    state.algo.loss += loss;
+    state.algo.numBuffered = 0;
+}
+
+/**
+ * @brief Thread function: Process one slice of the buffer
+ *
+ * This runs outside of the backend thread, see the class description.
+ */
+template <class Algorithm>
+void *
+Hogwild<Algorithm>::work(void *inWorker) {
+    Worker &worker = *static_cast<Worker*>(inWorker);
+    tuple_type tuple;
+    double loss = 0.;
+    for (uint64_t k = worker.begin; k < worker.end; k++) {
+        worker.state->bufferedTuple(k, tuple);
+        loss += Algorithm::lossAndTransition(*worker.state, tuple);
+    }
+    worker.loss = loss;
+    return NULL;
+}
+
+} // namespace convex
+
+} // namespace modules
+
+} // namespace madlib
+
+#endif
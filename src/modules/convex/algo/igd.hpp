@@ -17,6 +17,30 @@ namespace modules {
 
 namespace convex {
 
+/**
+ * @brief Whether a task evaluates the loss and applies the gradient in one
+ *     pass
+ *
+ * Tasks opt in by declaring a nested type \c fused_loss_and_gradient (its
+ * definition does not matter) and providing
+ * <tt>lossAndGradientInPlace()</tt> with the same arguments as
+ * <tt>gradientInPlace()</tt>. It has to return the loss of the model before
+ * the gradient step.
+ */
+template <class Task>
+class HasFusedLossAndGradient {
+    typedef char Yes;
+    typedef char (&No)[2];
+
+    template <class T>
+    static Yes test(typename T::fused_loss_and_gradient*);
+    template <class T>
+    static No test(...);
+
+public:
+    static const bool value = sizeof(test<Task>(0)) == sizeof(Yes);
+};
+
 // The reason for using ConstState instead of const State to reduce the
 // template type list: flexibility to high-level for mutability control
 // More: cast<ConstState>(MutableState) may not always work
@@ -29,8 +53,32 @@ public:
     typedef typename Task::model_type model_type;
 
     static void transition(state_type &state, const tuple_type &tuple);
+    static void transitionWithLoss(state_type &state,
+            const tuple_type &tuple);
     static void merge(state_type &state, const_state_type &otherState);
     static void final(state_type &state);
+
+    /**
+     * @brief Gradient step, returning the loss of the model before the step
+     *
+     * Unlike transitionWithLoss(), this only writes to the model and the
+     * AdaGrad accumulator of the state, so it may be called concurrently by
+     * several threads (see Hogwild).
+     */
+    static double lossAndTransition(state_type &state,
+            const tuple_type &tuple) {
+        return lossAndTransition<Task>(state, tuple);
+    }
+
+private:
+    template <class T>
+    static double lossAndTransition(state_type &state, const tuple_type &tuple,
+            typename boost::enable_if_c<
+                HasFusedLossAndGradient<T>::value>::type* = 0);
+    template <class T>
+    static double lossAndTransition(state_type &state, const tuple_type &tuple,
+            typename boost::disable_if_c<
+                HasFusedLossAndGradient<T>::value>::type* = 0);
 };
 
 template <class State, class ConstState, class Task>
@@ -44,11 +92,73 @@ IGD<State, ConstState, Task>::transition(state_type &state,
     // -- Task::sparse_model_type, which we do not explicit define
 
     // apply to the model directly
-    Task::gradientInPlace(
-            state.algo.incrModel,
-            tuple.indVar,
-            tuple.depVar,
-            state.task.stepsize);
+    if (state.stepsizePolicy() == kAdaGradStepSize) {
+        Task::gradientInPlace(
+                state.task.model,
+                tuple.indVar,
+                tuple.depVar,
+                state.task.stepsize,
+                state.task.accumulator,
+                state.algo.incrAccumulator);
+    } else {
+        Task::gradientInPlace(
+                state.task.model,
+                tuple.indVar,
+                tuple.depVar,
+                scheduledStepSize(state.stepsizePolicy(), state.task.stepsize,
+                    state.task.numPasses));
+    }
+}
+
+/**
+ * @brief Gradient step that also adds the loss of the tuple to the state
+ *
+ * The loss is that of the model before the gradient step, i.e., the same as
+ * calling Loss::transition() before transition(). Tasks with a fused
+ * lossAndGradientInPlace() share the prediction between both.
+ */
+template <class State, class ConstState, class Task>
+void
+IGD<State, ConstState, Task>::transitionWithLoss(state_type &state,
+        const tuple_type &tuple) {
+    state.algo.loss += lossAndTransition<Task>(state, tuple);
+}
+
+template <class State, class ConstState, class Task>
+template <class T>
+double
+IGD<State, ConstState, Task>::lossAndTransition(state_type &state,
+        const tuple_type &tuple,
+        typename boost::enable_if_c<
+            HasFusedLossAndGradient<T>::value>::type*) {
+    if (state.stepsizePolicy() == kAdaGradStepSize) {
+        return Task::lossAndGradientInPlace(
+                state.task.model,
+                tuple.indVar,
+                tuple.depVar,
+                state.task.stepsize,
+                state.task.accumulator,
+                state.algo.incrAccumulator);
+    } else {
+        return Task::lossAndGradientInPlace(
+                state.task.model,
+                tuple.indVar,
+                tuple.depVar,
+                scheduledStepSize(state.stepsizePolicy(), state.task.stepsize,
+                    state.task.numPasses));
+    }
+}
+
+template <class State, class ConstState, class Task>
+template <class T>
+double
+IGD<State, ConstState, Task>::lossAndTransition(state_type &state,
+        const tuple_type &tuple,
+        typename boost::disable_if_c<
+            HasFusedLossAndGradient<T>::value>::type*) {
+    double loss = Task::loss(state.task.model, tuple.indVar, tuple.depVar);
+    transition(state, tuple);
+    return loss;
 }
 
 template <class State, class ConstState, class Task>
@@ -59,12 +169,17 @@ IGD<State, ConstState, Task>::merge(state_type &state,
     // This can be removed if it affects performance in the future,
     // with the expectation that callers should do the zero checking.
     if (state.algo.numRows == 0) {
-        state.algo.incrModel = otherState.algo.incrModel;
+        state.task.model = otherState.task.model;
+        state.algo.incrAccumulator = otherState.algo.incrAccumulator;
         return;
     } else if (otherState.algo.numRows == 0) {
         return;
     }
 
+    // The squared gradients of AdaGrad are simply summed up (this is a no-op
+    // for the other policies, which have an empty incrAccumulator)
+    state.algo.incrAccumulator += otherState.algo.incrAccumulator;
+
     // The reason of this weird algorithm instead of an intuitive one
     // -- (w1 * m1 + w2 * m2) / (w1 + w2): we have only one mutable state,
     // therefore, (m1 * w1 / w2  + m2)  * w2 / (w1 + w2).
@@ -72,20 +187,38 @@ IGD<State, ConstState, Task>::merge(state_type &state,
 
     // model averaging, weighted by rows seen
     double totalNumRows = static_cast<double>(state.algo.numRows + otherState.algo.numRows);
-    state.algo.incrModel *= static_cast<double>(state.algo.numRows) /
+    state.task.model *= static_cast<double>(state.algo.numRows) /
         static_cast<double>(otherState.algo.numRows);
-    state.algo.incrModel += otherState.algo.incrModel;
-    state.algo.incrModel *= static_cast<double>(otherState.algo.numRows) /
+    state.task.model += otherState.task.model;
+    state.task.model *= static_cast<double>(otherState.algo.numRows) /
         static_cast<double>(totalNumRows);
 }
 
 template <class State, class ConstState, class Task>
 void
 IGD<State, ConstState, Task>::final(state_type &state) {
-    // The reason that we have to keep the task.model untouched in transition
-    // funtion: loss computation needs the model from last iteration cleanly
-
-    state.task.model = state.algo.incrModel;
+    // The model is updated in place by the transition function, so only the
+    // accumulators need to be folded in here
+
+    switch (state.stepsizePolicy()) {
+        case kAdaGradStepSize:
+            state.task.accumulator += state.algo.incrAccumulator;
+            break;
+        case kAveragingStepSize: {
+            // Averaging every iterate would cost a full pass over the model
+            // per tuple, whereas the gradient of a tuple is typically sparse.
+            // We therefore average the iterates at the end of each pass:
+            // average = (numPasses * average + iterate) / (numPasses + 1)
+            double numPasses = static_cast<double>(state.task.numPasses);
+            state.task.accumulator *= numPasses;
+            state.task.accumulator += state.task.model;
+            state.task.accumulator *= 1. / (numPasses + 1.);
+            break;
+        }
+        default:
+            break;
+    }
+    state.task.numPasses++;
 }
 
 } // namespace convex
@@ -37,7 +37,9 @@ template <class State, class ConstState, class Task>
 void
 Loss<State, ConstState, Task>::transition(state_type &state,
         const tuple_type &tuple) {
-    // "task.model" NOT "algo.incrModel"! Also see: igd.hpp:final()
+    // This has to be called before IGD::transition() for the same tuple, so
+    // that the loss is that of the iterate before the tuple's gradient step
+    // (progressive validation)
 
     state.algo.loss += Task::loss(
             state.task.model, 
@@ -0,0 +1,135 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file shuffle.hpp
+ *
+ * Randomize the order of gradient steps with a bounded buffer of tuples, so
+ * that incremental gradient descent does not depend on the (often clustered)
+ * scan order of the input.
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_MODULES_CONVEX_ALGO_SHUFFLE_HPP_
+#define MADLIB_MODULES_CONVEX_ALGO_SHUFFLE_HPP_
+
+namespace madlib {
+
+namespace modules {
+
+namespace convex {
+
+/**
+ * @brief Apply gradient steps in pseudo-random order through a shuffle buffer
+ *
+ * The buffer is filled with the first tuples of an iteration. Once it is full,
+ * every new tuple replaces a uniformly chosen buffered tuple, whose gradient
+ * step is applied instead (or, with the same probability as any buffered
+ * tuple, the new tuple is applied right away). At the end of the iteration,
+ * flush() applies the remaining tuples in random order. A tuple may thus stay
+ * in the buffer for an arbitrary number of steps, so the order is closer to
+ * a random permutation than what shuffling consecutive windows would give,
+ * while the memory stays bounded by the buffer size.
+ *
+ * The random numbers come from the backend (NativeRandomNumberGenerator), so
+ * all functions have to be called by the backend thread, and the order is
+ * reproducible with <tt>setseed()</tt>.
+ *
+ * \c Algorithm has to provide <tt>transitionWithLoss(state, tuple)</tt>. The
+ * state has to provide:
+ * - <tt>algo.numBuffered</tt>: The number of buffered tuples
+ * - <tt>isBufferFull() const</tt>
+ * - <tt>bufferTuple(const tuple_type &)</tt>: Append a tuple to the buffer
+ * - <tt>bufferedTuple(uint64_t, tuple_type &) const</tt>: Decode a buffered
+ *   tuple. The tuple may refer to the buffer, so it has to be consumed
+ *   before the buffer changes.
+ * - <tt>setBufferedTuple(uint64_t, const tuple_type &)</tt>: Overwrite a
+ *   buffered tuple
+ * - <tt>swapBufferedTuples(uint64_t, uint64_t)</tt>
+ */
+template <class Algorithm>
+class Shuffle {
+public:
+    typedef typename Algorithm::state_type state_type;
+    typedef typename Algorithm::tuple_type tuple_type;
+
+    static void transition(state_type &state, const tuple_type &tuple);
+    static void permute(state_type &state);
+    static void flush(state_type &state);
+
+private:
+    static uint64_t uniformIndex(uint64_t inEnd);
+};
+
+/**
+ * @brief Add a tuple to the buffer, and apply the gradient step of the tuple
+ *     it evicts
+ */
+template <class Algorithm>
+void
+Shuffle<Algorithm>::transition(state_type &state, const tuple_type &tuple) {
+    if (!state.isBufferFull()) {
+        state.bufferTuple(tuple);
+        return;
+    }
+
+    uint64_t numBuffered = state.algo.numBuffered;
+    uint64_t k = uniformIndex(numBuffered + 1);
+    if (k == numBuffered) {
+        Algorithm::transitionWithLoss(state, tuple);
+    } else {
+        tuple_type evicted;
+        state.bufferedTuple(k, evicted);
+        Algorithm::transitionWithLoss(state, evicted);
+        state.setBufferedTuple(k, tuple);
+    }
+}
+
+/**
+ * @brief Put the buffered tuples into random order (Fisher-Yates)
+ */
+template <class Algorithm>
+void
+Shuffle<Algorithm>::permute(state_type &state) {
+    for (uint64_t k = state.algo.numBuffered; k > 1; k--) {
+        uint64_t l = uniformIndex(k);
+        if (l != k - 1)
+            state.swapBufferedTuples(l, k - 1);
+    }
+}
+
+/**
+ * @brief Apply the gradient steps of all buffered tuples in random order, and
+ *     empty the buffer
+ */
+template <class Algorithm>
+void
+Shuffle<Algorithm>::flush(state_type &state) {
+    permute(state);
+
+    tuple_type tuple;
+    for (uint64_t k = 0; k < state.algo.numBuffered; k++) {
+        state.bufferedTuple(k, tuple);
+        Algorithm::transitionWithLoss(state, tuple);
+    }
+    state.algo.numBuffered = 0;
+}
+
+/**
+ * @brief Return a pseudo-random integer that is uniform in [0, inEnd)
+ */
+template <class Algorithm>
+uint64_t
+Shuffle<Algorithm>::uniformIndex(uint64_t inEnd) {
+    // using madlib::dbconnector::$database::NativeRandomNumberGenerator
+    NativeRandomNumberGenerator rng;
+    double u = (rng() - rng.min()) / (rng.max() - rng.min());
+    return std::min(static_cast<uint64_t>(u * static_cast<double>(inEnd)),
+        inEnd - 1);
+}
+
+} // namespace convex
+
+} // namespace modules
+
+} // namespace madlib
+
+#endif
@@ -8,3 +8,4 @@
 
 #include "lmf_igd.hpp"
 
+#include "glm_igd.hpp"
@@ -0,0 +1,424 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file glm_igd.cpp
+ *
+ * @brief Linear models with convex loss (least squares, logistic regression,
+ *     linear support vector machines) trained by incremental gradient descent
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#include <dbconnector/dbconnector.hpp>
+#include <modules/shared/HandleTraits.hpp>
+#include <modules/shared/StepSizePolicy.hpp>
+
+#include "glm_igd.hpp"
+
+#include "task/glm.hpp"
+#include "algo/igd.hpp"
+#include "algo/loss.hpp"
+#include "algo/shuffle.hpp"
+
+#include "type/tuple.hpp"
+#include "type/model.hpp"
+#include "type/state.hpp"
+
+namespace madlib {
+
+namespace modules {
+
+namespace convex {
+
+typedef GLMIGDState<MutableArrayHandle<double> > GLMMutableState;
+typedef GLMIGDState<ArrayHandle<double> > GLMState;
+typedef LinearModel<MutableArrayHandle<double> > GLMModel;
+
+typedef IGD<GLMMutableState, GLMState, GLM<GLMModel, GLMTuple, SquaredLoss> >
+    OLSIGDAlgorithm;
+typedef IGD<GLMMutableState, GLMState, GLM<GLMModel, GLMTuple, LogisticLoss> >
+    LogisticIGDAlgorithm;
+typedef IGD<GLMMutableState, GLMState, GLM<GLMModel, GLMTuple, HingeLoss> >
+    LinearSVMIGDAlgorithm;
+
+typedef IGD<GLMMutableState, GLMState,
+        GLM<GLMModel, GLMSparseTuple, SquaredLoss> > OLSSparseIGDAlgorithm;
+typedef IGD<GLMMutableState, GLMState,
+        GLM<GLMModel, GLMSparseTuple, LogisticLoss> > LogisticSparseIGDAlgorithm;
+typedef IGD<GLMMutableState, GLMState,
+        GLM<GLMModel, GLMSparseTuple, HingeLoss> > LinearSVMSparseIGDAlgorithm;
+
+// The loss is accumulated by IGD::transitionWithLoss(), so the only function
+// needed from Loss is merge(), which does not depend on the task
+typedef Loss<GLMMutableState, GLMState, GLM<GLMModel, GLMTuple, SquaredLoss> >
+    GLMLossAlgorithm;
+
+/**
+ * @brief Gradient step followed by the shrinkage of L2 regularization
+ *
+ * This has the interface of IGD needed by Shuffle.
+ */
+template <class Algorithm>
+struct RegularizedIGD {
+    typedef typename Algorithm::state_type state_type;
+    typedef typename Algorithm::tuple_type tuple_type;
+
+    static void transitionWithLoss(state_type &state,
+            const tuple_type &tuple) {
+        Algorithm::transitionWithLoss(state, tuple);
+        state.regularize();
+    }
+};
+
+/**
+ * @brief Initialize the state with the first tuple of an iteration
+ *
+ * Arguments are the previous state (or Null in the first iteration), the
+ * dimension, and the argument values of stepsize, stepsize_policy, lambda,
+ * and shuffle_window, which are only used in the first iteration.
+ */
+void
+glmIGDInitialize(GLMMutableState &state, const Allocator &inAllocator,
+        const AnyType &inPreviousState, uint64_t inDimension,
+        const AnyType &inStepsize, const AnyType &inStepsizePolicy,
+        const AnyType &inLambda, const AnyType &inShuffleWindow) {
+
+    if (!inPreviousState.isNull()) {
+        GLMState previousState = inPreviousState;
+        if (previousState.task.dimension != inDimension)
+            throw std::runtime_error("Inconsistent numbers of independent "
+                "variables.");
+
+        state.allocate(inAllocator, previousState.task.dimension,
+            previousState.stepsizePolicy(), previousState.task.shuffleWindow);
+        state = previousState;
+    } else {
+        if (inDimension > std::numeric_limits<uint32_t>::max())
+            throw std::domain_error("Number of independent variables "
+                "cannot be larger than 2^32 - 1.");
+
+        double stepsize = inStepsize.getAs<double>();
+        if (stepsize <= 0.)
+            throw std::runtime_error("Invalid parameter: stepsize <= 0.0");
+        StepSizePolicy stepsizePolicy = inStepsizePolicy.isNull()
+            ? kConstantStepSize
+            : stepSizePolicyFromString(inStepsizePolicy.getAs<char*>());
+        double lambda = inLambda.isNull() ? 0. : inLambda.getAs<double>();
+        if (lambda < 0.)
+            throw std::runtime_error("Invalid parameter: lambda < 0.0");
+        if (stepsize * lambda >= 1.)
+            throw std::runtime_error("Invalid parameter: stepsize * lambda "
+                ">= 1.0");
+        int32_t shuffleWindow = inShuffleWindow.isNull()
+            ? 0 : inShuffleWindow.getAs<int32_t>();
+        if (shuffleWindow < 0)
+            throw std::runtime_error("Invalid parameter: shuffle_window < 0");
+
+        state.allocate(inAllocator, static_cast<uint32_t>(inDimension),
+            stepsizePolicy, static_cast<uint32_t>(shuffleWindow));
+        state.task.stepsize = stepsize;
+        state.task.lambda = lambda;
+    }
+    // resetting in either case
+    state.reset();
+}
+
+/**
+ * @brief Perform the transition step of any linear model with dense
+ *     independent variables
+ *
+ * Arguments are (state, ind_var, dep_var, previous_state, stepsize,
+ * stepsize_policy, lambda, shuffle_window). The dependent variable has
+ * already been converted to \c inY.
+ */
+template <class Algorithm>
+AnyType
+glmIGDTransition(AnyType &args, const Allocator &inAllocator, double inY) {
+    GLMMutableState state = args[0];
+    MappedColumnVector x = args[1].getAs<MappedColumnVector>();
+
+    // The following check was added with MADLIB-138.
+    if (!x.is_finite())
+        throw std::domain_error("Design matrix is not finite.");
+
+    // initilize the state if first tuple
+    if (state.algo.numRows == 0) {
+        glmIGDInitialize(state, inAllocator, args[3], x.size(), args[4],
+            args[5], args[6], args[7]);
+    } else if (state.task.dimension != x.size()) {
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+    }
+
+    GLMTuple tuple;
+    tuple.indVar.rebind(x.memoryHandle(), x.size());
+    tuple.depVar = inY;
+    if (state.isShuffled())
+        Shuffle<RegularizedIGD<Algorithm> >::transition(state, tuple);
+    else
+        RegularizedIGD<Algorithm>::transitionWithLoss(state, tuple);
+    state.algo.numRows++;
+
+    return state;
+}
+
+/**
+ * @brief Perform the transition step of any linear model with sparse
+ *     independent variables
+ *
+ * The arguments from inFirstArg on are (previous_state, dimension, stepsize,
+ * stepsize_policy, lambda). The gradient step only visits the non-zero
+ * coordinates, see task/glm.hpp. Tuples are not shuffled, as the buffer
+ * would store them densely.
+ */
+template <class Algorithm>
+AnyType
+glmSparseIGDTransition(AnyType &args, const Allocator &inAllocator,
+        const SparseVector &inX, double inY, uint16_t inFirstArg) {
+    GLMMutableState state = args[0];
+
+    // initilize the state if first tuple
+    if (state.algo.numRows == 0) {
+        uint32_t dimension = args[inFirstArg + 1].getAs<uint32_t>();
+        if (dimension == 0)
+            throw std::runtime_error("Invalid parameter: dimension = 0");
+        glmIGDInitialize(state, inAllocator, args[inFirstArg], dimension,
+            args[inFirstArg + 2], args[inFirstArg + 3], args[inFirstArg + 4],
+            Null());
+    }
+
+    uint32_t dimension = state.task.dimension;
+    for (uint32_t k = 0; k < inX.nnz; k++) {
+        if (inX.indices[k] < inX.indexBase
+                || static_cast<uint32_t>(inX.indices[k] - inX.indexBase)
+                    >= dimension)
+            throw std::runtime_error("Index of independent variable out of "
+                "range.");
+        if (!boost::math::isfinite(inX.values[k]))
+            throw std::domain_error("Design matrix is not finite.");
+    }
+
+    GLMSparseTuple tuple;
+    tuple.indVar = inX;
+    tuple.depVar = inY;
+    RegularizedIGD<Algorithm>::transitionWithLoss(state, tuple);
+    state.algo.numRows++;
+
+    return state;
+}
+
+/**
+ * @brief Perform the transition step of any linear model with independent
+ *     variables given as arrays of indices and values
+ *
+ * Arguments are (state, indices, values, dep_var, previous_state, dimension,
+ * stepsize, stepsize_policy, lambda).
+ */
+template <class Algorithm>
+AnyType
+glmArraysIGDTransition(AnyType &args, const Allocator &inAllocator,
+        double inY) {
+    ArrayHandle<int32_t> indices = args[1].getAs<ArrayHandle<int32_t> >();
+    ArrayHandle<double> values = args[2].getAs<ArrayHandle<double> >();
+
+    if (indices.size() != values.size())
+        throw std::runtime_error("Indices and values of the independent "
+            "variables differ in length.");
+
+    SparseVector x;
+    x.indices = indices.ptr();
+    x.values = values.ptr();
+    x.nnz = static_cast<uint32_t>(indices.size());
+    x.indexBase = 1;
+    return glmSparseIGDTransition<Algorithm>(args, inAllocator, x, inY, 4);
+}
+
+/**
+ * @brief Perform the transition step of any linear model with independent
+ *     variables of type svec
+ *
+ * Arguments are (state, ind_var, dep_var, previous_state, dimension,
+ * stepsize, stepsize_policy, lambda). The tuple refers to the storage of the
+ * SparseColumnVector that the svec is converted to.
+ */
+template <class Algorithm>
+AnyType
+glmSvecIGDTransition(AnyType &args, const Allocator &inAllocator,
+        double inY) {
+    SparseColumnVector indVar = args[1].getAs<SparseColumnVector>();
+
+    SparseVector x;
+    x.indices = indVar._innerIndexPtr();
+    x.values = indVar._valuePtr();
+    x.nnz = static_cast<uint32_t>(indVar.nonZeros());
+    x.indexBase = 0;
+    return glmSparseIGDTransition<Algorithm>(args, inAllocator, x, inY, 3);
+}
+
+/**
+ * @brief Perform the perliminary aggregation function: Merge transition states
+ */
+template <class Algorithm>
+AnyType
+glmIGDMerge(AnyType &args) {
+    GLMMutableState stateLeft = args[0];
+    GLMState stateRight = args[1];
+
+    // We first handle the trivial case where this function is called with one
+    // of the states being the initial state
+    if (stateLeft.algo.numRows == 0) { return stateRight; }
+    else if (stateRight.algo.numRows == 0) { return stateLeft; }
+
+    // Merge states together
+    Shuffle<RegularizedIGD<Algorithm> >::flush(stateLeft);
+    Algorithm::merge(stateLeft, stateRight);
+    GLMLossAlgorithm::merge(stateLeft, stateRight);
+    // The following numRows update, cannot be put above, because the model
+    // averaging depends on their original values
+    stateLeft.algo.numRows += stateRight.algo.numRows;
+    // The rows still buffered in the right state are processed with the
+    // merged model, see lmf_igd_merge
+    for (uint64_t k = 0; k < stateRight.algo.numBuffered; k++) {
+        GLMTuple tuple;
+        stateRight.bufferedTuple(k, tuple);
+        stateLeft.bufferTuple(tuple);
+    }
+
+    return stateLeft;
+}
+
+/**
+ * @brief Perform the final step of any linear model
+ */
+template <class Algorithm>
+AnyType
+glmIGDFinal(AnyType &args) {
+    // We request a mutable object. Depending on the backend, this might perform
+    // a deep copy.
+    GLMMutableState state = args[0];
+
+    // Aggregates that haven't seen any data just return Null.
+    if (state.algo.numRows == 0) { return Null(); }
+
+    Shuffle<RegularizedIGD<Algorithm> >::flush(state);
+    Algorithm::final(state);
+    // The result and the next iteration see plain coefficients
+    state.normalize();
+    state.computeLoss();
+
+    return state;
+}
+
+AnyType
+ols_igd_transition::run(AnyType &args) {
+    return glmIGDTransition<OLSIGDAlgorithm>(args, *this,
+        args[2].getAs<double>());
+}
+
+AnyType
+ols_igd_sparse_transition::run(AnyType &args) {
+    return glmArraysIGDTransition<OLSSparseIGDAlgorithm>(args, *this,
+        args[3].getAs<double>());
+}
+
+AnyType
+ols_igd_svec_transition::run(AnyType &args) {
+    return glmSvecIGDTransition<OLSSparseIGDAlgorithm>(args, *this,
+        args[2].getAs<double>());
+}
+
+AnyType
+ols_igd_merge::run(AnyType &args) {
+    return glmIGDMerge<OLSIGDAlgorithm>(args);
+}
+
+AnyType
+ols_igd_final::run(AnyType &args) {
+    return glmIGDFinal<OLSIGDAlgorithm>(args);
+}
+
+AnyType
+logistic_igd_transition::run(AnyType &args) {
+    return glmIGDTransition<LogisticIGDAlgorithm>(args, *this,
+        args[2].getAs<bool>() ? 1. : -1.);
+}
+
+AnyType
+logistic_igd_sparse_transition::run(AnyType &args) {
+    return glmArraysIGDTransition<LogisticSparseIGDAlgorithm>(args, *this,
+        args[3].getAs<bool>() ? 1. : -1.);
+}
+
+AnyType
+logistic_igd_svec_transition::run(AnyType &args) {
+    return glmSvecIGDTransition<LogisticSparseIGDAlgorithm>(args, *this,
+        args[2].getAs<bool>() ? 1. : -1.);
+}
+
+AnyType
+logistic_igd_merge::run(AnyType &args) {
+    return glmIGDMerge<LogisticIGDAlgorithm>(args);
+}
+
+AnyType
+logistic_igd_final::run(AnyType &args) {
+    return glmIGDFinal<LogisticIGDAlgorithm>(args);
+}
+
+AnyType
+linear_svm_igd_transition::run(AnyType &args) {
+    return glmIGDTransition<LinearSVMIGDAlgorithm>(args, *this,
+        args[2].getAs<bool>() ? 1. : -1.);
+}
+
+AnyType
+linear_svm_igd_sparse_transition::run(AnyType &args) {
+    return glmArraysIGDTransition<LinearSVMSparseIGDAlgorithm>(args, *this,
+        args[3].getAs<bool>() ? 1. : -1.);
+}
+
+AnyType
+linear_svm_igd_svec_transition::run(AnyType &args) {
+    return glmSvecIGDTransition<LinearSVMSparseIGDAlgorithm>(args, *this,
+        args[2].getAs<bool>() ? 1. : -1.);
+}
+
+AnyType
+linear_svm_igd_merge::run(AnyType &args) {
+    return glmIGDMerge<LinearSVMIGDAlgorithm>(args);
+}
+
+AnyType
+linear_svm_igd_final::run(AnyType &args) {
+    return glmIGDFinal<LinearSVMIGDAlgorithm>(args);
+}
+
+/**
+ * @brief Return the difference in average loss between two states
+ */
+AnyType
+internal_glm_igd_distance::run(AnyType &args) {
+    GLMState stateLeft = args[0];
+    GLMState stateRight = args[1];
+
+    return std::abs(stateLeft.task.loss - stateRight.task.loss);
+}
+
+/**
+ * @brief Return the coefficients and the average loss of the state
+ */
+AnyType
+internal_glm_igd_result::run(AnyType &args) {
+    GLMState state = args[0];
+
+    AnyType tuple;
+    tuple << state.result()
+        << static_cast<double>(state.task.loss)
+        << static_cast<int64_t>(state.task.numPasses);
+
+    return tuple;
+}
+
+} // namespace convex
+
+} // namespace modules
+
+} // namespace madlib
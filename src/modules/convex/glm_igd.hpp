@@ -0,0 +1,100 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file glm_igd.hpp
+ *
+ *//* ----------------------------------------------------------------------- */
+
+/**
+ * @brief Least squares (incremental gradient): Transition function
+ */
+DECLARE_UDF(convex, ols_igd_transition)
+
+/**
+ * @brief Least squares (incremental gradient): Transition function for sparse
+ *     independent variables
+ */
+DECLARE_UDF(convex, ols_igd_sparse_transition)
+
+/**
+ * @brief Least squares (incremental gradient): Transition function for svec
+ *     independent variables
+ */
+DECLARE_UDF(convex, ols_igd_svec_transition)
+
+/**
+ * @brief Least squares (incremental gradient): State merge function
+ */
+DECLARE_UDF(convex, ols_igd_merge)
+
+/**
+ * @brief Least squares (incremental gradient): Final function
+ */
+DECLARE_UDF(convex, ols_igd_final)
+
+/**
+ * @brief Logistic regression (incremental gradient): Transition function
+ */
+DECLARE_UDF(convex, logistic_igd_transition)
+
+/**
+ * @brief Logistic regression (incremental gradient): Transition function for
+ *     sparse independent variables
+ */
+DECLARE_UDF(convex, logistic_igd_sparse_transition)
+
+/**
+ * @brief Logistic regression (incremental gradient): Transition function for
+ *     svec independent variables
+ */
+DECLARE_UDF(convex, logistic_igd_svec_transition)
+
+/**
+ * @brief Logistic regression (incremental gradient): State merge function
+ */
+DECLARE_UDF(convex, logistic_igd_merge)
+
+/**
+ * @brief Logistic regression (incremental gradient): Final function
+ */
+DECLARE_UDF(convex, logistic_igd_final)
+
+/**
+ * @brief Linear support vector machine (incremental gradient): Transition
+ *     function
+ */
+DECLARE_UDF(convex, linear_svm_igd_transition)
+
+/**
+ * @brief Linear support vector machine (incremental gradient): Transition
+ *     function for sparse independent variables
+ */
+DECLARE_UDF(convex, linear_svm_igd_sparse_transition)
+
+/**
+ * @brief Linear support vector machine (incremental gradient): Transition
+ *     function for svec independent variables
+ */
+DECLARE_UDF(convex, linear_svm_igd_svec_transition)
+
+/**
+ * @brief Linear support vector machine (incremental gradient): State merge
+ *     function
+ */
+DECLARE_UDF(convex, linear_svm_igd_merge)
+
+/**
+ * @brief Linear support vector machine (incremental gradient): Final function
+ */
+DECLARE_UDF(convex, linear_svm_igd_final)
+
+/**
+ * @brief Linear models (incremental gradient): Difference in average loss
+ *     between two transition states
+ */
+DECLARE_UDF(convex, internal_glm_igd_distance)
+
+/**
+ * @brief Linear models (incremental gradient): Convert transition state to
+ *     result tuple
+ */
+DECLARE_UDF(convex, internal_glm_igd_result)
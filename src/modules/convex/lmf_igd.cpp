@@ -8,12 +8,15 @@
 
 #include <dbconnector/dbconnector.hpp>
 #include <modules/shared/HandleTraits.hpp>
+#include <modules/shared/StepSizePolicy.hpp>
 
 #include "lmf_igd.hpp"
 
 #include "task/lmf.hpp"
 #include "algo/igd.hpp"
 #include "algo/loss.hpp"
+#include "algo/hogwild.hpp"
+#include "algo/shuffle.hpp"
 
 #include "type/tuple.hpp"
 #include "type/model.hpp"
@@ -32,6 +35,25 @@ typedef IGD<LMFIGDState<MutableArrayHandle<double> >, LMFIGDState<ArrayHandle<do
 typedef Loss<LMFIGDState<MutableArrayHandle<double> >, LMFIGDState<ArrayHandle<double> >,
         LMF<LMFModel<MutableArrayHandle<double> >, LMFTuple > > LMFLossAlgorithm;
 
+typedef LMF<LMFModel<MutableArrayHandle<double> >, LMFTuple> LMFTask;
+
+typedef Hogwild<LMFIGDAlgorithm> LMFHogwildAlgorithm;
+typedef Shuffle<LMFIGDAlgorithm> LMFShuffleAlgorithm;
+
+/**
+ * @brief Apply the gradient steps of all buffered tuples and empty the buffer
+ */
+void
+lmfIGDFlush(LMFIGDState<MutableArrayHandle<double> > &state) {
+    if (state.numThreads() > 1) {
+        if (state.isShuffled())
+            LMFShuffleAlgorithm::permute(state);
+        LMFHogwildAlgorithm::flush(state);
+    } else {
+        LMFShuffleAlgorithm::flush(state);
+    }
+}
+
 /**
  * @brief Perform the low-rank matrix factorization transition step
  *
@@ -50,19 +72,22 @@ lmf_igd_transition::run(AnyType &args) {
         if (!args[4].isNull()) {
             LMFIGDState<ArrayHandle<double> > previousState = args[4];
             state.allocate(*this, previousState.task.rowDim,
-                    previousState.task.colDim, previousState.task.maxRank);
+                    previousState.task.colDim, previousState.task.maxRank,
+                    previousState.stepsizePolicy(),
+                    previousState.numThreads(),
+                    previousState.task.shuffleWindow);
             state = previousState;
         } else {
             // configuration parameters
-            uint16_t rowDim = args[5].getAs<uint16_t>();
+            uint32_t rowDim = args[5].getAs<uint32_t>();
             if (rowDim == 0) {
                 throw std::runtime_error("Invalid parameter: row_dim = 0");
             }
-            uint16_t columnDim = args[6].getAs<uint16_t>();
+            uint32_t columnDim = args[6].getAs<uint32_t>();
             if (columnDim == 0) {
                 throw std::runtime_error("Invalid parameter: column_dim = 0");
             }
-            uint16_t maxRank = args[7].getAs<uint16_t>();
+            uint32_t maxRank = args[7].getAs<uint32_t>();
             if (maxRank == 0) {
                 throw std::runtime_error("Invalid parameter: max_rank = 0");
             }
@@ -75,10 +100,59 @@ lmf_igd_transition::run(AnyType &args) {
                 throw std::runtime_error("Invalid parameter: scale_factor <= "
                         "0.0");
             }
+            StepSizePolicy stepsizePolicy = args[10].isNull()
+                ? kConstantStepSize
+                : stepSizePolicyFromString(args[10].getAs<char*>());
+            uint32_t numThreads = args[11].isNull()
+                ? 1 : args[11].getAs<uint32_t>();
+            if (numThreads == 0
+                || numThreads > LMFHogwildAlgorithm::kMaxNumThreads) {
+                std::stringstream errorMsg;
+                errorMsg << "Invalid parameter: num_threads must be between 1 "
+                    "and " << LMFHogwildAlgorithm::kMaxNumThreads;
+                throw std::runtime_error(errorMsg.str());
+            }
+            int32_t shuffleWindow = args[12].isNull()
+                ? 0 : args[12].getAs<int32_t>();
+            if (shuffleWindow < 0) {
+                throw std::runtime_error("Invalid parameter: shuffle_window "
+                        "< 0");
+            }
+            double tolerance = args[13].isNull()
+                ? 0. : args[13].getAs<double>();
+            if (tolerance < 0.) {
+                throw std::runtime_error("Invalid parameter: tolerance < 0.0");
+            }
+            int32_t patience = args[14].isNull()
+                ? 1 : args[14].getAs<int32_t>();
+            if (patience < 1) {
+                throw std::runtime_error("Invalid parameter: patience < 1");
+            }
+            double decayFactor = args[15].isNull()
+                ? 1. : args[15].getAs<double>();
+            if (decayFactor <= 0. || decayFactor > 1.) {
+                throw std::runtime_error("Invalid parameter: decay_factor "
+                        "must be in (0, 1]");
+            }
+            double holdoutFraction = args[16].isNull()
+                ? 0. : args[16].getAs<double>();
+            if (holdoutFraction < 0. || holdoutFraction >= 1.) {
+                throw std::runtime_error("Invalid parameter: "
+                        "holdout_fraction must be in [0, 1)");
+            }
+            bool isRelativeTolerance = args[17].isNull()
+                ? false : args[17].getAs<bool>();
 
-            state.allocate(*this, rowDim, columnDim, maxRank);
+            state.allocate(*this, rowDim, columnDim, maxRank, stepsizePolicy,
+                    static_cast<uint16_t>(numThreads),
+                    static_cast<uint32_t>(shuffleWindow));
             state.task.stepsize = stepsize;
-            state.task.model.initialize(scaleFactor);
+            state.task.tolerance = tolerance;
+            state.task.patience = static_cast<uint32_t>(patience);
+            state.task.decayFactor = decayFactor;
+            state.task.holdoutFraction = holdoutFraction;
+            state.task.isRelativeTolerance = isRelativeTolerance;
+            state.task.model.initialize(scaleFactor, maxRank);
         }
         // resetting in either case
         state.reset();
@@ -86,20 +160,43 @@ lmf_igd_transition::run(AnyType &args) {
 
     // tuple
     LMFTuple tuple;
-    tuple.indVar.i = args[1].getAs<uint16_t>();
-    tuple.indVar.j = args[2].getAs<uint16_t>();
+    tuple.indVar.i = args[1].getAs<uint32_t>();
+    tuple.indVar.j = args[2].getAs<uint32_t>();
     if (tuple.indVar.i == 0 || tuple.indVar.j == 0) {
         throw std::runtime_error("Invalid parameter: [col_row] = 0 or "
                 "[col_column] = 0 in table [rel_source]");
     }
+    if (tuple.indVar.i > state.task.rowDim
+        || tuple.indVar.j > state.task.colDim) {
+        throw std::runtime_error("Invalid parameter: [col_row] > row_dim or "
+                "[col_column] > column_dim in table [rel_source]");
+    }
     // database starts from 1, while C++ starts from 0
     tuple.indVar.i --;
     tuple.indVar.j --;
     tuple.depVar = args[3].getAs<double>();
 
-    // Now do the transition step
-    LMFIGDAlgorithm::transition(state, tuple);
-    LMFLossAlgorithm::transition(state, tuple);
+    // Holdout rows are only evaluated, with the model just before them
+    if (state.hasHoldout() && state.isHoldout(tuple)) {
+        state.algo.holdoutLoss += LMFTask::loss(state.task.model,
+            tuple.indVar, tuple.depVar);
+        state.algo.numHoldoutRows ++;
+        state.algo.numRows ++;
+        return state;
+    }
+
+    // Now do the transition step. With several threads, the gradient steps
+    // are deferred until the buffer is full. With a shuffle window (and a
+    // single thread), each tuple evicts a random buffered tuple.
+    if (state.numThreads() > 1) {
+        state.bufferTuple(tuple);
+        if (state.isBufferFull())
+            lmfIGDFlush(state);
+    } else if (state.isShuffled()) {
+        LMFShuffleAlgorithm::transition(state, tuple);
+    } else {
+        LMFIGDAlgorithm::transitionWithLoss(state, tuple);
+    }
     state.algo.numRows ++;
 
     return state;
@@ -119,11 +216,22 @@ lmf_igd_merge::run(AnyType &args) {
     else if (stateRight.algo.numRows == 0) { return stateLeft; }
 
     // Merge states together
+    lmfIGDFlush(stateLeft);
     LMFIGDAlgorithm::merge(stateLeft, stateRight);
     LMFLossAlgorithm::merge(stateLeft, stateRight);
     // The following numRows update, cannot be put above, because the model
     // averaging depends on their original values
     stateLeft.algo.numRows += stateRight.algo.numRows;
+    stateLeft.algo.numHoldoutRows += stateRight.algo.numHoldoutRows;
+    stateLeft.algo.holdoutLoss += stateRight.algo.holdoutLoss;
+    // The rows still buffered in the right state are processed with the
+    // merged model. Both buffers have the same size, and the left one is
+    // empty now.
+    for (uint64_t k = 0; k < stateRight.algo.numBuffered; k++) {
+        LMFTuple tuple;
+        stateRight.bufferedTuple(k, tuple);
+        stateLeft.bufferTuple(tuple);
+    }
 
     return stateLeft;
 }
@@ -141,12 +249,11 @@ lmf_igd_final::run(AnyType &args) {
     if (state.algo.numRows == 0) { return Null(); }
 
     // finalizing
+    lmfIGDFlush(state);
     LMFIGDAlgorithm::final(state);
     // LMFLossAlgorithm::final(state); // empty function call causes a warning
     state.computeRMSE();
-
-    // for stepsize tuning
-    dberr << "RMSE: " << state.task.RMSE << std::endl;
+    state.updateConvergence();
 
     return state;
 }
@@ -162,6 +269,42 @@ internal_lmf_igd_distance::run(AnyType &args) {
     return std::abs(stateLeft.task.RMSE - stateRight.task.RMSE);
 }
 
+/**
+ * @brief Return whether the iterations should stop, see
+ *     LMFIGDState::updateConvergence()
+ */
+AnyType
+internal_lmf_igd_converged::run(AnyType &args) {
+    LMFIGDState<ArrayHandle<double> > state = args[0];
+
+    return static_cast<bool>(state.task.isConverged);
+}
+
+/**
+ * @brief Return the RMSE on the holdout rows (Null if there are none)
+ */
+AnyType
+internal_lmf_igd_holdout_rmse::run(AnyType &args) {
+    LMFIGDState<ArrayHandle<double> > state = args[0];
+
+    if (!state.hasHoldout()) { return Null(); }
+    return static_cast<double>(state.task.holdoutRMSE);
+}
+
+/**
+ * @brief Set whether Hogwild behaves as if no thread could be created, and
+ *     return the previous setting
+ *
+ * This only affects the current backend (on Greenplum: not the segments).
+ */
+AnyType
+internal_lmf_igd_disable_threads::run(AnyType &args) {
+    bool wasDisabled = LMFHogwildAlgorithm::isThreadCreationDisabled;
+    LMFHogwildAlgorithm::isThreadCreationDisabled = args[0].getAs<bool>();
+
+    return wasDisabled;
+}
+
 /**
  * @brief Return the coefficients and diagnostic statistics of the state
  */
@@ -169,8 +312,11 @@ AnyType
 internal_lmf_igd_result::run(AnyType &args) {
     LMFIGDState<ArrayHandle<double> > state = args[0];
 
-    Matrix U = trans(state.task.model.matrixU);
-    Matrix V = trans(state.task.model.matrixV);
+    // The factors are stored as latent vectors (columns, without padding
+    // here), and each column becomes a row of the returned array
+    Index maxRank = static_cast<uint32_t>(state.task.maxRank);
+    Matrix U = state.result().matrixU.topRows(maxRank);
+    Matrix V = state.result().matrixV.topRows(maxRank);
     double RMSE = state.task.RMSE;
 
     AnyType tuple;
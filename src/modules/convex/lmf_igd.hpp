@@ -25,6 +25,24 @@ DECLARE_UDF(convex, lmf_igd_final)
  */
 DECLARE_UDF(convex, internal_lmf_igd_distance)
 
+/**
+ * @brief Low-rank matrix factorization (incremental gradient): Whether the
+ *     iterations have converged
+ */
+DECLARE_UDF(convex, internal_lmf_igd_converged)
+
+/**
+ * @brief Low-rank matrix factorization (incremental gradient): RMSE on the
+ *     holdout rows
+ */
+DECLARE_UDF(convex, internal_lmf_igd_holdout_rmse)
+
+/**
+ * @brief Low-rank matrix factorization (incremental gradient): Process all
+ *     Hogwild slices in the backend thread (for testing)
+ */
+DECLARE_UDF(convex, internal_lmf_igd_disable_threads)
+
 /**
  * @brief Low-rank matrix factorization (incremental gradient): Convert
  *     transition state to result tuple
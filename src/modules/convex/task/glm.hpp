@@ -0,0 +1,317 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file glm.hpp
+ *
+ * This file contains objective function related computation for linear
+ * models with a convex loss, i.e., least squares, logistic regression, and
+ * linear support vector machines. They are called by classes in algo/.
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_MODULES_CONVEX_TASK_GLM_HPP_
+#define MADLIB_MODULES_CONVEX_TASK_GLM_HPP_
+
+#include <modules/convex/type/independent_variables.hpp>
+
+namespace madlib {
+
+namespace modules {
+
+namespace convex {
+
+// Use Eigen
+using namespace madlib::dbal::eigen_integration;
+
+/**
+ * @brief Squared loss \f$ (p - y)^2 \f$ of prediction p (least squares)
+ */
+struct SquaredLoss {
+    static inline double loss(double p, double y) {
+        double e = p - y;
+        return e * e;
+    }
+
+    static inline double derivative(double p, double y) {
+        return 2. * (p - y);
+    }
+};
+
+/**
+ * @brief Logistic loss \f$ \ln(1 + \exp(-y p)) \f$ for labels
+ *     \f$ y \in \{ -1, 1 \} \f$ (logistic regression)
+ */
+struct LogisticLoss {
+    static inline double loss(double p, double y) {
+        // Avoid overflow of exp() for large margins
+        double z = y * p;
+        return z > 0 ? std::log(1. + std::exp(-z))
+                     : -z + std::log(1. + std::exp(z));
+    }
+
+    static inline double derivative(double p, double y) {
+        return -y / (1. + std::exp(y * p));
+    }
+};
+
+/**
+ * @brief Hinge loss \f$ \max(0, 1 - y p) \f$ for labels
+ *     \f$ y \in \{ -1, 1 \} \f$ (linear support vector machine)
+ *
+ * The loss is not differentiable at \f$ y p = 1 \f$, where we use the
+ * subgradient 0.
+ */
+struct HingeLoss {
+    static inline double loss(double p, double y) {
+        return std::max(0., 1. - y * p);
+    }
+
+    static inline double derivative(double p, double y) {
+        return y * p < 1. ? -y : 0.;
+    }
+};
+
+/**
+ * @name Linear algebra on the independent variables
+ *
+ * The GLM kernels only access the independent variables through these
+ * functions, which have one overload for dense and one for sparse vectors.
+ * For sparse vectors, they only visit the non-zero coordinates, so that a
+ * gradient step costs O(nnz) instead of O(dimension). The model is a
+ * LinearModel, i.e., a scale factor times a vector.
+ */
+//@{
+
+/**
+ * @brief Inner product of the coefficients and x
+ */
+template <class Model>
+inline double
+innerProduct(const Model &model, const MappedColumnVector &x) {
+    return model.scale * model.vector.dot(x);
+}
+
+template <class Model>
+inline double
+innerProduct(const Model &model, const SparseVector &x) {
+    double sum = 0.;
+    for (uint32_t k = 0; k < x.nnz; k++)
+        sum += model.vector(x.indices[k] - x.indexBase) * x.values[k];
+    return model.scale * sum;
+}
+
+/**
+ * @brief Add c times x to the coefficients
+ */
+template <class Model>
+inline void
+addScaled(Model &model, double c, const MappedColumnVector &x) {
+    model.vector += (c / model.scale) * x;
+}
+
+template <class Model>
+inline void
+addScaled(Model &model, double c, const SparseVector &x) {
+    c /= model.scale;
+    for (uint32_t k = 0; k < x.nnz; k++)
+        model.vector(x.indices[k] - x.indexBase) += c * x.values[k];
+}
+
+/**
+ * @brief AdaGrad step along the gradient derivative times x
+ *
+ * The sums of squares have scale factor 1, see LinearModel.
+ */
+template <class Model>
+inline void
+adaGradStep(Model &model, const Model &sumOfSquares, Model &incrSumOfSquares,
+        double stepsize, double derivative, const MappedColumnVector &x) {
+    incrSumOfSquares.vector.array() += (derivative * x).array().square();
+    model.vector.array() -= (stepsize * derivative / model.scale) * x.array()
+        / ((sumOfSquares.vector + incrSumOfSquares.vector).array().sqrt()
+            + kAdaGradEpsilon);
+}
+
+template <class Model>
+inline void
+adaGradStep(Model &model, const Model &sumOfSquares, Model &incrSumOfSquares,
+        double stepsize, double derivative, const SparseVector &x) {
+    double c = stepsize * derivative / model.scale;
+    for (uint32_t k = 0; k < x.nnz; k++) {
+        Index i = x.indices[k] - x.indexBase;
+        double g = derivative * x.values[k];
+        incrSumOfSquares.vector(i) += g * g;
+        model.vector(i) -= c * x.values[k]
+            / (std::sqrt(sumOfSquares.vector(i) + incrSumOfSquares.vector(i))
+                + kAdaGradEpsilon);
+    }
+}
+
+//@}
+
+/**
+ * @brief Linear model with prediction \f$ p = w^T x \f$ and loss
+ *     <tt>LossFunction::loss(p, y)</tt>
+ *
+ * The gradient of the loss with respect to w is
+ * <tt>LossFunction::derivative(p, y)</tt> times x, so all losses share the
+ * same update kernels. The model is a LinearModel, and the independent
+ * variables are dense (MappedColumnVector) or sparse (SparseVector).
+ */
+template <class Model, class Tuple, class LossFunction>
+class GLM {
+public:
+    typedef Model model_type;
+    typedef Tuple tuple_type;
+    typedef typename Tuple::independent_variables_type
+        independent_variables_type;
+    typedef typename Tuple::dependent_variable_type dependent_variable_type;
+    // The prediction is needed for both the loss and the gradient, see
+    // HasFusedLossAndGradient
+    typedef void fused_loss_and_gradient;
+
+    static void gradient(
+            const model_type                    &model,
+            const independent_variables_type    &x,
+            const dependent_variable_type       &y,
+            model_type                          &gradient);
+
+    static void gradientInPlace(
+            model_type                          &model,
+            const independent_variables_type    &x,
+            const dependent_variable_type       &y,
+            const double                        &stepsize);
+
+    static void gradientInPlace(
+            model_type                          &model,
+            const independent_variables_type    &x,
+            const dependent_variable_type       &y,
+            const double                        &stepsize,
+            const model_type                    &sumOfSquares,
+            model_type                          &incrSumOfSquares);
+
+    static double lossAndGradientInPlace(
+            model_type                          &model,
+            const independent_variables_type    &x,
+            const dependent_variable_type       &y,
+            const double                        &stepsize);
+
+    static double lossAndGradientInPlace(
+            model_type                          &model,
+            const independent_variables_type    &x,
+            const dependent_variable_type       &y,
+            const double                        &stepsize,
+            const model_type                    &sumOfSquares,
+            model_type                          &incrSumOfSquares);
+
+    static double loss(
+            const model_type                    &model,
+            const independent_variables_type    &x,
+            const dependent_variable_type       &y);
+
+    static double predict(
+            const model_type                    &model,
+            const independent_variables_type    &x);
+};
+
+/**
+ * @brief Add the gradient of the loss at (x, y) to \c gradient
+ */
+template <class Model, class Tuple, class LossFunction>
+void
+GLM<Model, Tuple, LossFunction>::gradient(
+        const model_type                    &model,
+        const independent_variables_type    &x,
+        const dependent_variable_type       &y,
+        model_type                          &gradient) {
+    addScaled(gradient, LossFunction::derivative(predict(model, x), y), x);
+}
+
+template <class Model, class Tuple, class LossFunction>
+void
+GLM<Model, Tuple, LossFunction>::gradientInPlace(
+        model_type                          &model,
+        const independent_variables_type    &x,
+        const dependent_variable_type       &y,
+        const double                        &stepsize) {
+    lossAndGradientInPlace(model, x, y, stepsize);
+}
+
+template <class Model, class Tuple, class LossFunction>
+void
+GLM<Model, Tuple, LossFunction>::gradientInPlace(
+        model_type                          &model,
+        const independent_variables_type    &x,
+        const dependent_variable_type       &y,
+        const double                        &stepsize,
+        const model_type                    &sumOfSquares,
+        model_type                          &incrSumOfSquares) {
+    lossAndGradientInPlace(model, x, y, stepsize, sumOfSquares,
+        incrSumOfSquares);
+}
+
+/**
+ * @brief Gradient step, returning the loss before the step
+ */
+template <class Model, class Tuple, class LossFunction>
+double
+GLM<Model, Tuple, LossFunction>::lossAndGradientInPlace(
+        model_type                          &model,
+        const independent_variables_type    &x,
+        const dependent_variable_type       &y,
+        const double                        &stepsize) {
+    double p = predict(model, x);
+    double derivative = LossFunction::derivative(p, y);
+    // Many tuples are classified correctly with a margin (hinge loss), so
+    // skipping zero updates saves a pass over x
+    if (derivative != 0.)
+        addScaled(model, -stepsize * derivative, x);
+    return LossFunction::loss(p, y);
+}
+
+/**
+ * @brief Gradient step with AdaGrad per-coordinate step sizes, returning the
+ *     loss before the step
+ *
+ * See LMF::lossAndGradientInPlace() for the meaning of the sums of squares.
+ */
+template <class Model, class Tuple, class LossFunction>
+double
+GLM<Model, Tuple, LossFunction>::lossAndGradientInPlace(
+        model_type                          &model,
+        const independent_variables_type    &x,
+        const dependent_variable_type       &y,
+        const double                        &stepsize,
+        const model_type                    &sumOfSquares,
+        model_type                          &incrSumOfSquares) {
+    double p = predict(model, x);
+    double derivative = LossFunction::derivative(p, y);
+    if (derivative != 0.)
+        adaGradStep(model, sumOfSquares, incrSumOfSquares, stepsize,
+            derivative, x);
+    return LossFunction::loss(p, y);
+}
+
+template <class Model, class Tuple, class LossFunction>
+double
+GLM<Model, Tuple, LossFunction>::loss(
+        const model_type                    &model,
+        const independent_variables_type    &x,
+        const dependent_variable_type       &y) {
+    return LossFunction::loss(predict(model, x), y);
+}
+
+template <class Model, class Tuple, class LossFunction>
+double
+GLM<Model, Tuple, LossFunction>::predict(
+        const model_type                    &model,
+        const independent_variables_type    &x) {
+    return innerProduct(model, x);
+}
+
+} // namespace convex
+
+} // namespace modules
+
+} // namespace madlib
+
+#endif
@@ -27,6 +27,9 @@ public:
     typedef typename Tuple::independent_variables_type 
         independent_variables_type;
     typedef typename Tuple::dependent_variable_type dependent_variable_type;
+    // The error of the prediction is needed for both the loss and the
+    // gradient, see HasFusedLossAndGradient
+    typedef void fused_loss_and_gradient;
 
     static void gradient(
             const model_type                    &model,
@@ -39,7 +42,29 @@ public:
             const independent_variables_type    &x,
             const dependent_variable_type       &y, 
             const double                        &stepsize);
-    
+
+    static void gradientInPlace(
+            model_type                          &model,
+            const independent_variables_type    &x,
+            const dependent_variable_type       &y,
+            const double                        &stepsize,
+            const model_type                    &sumOfSquares,
+            model_type                          &incrSumOfSquares);
+
+    static double lossAndGradientInPlace(
+            model_type                          &model,
+            const independent_variables_type    &x,
+            const dependent_variable_type       &y,
+            const double                        &stepsize);
+
+    static double lossAndGradientInPlace(
+            model_type                          &model,
+            const independent_variables_type    &x,
+            const dependent_variable_type       &y,
+            const double                        &stepsize,
+            const model_type                    &sumOfSquares,
+            model_type                          &incrSumOfSquares);
+
     static double loss(
             const model_type                    &model, 
             const independent_variables_type    &x, 
@@ -64,30 +89,103 @@ template <class Model, class Tuple>
 void
 LMF<Model, Tuple>::gradientInPlace(
         model_type                          &model,
-        const independent_variables_type    &x, 
-        const dependent_variable_type       &y, 
+        const independent_variables_type    &x,
+        const dependent_variable_type       &y,
+        const double                        &stepsize) {
+    lossAndGradientInPlace(model, x, y, stepsize);
+}
+
+template <class Model, class Tuple>
+void
+LMF<Model, Tuple>::gradientInPlace(
+        model_type                          &model,
+        const independent_variables_type    &x,
+        const dependent_variable_type       &y,
+        const double                        &stepsize,
+        const model_type                    &sumOfSquares,
+        model_type                          &incrSumOfSquares) {
+    lossAndGradientInPlace(model, x, y, stepsize, sumOfSquares,
+        incrSumOfSquares);
+}
+
+/**
+ * @brief Gradient step, returning the loss before the step
+ */
+template <class Model, class Tuple>
+double
+LMF<Model, Tuple>::lossAndGradientInPlace(
+        model_type                          &model,
+        const independent_variables_type    &x,
+        const dependent_variable_type       &y,
         const double                        &stepsize) {
     // Please refer to the design document for an explanation of the following
-    double e = model.matrixU.row(x.i) * trans(model.matrixV.row(x.j)) - y;
-    RowVector temp = model.matrixU.row(x.i)
-        - stepsize * e * model.matrixV.row(x.j);
-    model.matrixV.row(x.j) -= stepsize * e * model.matrixU.row(x.i);
-    model.matrixU.row(x.i) = temp;
+    // Latent vectors are columns, see LMFModel
+    //
+    // The update is written coordinate-wise so that it does not allocate
+    // temporaries: It may run in worker threads (see Hogwild), where the
+    // backend memory allocator must not be called.
+    double *u = model.matrixU.col(x.i).data();
+    double *v = model.matrixV.col(x.j).data();
+    Index rank = model.matrixU.rows();
+    double e = model.matrixU.col(x.i).dot(model.matrixV.col(x.j)) - y;
+    double scale = stepsize * e;
+    for (Index r = 0; r < rank; r++) {
+        double ur = u[r];
+        u[r] = ur - scale * v[r];
+        v[r] -= scale * ur;
+    }
+    return e * e;
 }
 
+/**
+ * @brief Gradient step with AdaGrad per-coordinate step sizes, returning the
+ *     loss before the step
+ *
+ * The step size of each coordinate is divided by the square root of the sum
+ * of all squared gradient components seen so far. These are the sums from
+ * previous iterations (sumOfSquares) plus the sums from this iteration
+ * (incrSumOfSquares, which is updated here).
+ */
 template <class Model, class Tuple>
-double 
+double
+LMF<Model, Tuple>::lossAndGradientInPlace(
+        model_type                          &model,
+        const independent_variables_type    &x,
+        const dependent_variable_type       &y,
+        const double                        &stepsize,
+        const model_type                    &sumOfSquares,
+        model_type                          &incrSumOfSquares) {
+    // Coordinate-wise without temporaries, see the other overload
+    double *u = model.matrixU.col(x.i).data();
+    double *v = model.matrixV.col(x.j).data();
+    const double *sumU = sumOfSquares.matrixU.col(x.i).data();
+    const double *sumV = sumOfSquares.matrixV.col(x.j).data();
+    double *incrU = incrSumOfSquares.matrixU.col(x.i).data();
+    double *incrV = incrSumOfSquares.matrixV.col(x.j).data();
+    Index rank = model.matrixU.rows();
+    double e = model.matrixU.col(x.i).dot(model.matrixV.col(x.j)) - y;
+    for (Index r = 0; r < rank; r++) {
+        double gradientU = e * v[r];
+        double gradientV = e * u[r];
+        incrU[r] += gradientU * gradientU;
+        incrV[r] += gradientV * gradientV;
+        u[r] -= stepsize * gradientU
+            / (std::sqrt(sumU[r] + incrU[r]) + kAdaGradEpsilon);
+        v[r] -= stepsize * gradientV
+            / (std::sqrt(sumV[r] + incrV[r]) + kAdaGradEpsilon);
+    }
+    return e * e;
+}
+
+template <class Model, class Tuple>
+double
 LMF<Model, Tuple>::loss(
-        const model_type                    &model, 
-        const independent_variables_type    &x, 
+        const model_type                    &model,
+        const independent_variables_type    &x,
         const dependent_variable_type       &y) {
-    // HAYING: A chance for improvement by reusing the e computed in gradient.
-    // Perhaps we can add a book-keeping data structure in the model...
-    // Note: the value of e is different from the e in gradient if the
-    // model passed in is different, which IS the case for IGD
-    // Note 2: this can actually be a problem of having the computation 
-    // around model (algo/ & task/) detached from the model classes 
-    double e = model.matrixU.row(x.i) * trans(model.matrixV.row(x.j)) - y;
+    // IGD::transitionWithLoss() does not call this, but reuses the error
+    // computed in lossAndGradientInPlace()
+    double e = model.matrixU.col(x.i).dot(model.matrixV.col(x.j)) - y;
     return e * e;
 }
 
@@ -97,7 +195,7 @@ typename Tuple::dependent_variable_type
 LMF<Model, Tuple>::predict(
         const model_type                    &model, 
         const independent_variables_type    &x) {
-    return model.matrixU.row(x.i) * trasn(model.matrixV.row(x.j));
+    return model.matrixU.col(x.i).dot(model.matrixV.col(x.j));
 }
 
 } // namespace convex
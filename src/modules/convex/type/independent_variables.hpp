@@ -18,8 +18,23 @@ namespace modules {
 namespace convex {
 
 struct MatrixIndex {
-    uint16_t i;
-    uint16_t j;
+    uint32_t i;
+    uint32_t j;
+};
+
+/**
+ * @brief Sparse vector given by the indices and values of its non-zero
+ *     coordinates
+ *
+ * Indices start at indexBase: 1 for the index arrays passed from SQL, 0 for
+ * the storage of a SparseColumnVector (svec). The arrays are not owned; they
+ * point into the arguments of the current function call.
+ */
+struct SparseVector {
+    const int32_t *indices;
+    const double *values;
+    uint32_t nnz;
+    int32_t indexBase;
 };
 
 } // namespace convex
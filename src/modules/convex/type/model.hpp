@@ -18,11 +18,38 @@ namespace convex {
 
 // The necessity of this wrapper is to allow classes in algo/ and task/ to
 // have a type that they can template over
+//
+// The factors are stored transposed: Column i of matrixU is the latent vector
+// of row i (and likewise for matrixV), so that a gradient step reads and
+// writes two contiguous blocks of memory. Each latent vector is padded with
+// zeros to paddedRank() values. The padding stays zero under all updates,
+// because the gradient in those coordinates is zero.
+// examples/benchmarks/lmf_layout.cpp compares the throughput of gradient steps
+// with the previous row-wise layout.
 template <class Handle>
 struct LMFModel {
     typename HandleTraits<Handle>::MatrixTransparentHandleMap matrixU;
     typename HandleTraits<Handle>::MatrixTransparentHandleMap matrixV;
 
+    /**
+     * @brief Granularity (in number of values) of the padding of latent
+     *     vectors
+     *
+     * Latent vectors are contiguous and padded to a multiple of 4 values (32
+     * bytes), so a latent vector of rank up to 4 spans at most two cache
+     * lines. This is not a memory alignment: The state starts after the
+     * array header, which the backend only aligns to 8 bytes, so latent
+     * vectors are not aligned for 32-byte SIMD loads.
+     */
+    static const uint32_t kAlignment = 4;
+
+    /**
+     * @brief Number of values of a (padded) latent vector
+     */
+    static inline uint32_t paddedRank(const uint32_t inMaxRank) {
+        return (inMaxRank + kAlignment - 1) / kAlignment * kAlignment;
+    }
+
     /**
      * @brief Space needed.
      *
@@ -30,28 +57,32 @@ struct LMFModel {
      * necessary for a matrix, so that it can perform operations. These are
      * stored in the HandleMap.
      */
-    static inline uint32_t arraySize(const uint16_t inRowDim, 
-            const uint16_t inColDim, const uint16_t inMaxRank) {
-        return (inRowDim + inColDim) * inMaxRank;
+    static inline uint64_t arraySize(const uint32_t inRowDim,
+            const uint32_t inColDim, const uint32_t inMaxRank) {
+        return (static_cast<uint64_t>(inRowDim) + inColDim)
+            * paddedRank(inMaxRank);
     }
 
     /**
      * @brief Initialize the model randomly with a user-provided scale factor
+     *
+     * Only the first inMaxRank coordinates of each latent vector are set, the
+     * padding is left zero.
      */
-    void initialize(const double &inScaleFactor) {
+    void initialize(const double &inScaleFactor, const uint32_t inMaxRank) {
         // using madlib::dbconnector::$database::NativeRandomNumberGenerator
         NativeRandomNumberGenerator rng;
-        int i, j, rr;
+        Index i, j, rr;
         double base = rng.min();
         double span = rng.max() - base;
-        for (rr = 0; rr < matrixU.cols(); rr ++) {
-            for (i = 0; i < matrixU.rows(); i ++) {
-                matrixU(i, rr) = inScaleFactor * (rng() - base) / span;
+        for (i = 0; i < matrixU.cols(); i ++) {
+            for (rr = 0; rr < static_cast<Index>(inMaxRank); rr ++) {
+                matrixU(rr, i) = inScaleFactor * (rng() - base) / span;
             }
         }
-        for (rr = 0; rr < matrixV.cols(); rr ++) {
-            for (j = 0; j < matrixV.rows(); j ++) {
-                matrixV(j, rr) = inScaleFactor * (rng() - base) / span;
+        for (j = 0; j < matrixV.cols(); j ++) {
+            for (rr = 0; rr < static_cast<Index>(inMaxRank); rr ++) {
+                matrixV(rr, j) = inScaleFactor * (rng() - base) / span;
             }
         }
     }
@@ -91,6 +122,89 @@ struct LMFModel {
     }
 };
 
+/**
+ * @brief Coefficients of a linear model, stored as a scale factor times a
+ *     vector
+ *
+ * Multiplying the model by a constant only changes the scale factor. L2
+ * regularization shrinks all coefficients in every gradient step, so with
+ * this representation, a regularized gradient step for a sparse tuple still
+ * only touches its non-zero coordinates [1].
+ *
+ * The AdaGrad accumulators are only ever added to or zeroed, so their scale
+ * factor is always 1.
+ *
+ * [1] S. Shalev-Shwartz, Y. Singer, and N. Srebro. "Pegasos: Primal Estimated
+ *     sub-GrAdient SOlver for SVM." In: ICML 2007, pp. 807-814.
+ */
+template <class Handle>
+struct LinearModel {
+    typename HandleTraits<Handle>::ReferenceToDouble scale;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap vector;
+
+    /**
+     * @brief Smallest absolute scale factor before the scale is folded into
+     *     the vector
+     *
+     * Dividing by a tiny scale factor would lose precision in the vector.
+     */
+    static inline double minScale() { return 1e-9; }
+
+    /**
+     * @brief Space needed (the scale factor and the vector).
+     */
+    static inline uint64_t arraySize(const uint32_t inDimension) {
+        return 1 + static_cast<uint64_t>(inDimension);
+    }
+
+    /**
+     * @brief The i-th (0-based) coefficient
+     */
+    inline double coef(Index i) const {
+        return scale * vector(i);
+    }
+
+    /**
+     * @brief Fold the scale factor into the vector
+     */
+    void normalize() {
+        if (scale != 1.) {
+            vector *= static_cast<double>(scale);
+            scale = 1.;
+        }
+    }
+
+    void setZero() {
+        scale = 1.;
+        vector.setZero();
+    }
+
+    LinearModel &operator*=(const double &c) {
+        scale = scale * c;
+        if (std::fabs(scale) < minScale())
+            normalize();
+
+        return *this;
+    }
+
+    template<class OtherHandle>
+    LinearModel &operator+=(const LinearModel<OtherHandle> &inOtherModel) {
+        normalize();
+        vector += static_cast<double>(inOtherModel.scale)
+            * inOtherModel.vector;
+
+        return *this;
+    }
+
+    template<class OtherHandle>
+    LinearModel &operator=(const LinearModel<OtherHandle> &inOtherModel) {
+        scale = static_cast<double>(inOtherModel.scale);
+        vector = inOtherModel.vector;
+
+        return *this;
+    }
+};
+
 } // namespace convex
 
 } // namespace modules
@@ -9,6 +9,9 @@
 #ifndef MADLIB_MODULES_CONVEX_TYPE_STATE_HPP_
 #define MADLIB_MODULES_CONVEX_TYPE_STATE_HPP_
 
+#include <algorithm>
+#include <sstream>
+
 #include "model.hpp"
 
 namespace madlib {
@@ -27,9 +30,10 @@ namespace convex {
  * object containing scalars and vectors.
  *
  * Note: We assume that the DOUBLE PRECISION array is initialized by the
- * database with length at least 8 (actually 9), and at least first 3 elemenets
- * are 0 (exact values of other elements are ignored).
+ * database with 24 elements that are all 0 (see the layout in rebind()).
  *
+ * Dimensions are 32-bit and offsets into the state are 64-bit, so the state
+ * is only bounded by the maximum size of a backend array (kMaxArraySize).
  */
 template <class Handle>
 class LMFIGDState {
@@ -37,10 +41,36 @@ class LMFIGDState {
     friend class LMFIGDState;
 
 public:
+    /**
+     * @brief Maximum number of values in the state
+     *
+     * The backend stores the state as a single array, whose size is limited
+     * to 1GB. We keep some headroom for the array header.
+     */
+    static const uint64_t kMaxArraySize = (static_cast<uint64_t>(1) << 27)
+        - 1024;
+
+    /**
+     * @brief Number of tuples buffered per thread if there is more than one
+     *
+     * Each thread is started anew whenever the buffer is flushed, so its
+     * share of the buffer has to be large compared to the cost of creating a
+     * thread.
+     */
+    static const uint32_t kBufferSizePerThread = 8192;
+
     LMFIGDState(const AnyType &inArray) : mStorage(inArray.getAs<Handle>()) {
         rebind();
     }
 
+    /**
+     * @brief The step-size policy of this state
+     */
+    inline StepSizePolicy stepsizePolicy() const {
+        return static_cast<StepSizePolicy>(
+            static_cast<uint16_t>(task.stepsizePolicy));
+    }
+
     /**
      * @brief Convert to backend representation
      *
@@ -54,20 +84,34 @@ public:
     /**
      * @brief Allocating the incremental gradient state.
      */
-    inline void allocate(const Allocator &inAllocator, uint16_t inRowDim,
-            uint16_t inColDim, uint16_t inMaxRank) {
+    inline void allocate(const Allocator &inAllocator, uint32_t inRowDim,
+            uint32_t inColDim, uint32_t inMaxRank, StepSizePolicy inPolicy,
+            uint16_t inNumThreads, uint32_t inShuffleWindow) {
+        uint64_t size = arraySize(inRowDim, inColDim, inMaxRank, inPolicy,
+            inNumThreads, inShuffleWindow);
+        if (size > kMaxArraySize) {
+            std::stringstream errorMsg;
+            errorMsg << "Low-rank matrix factorization with " << inRowDim
+                << " rows, " << inColDim << " columns, and rank " << inMaxRank
+                << " needs a transition state of " << size << " values, "
+                "but at most " << kMaxArraySize << " are supported. "
+                "Reduce max_rank, num_threads, or shuffle_window.";
+            throw std::runtime_error(errorMsg.str());
+        }
         mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
-                dbal::DoZero, dbal::ThrowBadAlloc>(
-                arraySize(inRowDim, inColDim, inMaxRank));
+                dbal::DoZero, dbal::ThrowBadAlloc>(size);
 
-        // This rebind is totally for the following 3 lines of code to take
+        // This rebind is totally for the following 4 lines of code to take
         // effect. I can also do something like "mStorage[0] = inRowDim",
         // but I am not clear about the type casting
         rebind();
         task.rowDim = inRowDim;
         task.colDim = inColDim;
         task.maxRank = inMaxRank;
-        
+        task.stepsizePolicy = static_cast<uint16_t>(inPolicy);
+        task.numThreads = inNumThreads;
+        task.shuffleWindow = inShuffleWindow;
+
         // This time all the member fields are correctly binded
         rebind();
     }
@@ -90,7 +134,110 @@ public:
     inline void reset() {
         algo.numRows = 0;
         algo.loss = 0.;
-        algo.incrModel = task.model;
+        algo.numBuffered = 0;
+        algo.numHoldoutRows = 0;
+        algo.holdoutLoss = 0.;
+        algo.incrAccumulator *= 0.;
+    }
+
+    /**
+     * @brief Whether a fraction of the rows is held out for validation
+     */
+    inline bool hasHoldout() const {
+        return task.holdoutFraction > 0.;
+    }
+
+    /**
+     * @brief Whether a tuple (with 0-based indices) belongs to the holdout
+     *
+     * The decision only depends on the row and column of the tuple, so that
+     * the same tuples are held out in every iteration and on every segment.
+     * We hash them with the finalizer of SplitMix64.
+     */
+    inline bool isHoldout(const LMFTuple &inTuple) const {
+        uint64_t h = (static_cast<uint64_t>(inTuple.indVar.i) << 32)
+            | inTuple.indVar.j;
+        h += 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        h ^= h >> 31;
+        // The upper 53 bits as a uniform number in [0, 1)
+        return static_cast<double>(h >> 11) / 9007199254740992.
+            < task.holdoutFraction;
+    }
+
+    /**
+     * @brief The number of threads for gradient steps (see Hogwild)
+     */
+    inline uint16_t numThreads() const {
+        return std::max(static_cast<uint16_t>(task.numThreads),
+            static_cast<uint16_t>(1));
+    }
+
+    /**
+     * @brief Whether the order of gradient steps is randomized (see Shuffle)
+     */
+    inline bool isShuffled() const {
+        return task.shuffleWindow > 0;
+    }
+
+    /**
+     * @brief Whether the buffer is full and has to be flushed
+     */
+    inline bool isBufferFull() const {
+        return algo.numBuffered == bufferSize(numThreads(),
+            task.shuffleWindow);
+    }
+
+    /**
+     * @brief Append a tuple (with 0-based indices) to the buffer
+     */
+    inline void bufferTuple(const LMFTuple &inTuple) {
+        setBufferedTuple(algo.numBuffered, inTuple);
+        algo.numBuffered++;
+    }
+
+    /**
+     * @brief Overwrite the k-th buffered tuple
+     */
+    inline void setBufferedTuple(uint64_t k, const LMFTuple &inTuple) {
+        double *values = algo.buffer.data() + 3 * k;
+        values[0] = inTuple.indVar.i;
+        values[1] = inTuple.indVar.j;
+        values[2] = inTuple.depVar;
+    }
+
+    /**
+     * @brief Exchange two buffered tuples
+     */
+    inline void swapBufferedTuples(uint64_t k, uint64_t l) {
+        double *values = algo.buffer.data();
+        for (uint64_t c = 0; c < 3; c++)
+            std::swap(values[3 * k + c], values[3 * l + c]);
+    }
+
+    /**
+     * @brief Read the k-th buffered tuple
+     *
+     * This is called by worker threads and must not call any backend
+     * function.
+     */
+    inline void bufferedTuple(uint64_t k, LMFTuple &outTuple) const {
+        const double *values = algo.buffer.data() + 3 * k;
+        outTuple.indVar.i = static_cast<uint32_t>(values[0]);
+        outTuple.indVar.j = static_cast<uint32_t>(values[1]);
+        outTuple.depVar = values[2];
+    }
+
+    /**
+     * @brief The factors to return as result
+     *
+     * With averaging, this is the average of the iterates, otherwise it is the
+     * last iterate.
+     */
+    inline const LMFModel<Handle> &result() const {
+        return stepsizePolicy() == kAveragingStepSize
+            ? task.accumulator : task.model;
     }
 
     /**
@@ -101,12 +248,72 @@ public:
      * me. But I am not sure where I can move this to...
      */
     inline void computeRMSE() {
-        task.RMSE = sqrt(algo.loss / static_cast<double>(algo.numRows));
+        uint64_t numTrainingRows = algo.numRows - algo.numHoldoutRows;
+        task.RMSE = numTrainingRows > 0
+            ? sqrt(algo.loss / static_cast<double>(numTrainingRows)) : 0.;
+        task.holdoutRMSE = algo.numHoldoutRows > 0
+            ? sqrt(algo.holdoutLoss
+                / static_cast<double>(algo.numHoldoutRows))
+            : 0.;
+    }
+
+    /**
+     * @brief Track convergence at the end of an iteration
+     *
+     * The monitored error is the holdout RMSE if there is a holdout, and the
+     * (progressive) training RMSE otherwise. With an absolute tolerance (the
+     * default), an iteration does not improve if its error differs from the
+     * error of the previous iteration by less than the tolerance. With a
+     * relative tolerance, an iteration improves if it reduces the best error
+     * seen so far by more than the tolerance times that error. After an
+     * iteration without improvement, the step size is multiplied by the decay
+     * factor. The state converges after patience consecutive iterations
+     * without improvement. This has to be called after computeRMSE() and
+     * IGD::final().
+     */
+    inline void updateConvergence() {
+        double error = hasHoldout() ? task.holdoutRMSE : task.RMSE;
+        bool isImproved = task.numPasses <= 1 || (task.isRelativeTolerance
+            ? error < task.bestRMSE * (1. - task.tolerance)
+            : std::fabs(error - task.bestRMSE) >= task.tolerance);
+        // With an absolute tolerance, the reference is the previous error
+        if (isImproved || !task.isRelativeTolerance)
+            task.bestRMSE = error;
+        if (isImproved) {
+            task.numStalePasses = 0;
+        } else {
+            task.numStalePasses = task.numStalePasses + 1;
+            task.stepsize = static_cast<double>(task.stepsize)
+                * task.decayFactor;
+        }
+        task.isConverged = static_cast<uint32_t>(task.numStalePasses)
+            >= static_cast<uint32_t>(task.patience);
     }
 
-    static inline uint32_t arraySize(const uint16_t inRowDim, 
-            const uint16_t inColDim, const uint16_t inMaxRank) {
-        return 8 + 2 * LMFModel<Handle>::arraySize(inRowDim, inColDim, inMaxRank);
+    static inline uint64_t arraySize(const uint32_t inRowDim,
+            const uint32_t inColDim, const uint32_t inMaxRank,
+            const StepSizePolicy inPolicy, const uint16_t inNumThreads,
+            const uint32_t inShuffleWindow) {
+        uint64_t modelLength = LMFModel<Handle>::arraySize(inRowDim, inColDim,
+                inMaxRank);
+        return 24 + modelLength
+            + (hasAccumulator(inPolicy) ? modelLength : 0)
+            + (inPolicy == kAdaGradStepSize ? modelLength : 0)
+            + 3 * bufferSize(inNumThreads, inShuffleWindow);
+    }
+
+    /**
+     * @brief Number of tuples in a full buffer
+     *
+     * Tuples are buffered for Hogwild and for shuffling. With both, the
+     * buffer is shuffled before each flush.
+     */
+    static inline uint64_t bufferSize(const uint16_t inNumThreads,
+            const uint32_t inShuffleWindow) {
+        return inNumThreads > 1
+            ? std::max(static_cast<uint64_t>(kBufferSizePerThread)
+                * inNumThreads, static_cast<uint64_t>(inShuffleWindow))
+            : inShuffleWindow;
     }
 
 private:
@@ -118,16 +325,62 @@ private:
      * - 0: rowDim (row dimension of the input sparse matrix A)
      * - 1: colDim (col dimension of the input sparse matrix A)
      * - 2: maxRank (the rank of the low-rank assumption)
-     * - 3: stepsize (step size of gradient steps)
+     * - 3: stepsize (initial step size of gradient steps)
      * - 4: initValue (value scale used to initialize the model)
-     * - 5: model (matrices U(rowDim x maxRank), V(colDim x maxRank), A ~ UV')
-     * - 5 + modelLength: RMSE (root mean squared error)
+     * - 5: stepsizePolicy (see StepSizePolicy)
+     * - 6: numPasses (number of completed iterations)
+     * - 7: RMSE (root mean squared error)
+     * - 8: numThreads (number of threads for gradient steps, see Hogwild)
+     * - 9: shuffleWindow (number of tuples buffered to randomize the order of
+     *   gradient steps, see Shuffle; 0 if disabled)
+     * - 10: tolerance (minimum change of the error per iteration, see
+     *   updateConvergence())
+     * - 11: patience (number of iterations without improvement before
+     *   converging)
+     * - 12: numStalePasses (number of iterations since the last improvement)
+     * - 13: bestRMSE (reference error: the lowest error of all iterations
+     *   with a relative tolerance, the error of the last iteration otherwise)
+     * - 14: decayFactor (step-size factor after an iteration without
+     *   improvement)
+     * - 15: holdoutFraction (fraction of rows held out for validation)
+     * - 16: holdoutRMSE (root mean squared error on the holdout)
+     * - 17: isConverged (whether the iterations should stop)
+     * - 18: isRelativeTolerance (whether tolerance is relative to the error)
      *
      * Intra-iteration components (updated in transition step):
-     *   modelLength = (rowDim + colDim) * maxRank
-     * - 6 + modelLength: numRows (number of rows processed in this iteration)
-     * - 7 + modelLength: loss (sum of squared errors)
-     * - 8 + modelLength: incrModel (volatile model for incrementally update)
+     * - 19: numRows (number of rows processed in this iteration, including
+     *   buffered and holdout rows)
+     * - 20: loss (sum of squared errors of the training rows)
+     * - 21: numBuffered (number of buffered rows)
+     * - 22: numHoldoutRows (number of holdout rows in this iteration)
+     * - 23: holdoutLoss (sum of squared errors of the holdout rows)
+     *
+     * Factors and buffers, with
+     *   modelLength = (rowDim + colDim) * paddedRank
+     *   accLength = modelLength for AdaGrad and averaging, 0 otherwise
+     *   incrAccLength = modelLength for AdaGrad, 0 otherwise:
+     * - 24: model (matrices U(rowDim x maxRank), V(colDim x maxRank), A ~ UV',
+     *   stored as latent vectors, see LMFModel). This is the iterate, which
+     *   the transition function updates in place.
+     * - 24 + modelLength: accumulator (AdaGrad: sums of squared gradients,
+     *   averaging: the average of the iterates of all previous iterations;
+     *   empty for other policies)
+     * - 24 + modelLength + accLength: incrAccumulator (AdaGrad: sums of
+     *   squared gradients of this iteration; intra-iteration)
+     * - 24 + modelLength + accLength + incrAccLength: buffer (row, column,
+     *   and value of each buffered row; intra-iteration; empty if
+     *   numThreads <= 1 and shuffleWindow = 0)
+     *
+     * There are no unused elements. The initial state consists of the 24
+     * scalars, all 0.
+     *
+     * The model of the previous iteration is not kept: Every row contributes
+     * its loss with respect to the iterate just before the row's gradient step
+     * (progressive validation), so a single copy of the factors suffices.
+     *
+     * Since modelLength is a multiple of LMFModel::kAlignment, all models
+     * start at an offset (from the start of the array data) that is a
+     * multiple of LMFModel::kAlignment.
      */
     void rebind() {
         task.rowDim.rebind(&mStorage[0]);
@@ -135,42 +388,399 @@ private:
         task.maxRank.rebind(&mStorage[2]);
         task.stepsize.rebind(&mStorage[3]);
         task.initValue.rebind(&mStorage[4]);
-        task.model.matrixU.rebind(&mStorage[5], task.rowDim, task.maxRank);
-        task.model.matrixV.rebind(&mStorage[5 + task.rowDim * task.maxRank],
-                task.colDim, task.maxRank);
-        uint32_t modelLength = LMFModel<Handle>::arraySize(task.rowDim,
+        task.stepsizePolicy.rebind(&mStorage[5]);
+        task.numPasses.rebind(&mStorage[6]);
+        uint64_t modelLength = LMFModel<Handle>::arraySize(task.rowDim,
                 task.colDim, task.maxRank);
-//        task.model.rebind(&mStorage[5], task.rowDim,
-//                task.colDim, task.maxRank);
-        task.RMSE.rebind(&mStorage[5 + modelLength]);
+        uint64_t accLength = hasAccumulator(stepsizePolicy()) ? modelLength : 0;
+        bool hasIncrAcc = stepsizePolicy() == kAdaGradStepSize;
+        task.RMSE.rebind(&mStorage[7]);
+        task.numThreads.rebind(&mStorage[8]);
+        task.shuffleWindow.rebind(&mStorage[9]);
+        task.tolerance.rebind(&mStorage[10]);
+        task.patience.rebind(&mStorage[11]);
+        task.numStalePasses.rebind(&mStorage[12]);
+        task.bestRMSE.rebind(&mStorage[13]);
+        task.decayFactor.rebind(&mStorage[14]);
+        task.holdoutFraction.rebind(&mStorage[15]);
+        task.holdoutRMSE.rebind(&mStorage[16]);
+        task.isConverged.rebind(&mStorage[17]);
+        task.isRelativeTolerance.rebind(&mStorage[18]);
+        algo.numRows.rebind(&mStorage[19]);
+        algo.loss.rebind(&mStorage[20]);
+        algo.numBuffered.rebind(&mStorage[21]);
+        algo.numHoldoutRows.rebind(&mStorage[22]);
+        algo.holdoutLoss.rebind(&mStorage[23]);
 
-        algo.numRows.rebind(&mStorage[6 + modelLength]);
-        algo.loss.rebind(&mStorage[7 + modelLength]);
-//        algo.incrModel.rebind(&mStorage[8 + modelLength], task.rowDim,
-//                task.colDim, task.maxRank);
-        algo.incrModel.matrixU.rebind(&mStorage[8 + modelLength],
-                task.rowDim, task.maxRank);
-        algo.incrModel.matrixV.rebind(&mStorage[8 + modelLength +
-                task.rowDim * task.maxRank], task.colDim, task.maxRank);
+        rebindModel(task.model, 24, true);
+        rebindModel(task.accumulator, 24 + modelLength, accLength > 0);
+        rebindModel(algo.incrAccumulator, 24 + modelLength + accLength,
+                hasIncrAcc);
+        uint64_t bufferLength = 3 * bufferSize(numThreads(),
+                task.shuffleWindow);
+        algo.buffer.rebind(&mStorage[bufferLength > 0
+                ? 24 + modelLength + accLength
+                    + (hasIncrAcc ? modelLength : 0)
+                : 0], bufferLength);
+    }
+
+    /**
+     * @brief Rebind a model starting at the given offset
+     *
+     * If the model is not stored in the state, it is bound to empty matrices.
+     */
+    void rebindModel(LMFModel<Handle> &ioModel, uint64_t inOffset,
+            bool inIsStored) {
+        uint32_t rowDim = inIsStored ? static_cast<uint32_t>(task.rowDim) : 0;
+        uint32_t colDim = inIsStored ? static_cast<uint32_t>(task.colDim) : 0;
+        uint32_t paddedRank = LMFModel<Handle>::paddedRank(task.maxRank);
+        ioModel.matrixU.rebind(&mStorage[inIsStored ? inOffset : 0],
+                paddedRank, rowDim);
+        ioModel.matrixV.rebind(&mStorage[inIsStored ? inOffset
+                + static_cast<uint64_t>(rowDim) * paddedRank : 0],
+                paddedRank, colDim);
     }
 
     Handle mStorage;
 
 public:
     struct TaskState {
-        typename HandleTraits<Handle>::ReferenceToUInt16 rowDim;
-        typename HandleTraits<Handle>::ReferenceToUInt16 colDim;
-        typename HandleTraits<Handle>::ReferenceToUInt16 maxRank;
+        typename HandleTraits<Handle>::ReferenceToUInt32 rowDim;
+        typename HandleTraits<Handle>::ReferenceToUInt32 colDim;
+        typename HandleTraits<Handle>::ReferenceToUInt32 maxRank;
         typename HandleTraits<Handle>::ReferenceToDouble stepsize;
         typename HandleTraits<Handle>::ReferenceToDouble initValue;
+        typename HandleTraits<Handle>::ReferenceToUInt16 stepsizePolicy;
+        typename HandleTraits<Handle>::ReferenceToUInt64 numPasses;
         LMFModel<Handle> model;
         typename HandleTraits<Handle>::ReferenceToDouble RMSE;
+        typename HandleTraits<Handle>::ReferenceToUInt16 numThreads;
+        typename HandleTraits<Handle>::ReferenceToUInt32 shuffleWindow;
+        typename HandleTraits<Handle>::ReferenceToDouble tolerance;
+        typename HandleTraits<Handle>::ReferenceToUInt32 patience;
+        typename HandleTraits<Handle>::ReferenceToUInt32 numStalePasses;
+        typename HandleTraits<Handle>::ReferenceToDouble bestRMSE;
+        typename HandleTraits<Handle>::ReferenceToDouble decayFactor;
+        typename HandleTraits<Handle>::ReferenceToDouble holdoutFraction;
+        typename HandleTraits<Handle>::ReferenceToDouble holdoutRMSE;
+        typename HandleTraits<Handle>::ReferenceToBool isConverged;
+        typename HandleTraits<Handle>::ReferenceToBool isRelativeTolerance;
+        LMFModel<Handle> accumulator;
+    } task;
+
+    struct AlgoState {
+        typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
+        typename HandleTraits<Handle>::ReferenceToDouble loss;
+        typename HandleTraits<Handle>::ReferenceToUInt64 numBuffered;
+        typename HandleTraits<Handle>::ReferenceToUInt64 numHoldoutRows;
+        typename HandleTraits<Handle>::ReferenceToDouble holdoutLoss;
+        LMFModel<Handle> incrAccumulator;
+        typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap buffer;
+    } algo;
+};
+
+/**
+ * @brief Inter- (Task State) and intra-iteration (Algo State) state of
+ *        incremental gradient descent for linear models (see task/glm.hpp)
+ *
+ * TransitionState encapsualtes the transition state during the
+ * aggregate function during an iteration. To the database, the state is
+ * exposed as a single DOUBLE PRECISION array, to the C++ code it is a proper
+ * object containing scalars and vectors.
+ *
+ * Note: We assume that the DOUBLE PRECISION array is initialized by the
+ * database with length at least 13, and all elemenets are 0.
+ */
+template <class Handle>
+class GLMIGDState {
+    template <class OtherHandle>
+    friend class GLMIGDState;
+
+public:
+    /**
+     * @brief Maximum number of values in the state, see LMFIGDState
+     */
+    static const uint64_t kMaxArraySize = (static_cast<uint64_t>(1) << 27)
+        - 1024;
+
+    GLMIGDState(const AnyType &inArray) : mStorage(inArray.getAs<Handle>()) {
+        rebind();
+    }
+
+    /**
+     * @brief The step-size policy of this state
+     */
+    inline StepSizePolicy stepsizePolicy() const {
+        return static_cast<StepSizePolicy>(
+            static_cast<uint16_t>(task.stepsizePolicy));
+    }
+
+    /**
+     * @brief Convert to backend representation
+     *
+     * We define this function so that we can use State in the
+     * argument list and as a return type.
+     */
+    inline operator AnyType() const {
+        return mStorage;
+    }
+
+    /**
+     * @brief Allocating the incremental gradient state.
+     */
+    inline void allocate(const Allocator &inAllocator, uint32_t inDimension,
+            StepSizePolicy inPolicy, uint32_t inShuffleWindow) {
+        uint64_t size = arraySize(inDimension, inPolicy, inShuffleWindow);
+        if (size > kMaxArraySize) {
+            std::stringstream errorMsg;
+            errorMsg << "A linear model with " << inDimension
+                << " independent variables needs a transition state of "
+                << size << " values, but at most " << kMaxArraySize
+                << " are supported. Reduce shuffle_window.";
+            throw std::runtime_error(errorMsg.str());
+        }
+        mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
+                dbal::DoZero, dbal::ThrowBadAlloc>(size);
+
+        rebind();
+        task.dimension = inDimension;
+        task.stepsizePolicy = static_cast<uint16_t>(inPolicy);
+        task.shuffleWindow = inShuffleWindow;
+        rebind();
+        task.model.scale = 1.;
+        task.accumulator.scale = 1.;
+        algo.incrAccumulator.scale = 1.;
+    }
+
+    /**
+     * @brief We need to support assigning the previous state
+     */
+    template <class OtherHandle>
+    GLMIGDState &operator=(const GLMIGDState<OtherHandle> &inOtherState) {
+        for (size_t i = 0; i < mStorage.size(); i++) {
+            mStorage[i] = inOtherState.mStorage[i];
+        }
+
+        return *this;
+    }
+
+    /**
+     * @brief Reset the intra-iteration fields.
+     */
+    inline void reset() {
+        algo.numRows = 0;
+        algo.loss = 0.;
+        algo.numBuffered = 0;
+        algo.incrAccumulator.setZero();
+    }
+
+    /**
+     * @brief Whether the order of gradient steps is randomized (see Shuffle)
+     */
+    inline bool isShuffled() const {
+        return task.shuffleWindow > 0;
+    }
+
+    /**
+     * @brief Whether the shuffle buffer is full
+     */
+    inline bool isBufferFull() const {
+        uint64_t shuffleWindow = static_cast<uint32_t>(task.shuffleWindow);
+        return algo.numBuffered == shuffleWindow;
+    }
+
+    /**
+     * @brief Append a tuple to the buffer
+     */
+    inline void bufferTuple(const GLMTuple &inTuple) {
+        setBufferedTuple(algo.numBuffered, inTuple);
+        algo.numBuffered++;
+    }
+
+    /**
+     * @brief Read the k-th buffered tuple
+     *
+     * The independent variables of the tuple refer to the buffer.
+     */
+    inline void bufferedTuple(uint64_t k, GLMTuple &outTuple) const {
+        uint64_t dimension = static_cast<uint32_t>(task.dimension);
+        const double *values = algo.buffer.data() + (dimension + 1) * k;
+        outTuple.depVar = values[0];
+        outTuple.indVar.rebind(values + 1, dimension);
+    }
+
+    /**
+     * @brief Overwrite the k-th buffered tuple
+     */
+    inline void setBufferedTuple(uint64_t k, const GLMTuple &inTuple) {
+        uint64_t dimension = static_cast<uint32_t>(task.dimension);
+        double *values = algo.buffer.data() + (dimension + 1) * k;
+        values[0] = inTuple.depVar;
+        std::copy(inTuple.indVar.data(), inTuple.indVar.data() + dimension,
+            values + 1);
+    }
+
+    /**
+     * @brief Exchange two buffered tuples
+     */
+    inline void swapBufferedTuples(uint64_t k, uint64_t l) {
+        uint64_t length = static_cast<uint32_t>(task.dimension) + 1;
+        double *values = algo.buffer.data();
+        std::swap_ranges(values + length * k, values + length * (k + 1),
+            values + length * l);
+    }
+
+    /**
+     * @brief The step size of the current iteration
+     *
+     * For AdaGrad, this is the step size before the per-coordinate scaling.
+     */
+    inline double currentStepsize() const {
+        return stepsizePolicy() == kAdaGradStepSize
+            ? static_cast<double>(task.stepsize)
+            : scheduledStepSize(stepsizePolicy(), task.stepsize,
+                task.numPasses);
+    }
+
+    /**
+     * @brief Shrink the model after a gradient step (L2 regularization)
+     *
+     * This only changes the scale factor of the model, see LinearModel.
+     */
+    inline void regularize() {
+        if (task.lambda > 0.)
+            task.model *= 1. - currentStepsize() * task.lambda;
+    }
+
+    /**
+     * @brief Fold all scale factors into their vectors
+     */
+    inline void normalize() {
+        task.model.normalize();
+        task.accumulator.normalize();
+    }
+
+    /**
+     * @brief The coefficients to return as result
+     *
+     * With averaging, this is the average of the iterates, otherwise it is the
+     * last iterate. The final function normalizes the state, so the
+     * coefficients are just the vector.
+     */
+    inline const typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap
+    &result() const {
+        return stepsizePolicy() == kAveragingStepSize
+            ? task.accumulator.vector : task.model.vector;
+    }
+
+    /**
+     * @brief Compute the average loss using loss and numRows
+     */
+    inline void computeLoss() {
+        task.loss = algo.loss / static_cast<double>(algo.numRows);
+    }
+
+    static inline uint64_t arraySize(const uint32_t inDimension,
+            const StepSizePolicy inPolicy, const uint32_t inShuffleWindow) {
+        return 12 + LinearModel<Handle>::arraySize(inDimension)
+            + (hasAccumulator(inPolicy) ? inDimension : 0)
+            + (inPolicy == kAdaGradStepSize ? inDimension : 0)
+            + (static_cast<uint64_t>(inDimension) + 1) * inShuffleWindow;
+    }
+
+private:
+    /**
+     * @brief Rebind to a new storage array.
+     *
+     * Array layout (iteration refers to one aggregate-function call):
+     * Inter-iteration components (updated in final function):
+     * - 0: dimension (number of independent variables)
+     * - 1: stepsize (initial step size of gradient steps)
+     * - 2: stepsizePolicy (see StepSizePolicy)
+     * - 3: numPasses (number of completed iterations)
+     * - 4: loss (average loss of the last iteration)
+     * - 5: lambda (coefficient of the L2 regularization)
+     * - 6: shuffleWindow (number of tuples buffered to randomize the order of
+     *   gradient steps, see Shuffle; 0 if disabled)
+     * - 7: model (scale factor and coefficients, see LinearModel; updated in
+     *   place by the transition function)
+     * - 8 + dimension: accumulator (scale factor, followed by the AdaGrad
+     *   sums of squared gradients or, for averaging, the average of the
+     *   iterates of all previous iterations; only the scale factor for other
+     *   policies)
+     *
+     * Intra-iteration components (updated in transition step):
+     *   accLength = dimension for AdaGrad and averaging, 0 otherwise
+     *   incrAccLength = dimension for AdaGrad, 0 otherwise
+     * - 9 + dimension + accLength: numRows (number of rows processed in this
+     *   iteration, including buffered rows)
+     * - 10 + dimension + accLength: loss (sum of losses, each computed before
+     *   the gradient step of its row)
+     * - 11 + dimension + accLength: numBuffered (number of buffered rows)
+     * - 12 + dimension + accLength: incrAccumulator (scale factor, followed
+     *   by the AdaGrad sums of squared gradients of this iteration)
+     * - 13 + dimension + accLength + incrAccLength: buffer (dependent and
+     *   independent variables of each buffered row; empty if shuffleWindow
+     *   = 0)
+     */
+    void rebind() {
+        task.dimension.rebind(&mStorage[0]);
+        task.stepsize.rebind(&mStorage[1]);
+        task.stepsizePolicy.rebind(&mStorage[2]);
+        task.numPasses.rebind(&mStorage[3]);
+        task.loss.rebind(&mStorage[4]);
+        task.lambda.rebind(&mStorage[5]);
+        task.shuffleWindow.rebind(&mStorage[6]);
+        uint64_t dimension = static_cast<uint32_t>(task.dimension);
+        uint64_t accLength = hasAccumulator(stepsizePolicy()) ? dimension : 0;
+        uint64_t incrAccLength = stepsizePolicy() == kAdaGradStepSize
+            ? dimension : 0;
+        rebindModel(task.model, 7, dimension);
+        rebindModel(task.accumulator, 8 + dimension, accLength);
+
+        algo.numRows.rebind(&mStorage[9 + dimension + accLength]);
+        algo.loss.rebind(&mStorage[10 + dimension + accLength]);
+        algo.numBuffered.rebind(&mStorage[11 + dimension + accLength]);
+        rebindModel(algo.incrAccumulator, 12 + dimension + accLength,
+            incrAccLength);
+        uint64_t bufferLength = (dimension + 1)
+            * static_cast<uint32_t>(task.shuffleWindow);
+        algo.buffer.rebind(&mStorage[bufferLength > 0
+            ? 13 + dimension + accLength + incrAccLength : 0], bufferLength);
+    }
+
+    /**
+     * @brief Rebind a model (scale factor and vector) starting at the given
+     *     offset
+     */
+    void rebindModel(LinearModel<Handle> &ioModel, uint64_t inOffset,
+            uint64_t inLength) {
+        ioModel.scale.rebind(&mStorage[inOffset]);
+        ioModel.vector.rebind(&mStorage[inLength > 0 ? inOffset + 1 : 0],
+            inLength);
+    }
+
+    Handle mStorage;
+
+public:
+    struct TaskState {
+        typename HandleTraits<Handle>::ReferenceToUInt32 dimension;
+        typename HandleTraits<Handle>::ReferenceToDouble stepsize;
+        typename HandleTraits<Handle>::ReferenceToUInt16 stepsizePolicy;
+        typename HandleTraits<Handle>::ReferenceToUInt64 numPasses;
+        typename HandleTraits<Handle>::ReferenceToDouble loss;
+        typename HandleTraits<Handle>::ReferenceToDouble lambda;
+        typename HandleTraits<Handle>::ReferenceToUInt32 shuffleWindow;
+        LinearModel<Handle> model;
+        LinearModel<Handle> accumulator;
     } task;
 
     struct AlgoState {
         typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
         typename HandleTraits<Handle>::ReferenceToDouble loss;
-        LMFModel<Handle> incrModel;
+        typename HandleTraits<Handle>::ReferenceToUInt64 numBuffered;
+        LinearModel<Handle> incrAccumulator;
+        typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap buffer;
     } algo;
 };
 
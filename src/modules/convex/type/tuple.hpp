@@ -49,6 +49,12 @@ struct ExampleTuple {
 
 typedef ExampleTuple<MatrixIndex, double> LMFTuple;
 
+// The independent variables are mapped from the backend array, so tuples of
+// this type must not be copied
+typedef ExampleTuple<MappedColumnVector, double> GLMTuple;
+
+typedef ExampleTuple<SparseVector, double> GLMSparseTuple;
+
 } // namespace convex
 
 } // namespace modules
@@ -0,0 +1,740 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file feature_gen.cpp
+ *
+ * @brief Feature extraction for linear-chain Conditional Random Fields
+ *
+ * The training data of lincrf_lbfgs_step() consists of three feature arrays
+ * per document (see compute_logli_gradient() in linear_crf.cpp). They are
+ * computed here from the tokens and labels of a document, in a single pass
+ * over the document. Each token is looked up only once, in a hash table that
+ * maps the word feature of the token to all state features it fires.
+ *
+ * The feature set is the same for all documents. We therefore compile it only
+ * once per query and keep it in the cross-call context of the function (see
+ * AnyType::getUserFunctionContext()).
+ *
+ * Regular expressions are not evaluated here: Whether a regex feature fires
+ * only depends on the token, so crf_train_fgen() matches the distinct tokens
+ * in SQL and passes the matches as part of the dictionary.
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#include <dbconnector/dbconnector.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "feature_gen.hpp"
+
+namespace madlib {
+
+// Use Eigen
+using namespace dbal::eigen_integration;
+
+namespace modules {
+
+namespace crf {
+
+using madlib::dbconnector::postgres::madlib_deconstruct_array;
+
+namespace {
+
+/**
+ * @brief Names of the features that are not fired by the token itself
+ */
+const char kEdgeFeature[] = "E.";
+const char kStartFeature[] = "S.";
+const char kEndFeature[] = "End.";
+
+/**
+ * @brief Prefix of the word features, which identify tokens
+ */
+const char kWordPrefix[] = "W_";
+
+/**
+ * @brief Elements of a text array
+ */
+class TextArray {
+public:
+    TextArray(const AnyType &inArg, const char* inName) {
+        ArrayHandle<text*> array = inArg.getAs<ArrayHandle<text*> >();
+        bool* nulls;
+        int size;
+        madlib_deconstruct_array(const_cast<ArrayType*>(array.array()),
+            TEXTOID, -1, false, 'i', &mElements, &nulls, &size);
+        for (int i = 0; i < size; ++i)
+            if (nulls[i])
+                throw std::runtime_error(std::string("Invalid parameter: ")
+                    + inName + " must not contain NULL elements");
+        mSize = static_cast<size_t>(size);
+    }
+
+    size_t size() const {
+        return mSize;
+    }
+
+    const char* data(size_t inIndex) const {
+        return VARDATA_ANY(DatumGetPointer(mElements[inIndex]));
+    }
+
+    size_t length(size_t inIndex) const {
+        return VARSIZE_ANY_EXHDR(DatumGetPointer(mElements[inIndex]));
+    }
+
+    bool equals(size_t inIndex, const char* inString) const {
+        return length(inIndex) == std::strlen(inString)
+            && std::memcmp(data(inIndex), inString, length(inIndex)) == 0;
+    }
+
+private:
+    Datum* mElements;
+    size_t mSize;
+};
+
+/**
+ * @brief Feature set compiled for the extraction, and cached across calls
+ *
+ * Every distinct feature name is a \c Symbol in an open-addressing hash
+ * table. Tokens are represented by the symbols of their word features, which
+ * also list the names of the other features (unknown word, regular
+ * expressions) fired by the token. Edge features are looked up in a dense
+ * matrix indexed by the two labels.
+ *
+ * The header is followed by the buffers listed in \c Buffer, each aligned to
+ * 16 bytes, and finally by the raw backend representation of the arguments
+ * describing the feature set (see also regress/predict.cpp). The layout only
+ * depends on the \c Shape of the feature set.
+ */
+struct FeatureDictionary {
+    /**
+     * @brief Arguments of crf_train_features() describing the feature set
+     */
+    enum Argument {
+        kNamesArgument = 2,
+        kPrevLabelsArgument,
+        kLabelsArgument,
+        kTokensArgument,
+        kTokenFeaturesArgument,
+        kEndOfArguments
+    };
+
+    enum {
+        kNumArguments = kEndOfArguments - kNamesArgument
+    };
+
+    enum Buffer {
+        // int32_t, numBuckets, symbol or -1
+        kBuckets,
+        // Symbol, maxSymbols() (upper bound)
+        kSymbols,
+        // char, numChars, the names of all symbols
+        kChars,
+        // StateFeature, numFeatures (upper bound), grouped by symbol
+        kStateFeatures,
+        // int32_t, numTokenFeatures, grouped by the symbol of the token
+        kTokenFeatures,
+        // int32_t, numLabels x numLabels, entry (p, c) is the index of the
+        // edge feature from p to c or -1
+        kEdges,
+        // double, 3 x numEdgeFeatures, the sparse_m array
+        kEdgeFeatures,
+        kRaw
+    };
+
+    /**
+     * @brief A feature name
+     *
+     * The state features with this name are
+     * <tt>stateFeatures[stateBegin, stateEnd)</tt>. For a word feature,
+     * <tt>tokenFeatures[tokenBegin, tokenEnd)</tt> are the symbols of the
+     * other features fired by the token.
+     */
+    struct Symbol {
+        uint32_t hash;
+        uint32_t offset;
+        uint32_t length;
+        int32_t stateBegin;
+        int32_t stateEnd;
+        int32_t tokenBegin;
+        int32_t tokenEnd;
+    };
+
+    struct StateFeature {
+        int32_t label;
+        int32_t index;
+    };
+
+    struct Shape {
+        size_t numFeatures;
+        size_t numEdgeFeatures;
+        size_t numTokenFeatures;
+        size_t numChars;
+        size_t numBuckets;
+        int32_t numLabels;
+
+        /**
+         * @brief Upper bound on the number of symbols
+         *
+         * Each non-edge feature adds at most one symbol, and each dictionary
+         * entry at most two (its word feature and its feature name).
+         */
+        size_t maxSymbols() const {
+            return numFeatures + 2 * numTokenFeatures;
+        }
+    };
+
+    size_t capacity;
+    size_t rawSizes[kNumArguments];
+    Shape shape;
+    int32_t numSymbols;
+    int32_t startSymbol;
+    int32_t endSymbol;
+
+    static FeatureDictionary* get(AnyType &args);
+
+    AnyType extract(const TextArray& inTokens,
+        const ArrayHandle<int32_t>& inLabels) const;
+
+private:
+    static size_t align(size_t inSize) {
+        return (inSize + 15) & ~static_cast<size_t>(15);
+    }
+
+    static size_t sizeOf(int inBuffer, const Shape& inShape);
+
+    static size_t offsetOf(int inBuffer, const Shape& inShape) {
+        size_t offset = align(sizeof(FeatureDictionary));
+        for (int buffer = 0; buffer < inBuffer; ++buffer)
+            offset += align(sizeOf(buffer, inShape));
+        return offset;
+    }
+
+    template <class T>
+    T* buffer(Buffer inBuffer) {
+        return reinterpret_cast<T*>(reinterpret_cast<char*>(this)
+            + offsetOf(inBuffer, shape));
+    }
+
+    template <class T>
+    const T* buffer(Buffer inBuffer) const {
+        return reinterpret_cast<const T*>(reinterpret_cast<const char*>(this)
+            + offsetOf(inBuffer, shape));
+    }
+
+    static Shape shapeOf(const TextArray& inNames,
+        const ArrayHandle<int32_t>& inPrevLabels,
+        const ArrayHandle<int32_t>& inLabels, const TextArray& inTokens,
+        const TextArray& inTokenFeatures);
+
+    static uint32_t hash(const char* inPrefix, size_t inPrefixLength,
+        const char* inName, size_t inLength);
+
+    int32_t find(const char* inPrefix, size_t inPrefixLength,
+        const char* inName, size_t inLength, uint32_t inHash) const;
+    int32_t intern(const char* inPrefix, size_t inPrefixLength,
+        const char* inName, size_t inLength);
+    int32_t tokenSymbol(const char* inToken, size_t inLength) const;
+
+    void compile(const TextArray& inNames,
+        const ArrayHandle<int32_t>& inPrevLabels,
+        const ArrayHandle<int32_t>& inLabels, const TextArray& inTokens,
+        const TextArray& inTokenFeatures);
+
+    size_t numStateFeatures(int32_t inSymbol) const;
+    double* appendStateFeatures(int32_t inSymbol, int32_t inLabel,
+        Index inPosition, double* outSparseR) const;
+};
+
+/**
+ * @brief Size (in bytes) of a buffer
+ */
+size_t
+FeatureDictionary::sizeOf(int inBuffer, const Shape& inShape) {
+    size_t numLabels = static_cast<size_t>(inShape.numLabels);
+
+    switch (inBuffer) {
+        case kBuckets:
+            return sizeof(int32_t) * inShape.numBuckets;
+        case kSymbols:
+            return sizeof(Symbol) * inShape.maxSymbols();
+        case kChars:
+            return inShape.numChars;
+        case kStateFeatures:
+            return sizeof(StateFeature) * inShape.numFeatures;
+        case kTokenFeatures:
+            return sizeof(int32_t) * inShape.numTokenFeatures;
+        case kEdges:
+            return sizeof(int32_t) * numLabels * numLabels;
+        case kEdgeFeatures:
+            return sizeof(double) * 3 * inShape.numEdgeFeatures;
+    }
+    return 0;
+}
+
+/**
+ * @brief Validate the feature set and return the sizes of the buffers
+ */
+FeatureDictionary::Shape
+FeatureDictionary::shapeOf(const TextArray& inNames,
+    const ArrayHandle<int32_t>& inPrevLabels,
+    const ArrayHandle<int32_t>& inLabels, const TextArray& inTokens,
+    const TextArray& inTokenFeatures) {
+
+    if (inPrevLabels.size() != inNames.size()
+        || inLabels.size() != inNames.size())
+        throw std::runtime_error("Invalid parameter: feature_names, "
+            "feature_prev_labels, and feature_labels must have the same "
+            "number of elements");
+    if (inTokenFeatures.size() != inTokens.size())
+        throw std::runtime_error("Invalid parameter: dict_tokens and "
+            "dict_features must have the same number of elements");
+
+    Shape shape;
+    shape.numFeatures = inNames.size();
+    shape.numEdgeFeatures = 0;
+    shape.numTokenFeatures = inTokens.size();
+    shape.numChars = 0;
+    int32_t maxLabel = -1;
+    for (size_t i = 0; i < inNames.size(); ++i) {
+        bool isEdge = inNames.equals(i, kEdgeFeature);
+        if (inLabels[i] < 0 || (isEdge && inPrevLabels[i] < 0)
+            || (!isEdge && inPrevLabels[i] != -1))
+            throw std::runtime_error("Invalid parameter: Labels must be "
+                "non-negative, and the previous label must be -1 for all "
+                "features but edge features");
+        maxLabel = std::max(maxLabel,
+            std::max(inLabels[i], inPrevLabels[i]));
+        if (isEdge)
+            shape.numEdgeFeatures++;
+        else
+            shape.numChars += inNames.length(i);
+    }
+    for (size_t i = 0; i < inTokens.size(); ++i)
+        shape.numChars += sizeof(kWordPrefix) - 1 + inTokens.length(i)
+            + inTokenFeatures.length(i);
+
+    size_t maxSymbols = shape.maxSymbols();
+    if (maxSymbols >= static_cast<size_t>(
+            std::numeric_limits<int32_t>::max()) / 2
+        || shape.numChars >= std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("Invalid parameter: The feature set is too "
+            "large");
+
+    // The load factor of the hash table is at most 1/2
+    shape.numBuckets = 16;
+    while (shape.numBuckets < 2 * maxSymbols)
+        shape.numBuckets *= 2;
+    shape.numLabels = maxLabel + 1;
+    return shape;
+}
+
+/**
+ * @brief Return the compiled feature set passed as arguments 2 to 6
+ *
+ * The feature set is only compiled if the arguments changed since the last
+ * call. If no cross-call context is available (e.g., if the function is
+ * called from another C++ AL function), it is compiled on every call.
+ */
+FeatureDictionary*
+FeatureDictionary::get(AnyType &args) {
+    const void* raw[kNumArguments];
+    size_t rawSizes[kNumArguments];
+    size_t rawSize = 0;
+    for (int i = 0; i < kNumArguments; ++i) {
+        AnyType arg = args[kNamesArgument + i];
+        raw[i] = arg.getRawValue();
+        rawSizes[i] = arg.getRawValueSize();
+        rawSize += rawSizes[i];
+    }
+
+    FeatureDictionary* dictionary
+        = static_cast<FeatureDictionary*>(args.getUserFunctionContext());
+    if (dictionary) {
+        const char* cachedRaw = dictionary->buffer<char>(kRaw);
+        bool same = true;
+        for (int i = 0; same && i < kNumArguments; ++i) {
+            same = dictionary->rawSizes[i] == rawSizes[i]
+                && std::memcmp(cachedRaw, raw[i], rawSizes[i]) == 0;
+            cachedRaw += rawSizes[i];
+        }
+        if (same)
+            return dictionary;
+    }
+
+    TextArray names(args[kNamesArgument], "feature_names");
+    ArrayHandle<int32_t> prevLabels
+        = args[kPrevLabelsArgument].getAs<ArrayHandle<int32_t> >();
+    ArrayHandle<int32_t> labels
+        = args[kLabelsArgument].getAs<ArrayHandle<int32_t> >();
+    TextArray tokens(args[kTokensArgument], "dict_tokens");
+    TextArray tokenFeatures(args[kTokenFeaturesArgument], "dict_features");
+    Shape shape = shapeOf(names, prevLabels, labels, tokens, tokenFeatures);
+    size_t size = offsetOf(kRaw, shape) + rawSize;
+
+    if (!dictionary || dictionary->capacity < size) {
+        void* memory = args.allocateUserFunctionContext(size);
+        if (!memory)
+            memory = defaultAllocator().allocate<dbal::FunctionContext,
+                dbal::DoZero, dbal::ThrowBadAlloc>(size);
+        dictionary = static_cast<FeatureDictionary*>(memory);
+        dictionary->capacity = size;
+    }
+
+    // Invalidate the cache while it is being overwritten
+    std::fill(dictionary->rawSizes, dictionary->rawSizes + kNumArguments,
+        static_cast<size_t>(0));
+    dictionary->shape = shape;
+    dictionary->compile(names, prevLabels, labels, tokens, tokenFeatures);
+
+    char* cachedRaw = dictionary->buffer<char>(kRaw);
+    for (int i = 0; i < kNumArguments; ++i) {
+        std::memcpy(cachedRaw, raw[i], rawSizes[i]);
+        cachedRaw += rawSizes[i];
+    }
+    std::copy(rawSizes, rawSizes + kNumArguments, dictionary->rawSizes);
+    return dictionary;
+}
+
+/**
+ * @brief FNV-1a hash of the concatenation of prefix and name
+ */
+uint32_t
+FeatureDictionary::hash(const char* inPrefix, size_t inPrefixLength,
+    const char* inName, size_t inLength) {
+
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < inPrefixLength; ++i)
+        hash = (hash ^ static_cast<unsigned char>(inPrefix[i])) * 16777619u;
+    for (size_t i = 0; i < inLength; ++i)
+        hash = (hash ^ static_cast<unsigned char>(inName[i])) * 16777619u;
+    return hash;
+}
+
+/**
+ * @brief Return the bucket of the symbol with the given name, or the empty
+ *     bucket where it would be inserted
+ */
+int32_t
+FeatureDictionary::find(const char* inPrefix, size_t inPrefixLength,
+    const char* inName, size_t inLength, uint32_t inHash) const {
+
+    const int32_t* buckets = buffer<int32_t>(kBuckets);
+    const Symbol* symbols = buffer<Symbol>(kSymbols);
+    const char* chars = buffer<char>(kChars);
+    size_t mask = shape.numBuckets - 1;
+
+    for (size_t bucket = inHash & mask; ; bucket = (bucket + 1) & mask) {
+        if (buckets[bucket] < 0)
+            return static_cast<int32_t>(bucket);
+
+        const Symbol& symbol = symbols[buckets[bucket]];
+        const char* name = chars + symbol.offset;
+        if (symbol.hash == inHash
+            && symbol.length == inPrefixLength + inLength
+            && std::memcmp(name, inPrefix, inPrefixLength) == 0
+            && std::memcmp(name + inPrefixLength, inName, inLength) == 0)
+            return static_cast<int32_t>(bucket);
+    }
+}
+
+/**
+ * @brief Return the symbol with the given name, and add it if it does not
+ *     exist yet
+ */
+int32_t
+FeatureDictionary::intern(const char* inPrefix, size_t inPrefixLength,
+    const char* inName, size_t inLength) {
+
+    uint32_t symbolHash = hash(inPrefix, inPrefixLength, inName, inLength);
+    int32_t* bucket = buffer<int32_t>(kBuckets)
+        + find(inPrefix, inPrefixLength, inName, inLength, symbolHash);
+    if (*bucket >= 0)
+        return *bucket;
+
+    Symbol* symbols = buffer<Symbol>(kSymbols);
+    Symbol& symbol = symbols[numSymbols];
+    symbol.hash = symbolHash;
+    symbol.offset = numSymbols > 0
+        ? symbols[numSymbols - 1].offset + symbols[numSymbols - 1].length
+        : 0;
+    symbol.length = static_cast<uint32_t>(inPrefixLength + inLength);
+    symbol.stateBegin = symbol.stateEnd = 0;
+    symbol.tokenBegin = symbol.tokenEnd = 0;
+
+    char* name = buffer<char>(kChars) + symbol.offset;
+    std::memcpy(name, inPrefix, inPrefixLength);
+    std::memcpy(name + inPrefixLength, inName, inLength);
+
+    *bucket = numSymbols;
+    return numSymbols++;
+}
+
+/**
+ * @brief Return the symbol of the word feature of a token, or -1 if the token
+ *     is not in the dictionary
+ */
+int32_t
+FeatureDictionary::tokenSymbol(const char* inToken, size_t inLength) const {
+    size_t prefixLength = sizeof(kWordPrefix) - 1;
+    int32_t bucket = find(kWordPrefix, prefixLength, inToken, inLength,
+        hash(kWordPrefix, prefixLength, inToken, inLength));
+    return buffer<int32_t>(kBuckets)[bucket];
+}
+
+/**
+ * @brief Compile the feature set
+ *
+ * The state features and the token features are grouped by symbol with a
+ * counting sort: The ranges of the symbols first hold the counts, and are
+ * then filled in a second pass.
+ */
+void
+FeatureDictionary::compile(const TextArray& inNames,
+    const ArrayHandle<int32_t>& inPrevLabels,
+    const ArrayHandle<int32_t>& inLabels, const TextArray& inTokens,
+    const TextArray& inTokenFeatures) {
+
+    size_t numLabels = static_cast<size_t>(shape.numLabels);
+    int32_t* buckets = buffer<int32_t>(kBuckets);
+    Symbol* symbols = buffer<Symbol>(kSymbols);
+    int32_t* edges = buffer<int32_t>(kEdges);
+    double* edgeFeatures = buffer<double>(kEdgeFeatures);
+
+    std::fill(buckets, buckets + shape.numBuckets, -1);
+    std::fill(edges, edges + numLabels * numLabels, -1);
+    numSymbols = 0;
+
+    std::vector<int32_t> featureSymbols(inNames.size(), -1);
+    for (size_t i = 0; i < inNames.size(); ++i) {
+        if (inNames.equals(i, kEdgeFeature)) {
+            edges[static_cast<size_t>(inPrevLabels[i]) * numLabels
+                + static_cast<size_t>(inLabels[i])]
+                = static_cast<int32_t>(i);
+            *edgeFeatures++ = static_cast<double>(i);
+            *edgeFeatures++ = inPrevLabels[i];
+            *edgeFeatures++ = inLabels[i];
+        } else {
+            featureSymbols[i] = intern("", 0, inNames.data(i),
+                inNames.length(i));
+            symbols[featureSymbols[i]].stateEnd++;
+        }
+    }
+
+    std::vector<int32_t> tokenSymbols(inTokens.size());
+    std::vector<int32_t> featureOfToken(inTokens.size());
+    for (size_t i = 0; i < inTokens.size(); ++i) {
+        tokenSymbols[i] = intern(kWordPrefix, sizeof(kWordPrefix) - 1,
+            inTokens.data(i), inTokens.length(i));
+        featureOfToken[i] = intern("", 0, inTokenFeatures.data(i),
+            inTokenFeatures.length(i));
+        symbols[tokenSymbols[i]].tokenEnd++;
+    }
+
+    int32_t stateOffset = 0;
+    int32_t tokenOffset = 0;
+    for (int32_t s = 0; s < numSymbols; ++s) {
+        Symbol& symbol = symbols[s];
+        symbol.stateBegin = stateOffset;
+        stateOffset += symbol.stateEnd;
+        symbol.stateEnd = symbol.stateBegin;
+        symbol.tokenBegin = tokenOffset;
+        tokenOffset += symbol.tokenEnd;
+        symbol.tokenEnd = symbol.tokenBegin;
+    }
+
+    StateFeature* stateFeatures = buffer<StateFeature>(kStateFeatures);
+    for (size_t i = 0; i < inNames.size(); ++i) {
+        if (featureSymbols[i] < 0)
+            continue;
+        StateFeature& feature
+            = stateFeatures[symbols[featureSymbols[i]].stateEnd++];
+        feature.label = inLabels[i];
+        feature.index = static_cast<int32_t>(i);
+    }
+    int32_t* tokenFeatures = buffer<int32_t>(kTokenFeatures);
+    for (size_t i = 0; i < inTokens.size(); ++i)
+        tokenFeatures[symbols[tokenSymbols[i]].tokenEnd++]
+            = featureOfToken[i];
+
+    startSymbol = buckets[find("", 0, kStartFeature,
+        sizeof(kStartFeature) - 1,
+        hash("", 0, kStartFeature, sizeof(kStartFeature) - 1))];
+    endSymbol = buckets[find("", 0, kEndFeature, sizeof(kEndFeature) - 1,
+        hash("", 0, kEndFeature, sizeof(kEndFeature) - 1))];
+}
+
+/**
+ * @brief Number of state features with the name of the given symbol
+ */
+inline
+size_t
+FeatureDictionary::numStateFeatures(int32_t inSymbol) const {
+    if (inSymbol < 0)
+        return 0;
+    const Symbol& symbol = buffer<Symbol>(kSymbols)[inSymbol];
+    return static_cast<size_t>(symbol.stateEnd - symbol.stateBegin);
+}
+
+/**
+ * @brief Append the state features with the name of the given symbol to
+ *     sparse_r, for a token with the given label
+ */
+inline
+double*
+FeatureDictionary::appendStateFeatures(int32_t inSymbol, int32_t inLabel,
+    Index inPosition, double* outSparseR) const {
+
+    if (inSymbol < 0)
+        return outSparseR;
+
+    const Symbol& symbol = buffer<Symbol>(kSymbols)[inSymbol];
+    const StateFeature* features = buffer<StateFeature>(kStateFeatures);
+    for (int32_t f = symbol.stateBegin; f < symbol.stateEnd; ++f) {
+        *outSparseR++ = -1;
+        *outSparseR++ = features[f].label;
+        *outSparseR++ = features[f].index;
+        *outSparseR++ = static_cast<double>(inPosition);
+        *outSparseR++ = features[f].label == inLabel ? 1 : 0;
+    }
+    return outSparseR;
+}
+
+/**
+ * @brief Return the feature arrays of a document
+ *
+ * A token fires its word feature, the features listed for it in the
+ * dictionary, the start feature if it is the first token, and the end feature
+ * if it is the last token. Tokens are counted from 0, in the order of the
+ * array.
+ */
+AnyType
+FeatureDictionary::extract(const TextArray& inTokens,
+    const ArrayHandle<int32_t>& inLabels) const {
+
+    if (inTokens.size() == 0 || inLabels.size() != inTokens.size())
+        throw std::runtime_error("Invalid parameter: doc_tokens must not be "
+            "empty, and doc_labels must have one element per token");
+
+    Index length = static_cast<Index>(inTokens.size());
+    const Symbol* symbols = buffer<Symbol>(kSymbols);
+    const int32_t* tokenFeatures = buffer<int32_t>(kTokenFeatures);
+    const int32_t* edges = buffer<int32_t>(kEdges);
+
+    // Look up each token once, and count the state features
+    std::vector<int32_t> words(inTokens.size());
+    size_t numFeatures = 0;
+    for (size_t pos = 0; pos < inTokens.size(); ++pos) {
+        if (inLabels[pos] < 0 || inLabels[pos] >= shape.numLabels)
+            throw std::runtime_error("Invalid parameter: doc_labels contains "
+                "a label that is not in the feature set");
+
+        int32_t word = tokenSymbol(inTokens.data(pos), inTokens.length(pos));
+        size_t numTokenFeatures = numStateFeatures(word);
+        if (word >= 0)
+            for (int32_t t = symbols[word].tokenBegin;
+                t < symbols[word].tokenEnd; ++t)
+                numTokenFeatures += numStateFeatures(tokenFeatures[t]);
+        if (pos == 0)
+            numTokenFeatures += numStateFeatures(startSymbol);
+        if (pos == inTokens.size() - 1) {
+            numTokenFeatures += numStateFeatures(endSymbol);
+            // The length of the document is the position of the last state
+            // feature plus 1
+            if (numTokenFeatures == 0)
+                throw std::runtime_error("Invalid parameter: The last token "
+                    "of a document must fire at least one feature");
+        }
+        words[pos] = word;
+        numFeatures += numTokenFeatures;
+    }
+
+    Allocator& allocator = defaultAllocator();
+    MutableNativeColumnVector sparseR(allocator.allocateArray<double,
+        dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(
+            5 * numFeatures));
+    MutableNativeColumnVector denseM(allocator.allocateArray<double,
+        dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(
+            5 * static_cast<size_t>(length - 1)));
+    MutableNativeColumnVector sparseM(allocator.allocateArray<double,
+        dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(
+            3 * shape.numEdgeFeatures));
+
+    double* r = sparseR.data();
+    for (Index pos = 0; pos < length; ++pos) {
+        int32_t label = inLabels[static_cast<size_t>(pos)];
+        int32_t word = words[static_cast<size_t>(pos)];
+
+        if (pos == 0)
+            r = appendStateFeatures(startSymbol, label, pos, r);
+        r = appendStateFeatures(word, label, pos, r);
+        if (word >= 0)
+            for (int32_t t = symbols[word].tokenBegin;
+                t < symbols[word].tokenEnd; ++t)
+                r = appendStateFeatures(tokenFeatures[t], label, pos, r);
+        if (pos == length - 1)
+            r = appendStateFeatures(endSymbol, label, pos, r);
+
+        if (pos > 0) {
+            int32_t prevLabel = inLabels[static_cast<size_t>(pos - 1)];
+            int32_t edge = edges[static_cast<size_t>(prevLabel)
+                * static_cast<size_t>(shape.numLabels)
+                + static_cast<size_t>(label)];
+            if (edge < 0)
+                throw std::runtime_error("Invalid parameter: The feature set "
+                    "lacks an edge feature of the document");
+            double* m = denseM.data() + 5 * (pos - 1);
+            m[0] = prevLabel;
+            m[1] = label;
+            m[2] = edge;
+            m[3] = static_cast<double>(pos);
+            m[4] = 1;
+        }
+    }
+
+    const double* edgeFeatures = buffer<double>(kEdgeFeatures);
+    std::copy(edgeFeatures, edgeFeatures + 3 * shape.numEdgeFeatures,
+        sparseM.data());
+
+    AnyType tuple;
+    tuple << sparseR << denseM << sparseM;
+    return tuple;
+}
+
+} // namespace
+
+/**
+ * @brief Return the feature arrays of a training document, as expected by
+ *     lincrf_lbfgs_step()
+ *
+ * Arguments:
+ * - 0: doc_tokens (tokens of the document, in order)
+ * - 1: doc_labels (label of each token)
+ * - 2: feature_names (name of each feature, in the order of the feature
+ *   indices)
+ * - 3: feature_prev_labels (previous label of each feature, -1 for all but
+ *   edge features)
+ * - 4: feature_labels (label of each feature)
+ * - 5: dict_tokens, 6: dict_features (the names of the features other than
+ *   the word feature that each token fires, e.g., regular expressions; a
+ *   token may occur several times)
+ *
+ * The result is a composite value of sparse_r, dense_m, and sparse_m (see
+ * compute_logli_gradient() in linear_crf.cpp).
+ */
+AnyType
+crf_train_features::run(AnyType &args) {
+    FeatureDictionary* dictionary = FeatureDictionary::get(args);
+    TextArray tokens(args[0], "doc_tokens");
+    ArrayHandle<int32_t> labels = args[1].getAs<ArrayHandle<int32_t> >();
+    return dictionary->extract(tokens, labels);
+}
+
+} // namespace crf
+
+} // namespace modules
+
+} // namespace madlib
@@ -0,0 +1,10 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file feature_gen.hpp
+ *
+ *//* ----------------------------------------------------------------------- */
+
+/**
+ * @brief Linear-chain CRF: Feature arrays of a training document
+ */
+DECLARE_UDF(crf, crf_train_features)
@@ -4,12 +4,13 @@
  *
  * @brief Linear-chain Conditional Random Field functions
  *
- * We implement limited-memory BFGS method.
+ * We use the limited-memory BFGS method (see modules/shared/LBFGS.hpp).
  *
  *//* ----------------------------------------------------------------------- */
 
 #include <dbconnector/dbconnector.hpp>
 #include <modules/shared/HandleTraits.hpp>
+#include <modules/shared/LBFGS.hpp>
 #include "linear_crf.hpp"
 
 namespace madlib {
@@ -39,7 +40,7 @@ AnyType stateToResult(const Allocator &inAllocator,
  * object containing scalars and vectors.
  *
  * Note: We assume that the DOUBLE PRECISION array is initialized by the
- * database with length at least 58, and all elemenets are 0.
+ * database with length at least 68, and all elemenets are 0.
  */
 template <class Handle>
 class LinCrfLBFGSTransitionState {
@@ -119,21 +120,56 @@ public:
 
 private:
     static inline uint32_t arraySize(const uint32_t num_features) {
-        return 52 + 3 * num_features + num_features*(2*m+1)+2*m;
+        return 54 + 3 * num_features + LBFGS::workspaceSize(num_features, m);
     }
 
+    /**
+     * @brief Rebind to a new storage array
+     *
+     * @param inWidthOfFeature The number of features.
+     *
+     * Array layout (iteration refers to one aggregate-function call):
+     * Inter-iteration components (updated in final function):
+     *   w = LBFGS::workspaceSize(num_features, m)
+     * - 0: iteration (number of completed iterations)
+     * - 1: num_features (number of features)
+     * - 2: num_labels (number of labels)
+     * - 3: sigmaSquare (variance of the Gaussian prior on the coefficients)
+     * - 4: tolerance (L-BFGS terminates once the norm of the gradient is less
+     *   than tolerance times the norm of the coefficients)
+     * - 5: xtol (estimate of the machine precision, used by the line search)
+     * - 6: coef (vector of coefficients)
+     * - 6 + num_features: diag (diagonal of the inverse Hessian
+     *   approximation)
+     * - 6 + 2 * num_features: grad (gradient of the log-likelihood)
+     * - 6 + 3 * num_features: ws (work space of L-BFGS)
+     * - 8 + 3 * num_features + w: lbfgs_state (scalars of L-BFGS)
+     * - 29 + 3 * num_features + w: mcsrch_state (scalars of the line search)
+     *
+     * Intra-iteration components (updated in transition step):
+     * - 6 + 3 * num_features + w: numRows (number of rows already processed
+     *   in this iteration)
+     * - 7 + 3 * num_features + w: loglikelihood ( ln(l(c)) )
+     */
     void rebind(uint32_t inWidthOfFeature) {
+        uint32_t w = LBFGS::workspaceSize(inWidthOfFeature, m);
+
         iteration.rebind(&mStorage[0]);
         num_features.rebind(&mStorage[1]);
         num_labels.rebind(&mStorage[2]);
-        coef.rebind(&mStorage[3], inWidthOfFeature);
-        diag.rebind(&mStorage[3 + inWidthOfFeature], inWidthOfFeature);
-        grad.rebind(&mStorage[3 + 2 * inWidthOfFeature], inWidthOfFeature);
-        ws.rebind(&mStorage[3 + 3 * inWidthOfFeature], inWidthOfFeature*(2*m+1)+2*m);
-        numRows.rebind(&mStorage[3 + 3 * inWidthOfFeature + inWidthOfFeature*(2*m+1)+2*m]);
-        loglikelihood.rebind(&mStorage[4 + 3 * inWidthOfFeature + inWidthOfFeature*(2*m+1)+2*m]);
-        lbfgs_state.rebind(&mStorage[5 + 3 * inWidthOfFeature + inWidthOfFeature*(2*m+1)+2*m], 21);
-        mcsrch_state.rebind(&mStorage[26 + 3 * inWidthOfFeature + inWidthOfFeature*(2*m+1)+2*m], 25);
+        sigmaSquare.rebind(&mStorage[3]);
+        tolerance.rebind(&mStorage[4]);
+        xtol.rebind(&mStorage[5]);
+        coef.rebind(&mStorage[6], inWidthOfFeature);
+        diag.rebind(&mStorage[6 + inWidthOfFeature], inWidthOfFeature);
+        grad.rebind(&mStorage[6 + 2 * inWidthOfFeature], inWidthOfFeature);
+        ws.rebind(&mStorage[6 + 3 * inWidthOfFeature], w);
+        numRows.rebind(&mStorage[6 + 3 * inWidthOfFeature + w]);
+        loglikelihood.rebind(&mStorage[7 + 3 * inWidthOfFeature + w]);
+        lbfgs_state.rebind(&mStorage[8 + 3 * inWidthOfFeature + w],
+            LBFGS::kLBFGSStateSize);
+        mcsrch_state.rebind(&mStorage[29 + 3 * inWidthOfFeature + w],
+            LBFGS::kLineSearchStateSize);
     }
     Handle mStorage;
 
@@ -141,6 +177,9 @@ public:
     typename HandleTraits<Handle>::ReferenceToUInt32 iteration;
     typename HandleTraits<Handle>::ReferenceToUInt32 num_features;
     typename HandleTraits<Handle>::ReferenceToUInt32 num_labels;
+    typename HandleTraits<Handle>::ReferenceToDouble sigmaSquare;
+    typename HandleTraits<Handle>::ReferenceToDouble tolerance;
+    typename HandleTraits<Handle>::ReferenceToDouble xtol;
     typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap coef;
     typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap diag;
     typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap grad;
@@ -153,666 +192,137 @@ public:
     typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap mcsrch_state;
 };
 
-
-/** This class contains code for the limited-memory Broyden-Fletcher-Goldfarb-Shanno
- * (LBFGS) algorithm for large-scale multidimensional unconstrained minimization problems.
- * This following class is a translation of Fortran code written by Jorge Nocedal.
- */
-class LBFGS {
-public:
-    // shared variable in lbfgs
-    double stp1, ftol, stp, sq, yr, beta;
-    // iflag A return with <code>iflag &lt; 0</code> indicates an error,
-    // and <code>iflag = 0</code> indicates that the routine has
-    // terminated without detecting errors. On a return with
-    // <code>iflag = 1</code>, the user must evaluate the function
-    // <code>f</code> and gradient <code>g</code>. On a return with
-    // iflag is negative , lbfgs failed
-
-    int  iflag, iter, nfun, point, ispt, iypt, maxfev, info, bound, npt, cp, nfev, inmc, iycn, iscn;
-    // shared varibles in mcscrch
-    int infoc;
-    double dg, dgm, dginit, dgtest, dgx, dgxm, dgy, dgym, finit, ftest1, fm, fx, fxm, fy, fym, p5, p66, stx, sty, stmin, stmax, width, width1, xtrapf;
-    bool brackt, stage1, finish;
-
-    ColumnVector w;//
-    ColumnVector x;// solution vector
-    ColumnVector diag;
-
-    LBFGS(LinCrfLBFGSTransitionState<MutableArrayHandle<double> >&);
-    void save_state(LinCrfLBFGSTransitionState<MutableArrayHandle<double> > &state);
-    void mcstep (double&, double& , double&, double&, double& , double&, double&, double, double, bool&, double, double, int&);
-    void mcsrch (int, Eigen::VectorXd&, double, Eigen::VectorXd&, const Eigen::VectorXd&, double&, double, double, int, int&, int&, Eigen::VectorXd&);
-    void lbfgs(int, int, double, Eigen::VectorXd, double, double);
-};
-
-/**
- *@brief initialize state of current lbfgs iteration with the state of last iteration
- */
-LBFGS::LBFGS(LinCrfLBFGSTransitionState<MutableArrayHandle<double> >& state) {
-    w = state.ws;
-    diag = state.diag;
-    x = state.coef;
-
-    stp1 = state.lbfgs_state(0);
-    ftol = state.lbfgs_state(1);
-    stp = state.lbfgs_state(2);
-    sq = state.lbfgs_state(3);
-    yr = state.lbfgs_state(4);
-    beta = state.lbfgs_state(5);
-    iflag = static_cast<int>(state.lbfgs_state(6));
-    iter = static_cast<int>(state.lbfgs_state(7));
-    nfun = static_cast<int>(state.lbfgs_state(8));
-    point = static_cast<int>(state.lbfgs_state(9));
-    ispt = static_cast<int>(state.lbfgs_state(10));
-    iypt = static_cast<int>(state.lbfgs_state(11));
-    maxfev = static_cast<int>(state.lbfgs_state(12));
-    info = static_cast<int>(state.lbfgs_state(13));
-    bound = static_cast<int>(state.lbfgs_state(14));
-    npt = static_cast<int>(state.lbfgs_state(15));
-    cp = static_cast<int>(state.lbfgs_state(16));
-    nfev = static_cast<int>(state.lbfgs_state(17));
-    inmc = static_cast<int>(state.lbfgs_state(18));
-    iycn = static_cast<int>(state.lbfgs_state(19));
-    iscn = static_cast<int>(state.lbfgs_state(20));
-
-    infoc = static_cast<int>(state.mcsrch_state(0));
-    dg = state.mcsrch_state(1);
-    dgm = state.mcsrch_state(2);
-    dginit = state.mcsrch_state(3);
-    dgtest = state.mcsrch_state(4);
-    dgx = state.mcsrch_state(5);
-    dgxm = state.mcsrch_state(6);
-    dgy = state.mcsrch_state(7);
-    dgym = state.mcsrch_state(8);
-    finit = state.mcsrch_state(9);
-    ftest1 = state.mcsrch_state(10);
-    fm = state.mcsrch_state(11);
-    fx = state.mcsrch_state(12);
-    fxm = state.mcsrch_state(13);
-    fy = state.mcsrch_state(14);
-    fym = state.mcsrch_state(15);
-    stx = state.mcsrch_state(16);
-    sty = state.mcsrch_state(17);
-    stmin = state.mcsrch_state(18);
-    stmax = state.mcsrch_state(19);
-    width = state.mcsrch_state(20);
-    width1 = state.mcsrch_state(21);
-    brackt = (state.mcsrch_state(22) == 1.0 ? true: false);
-    stage1 = (state.mcsrch_state(23) == 1.0 ? true: false);
-    finish = (state.mcsrch_state(24) == 1.0 ? true: false);
-}
-
 /**
- *@brief save current lbfgs state for the next lbfgs iteration
- */
-void LBFGS::save_state(LinCrfLBFGSTransitionState<MutableArrayHandle<double> > &state) {
-    state.ws = w ;
-    state.diag = diag ;
-    state.coef = x ;
-
-    state.lbfgs_state(0) = stp1;
-    state.lbfgs_state(1) = ftol;
-    state.lbfgs_state(2) = stp;
-    state.lbfgs_state(3) = sq;
-    state.lbfgs_state(4) = yr;
-    state.lbfgs_state(5) = beta;
-    state.lbfgs_state(6) = iflag;
-    state.lbfgs_state(7) = iter;
-    state.lbfgs_state(8) = nfun;
-    state.lbfgs_state(9) = point;
-    state.lbfgs_state(10) = ispt;
-    state.lbfgs_state(11) = iypt;
-    state.lbfgs_state(12) = maxfev;
-    state.lbfgs_state(13) = info;
-    state.lbfgs_state(14) = bound;
-    state.lbfgs_state(15) = npt;
-    state.lbfgs_state(16) = cp;
-    state.lbfgs_state(17) = nfev;
-    state.lbfgs_state(18) = inmc;
-    state.lbfgs_state(19) = iycn;
-    state.lbfgs_state(20) = iscn;
-
-    state.mcsrch_state(0) = infoc;
-    state.mcsrch_state(1) =  dg;
-    state.mcsrch_state(2) = dgm;
-    state.mcsrch_state(3) = dginit;
-    state.mcsrch_state(4) = dgtest;
-    state.mcsrch_state(5) = dgx;
-    state.mcsrch_state(6) = dgxm;
-    state.mcsrch_state(7) = dgy;
-    state.mcsrch_state(8) = dgym;
-    state.mcsrch_state(9) = finit;
-    state.mcsrch_state(10) = ftest1;
-    state.mcsrch_state(11) = fm;
-    state.mcsrch_state(12) = fx;
-    state.mcsrch_state(13) = fxm;
-    state.mcsrch_state(14) = fy;
-    state.mcsrch_state(15) = fym;
-    state.mcsrch_state(16) = stx;
-    state.mcsrch_state(17) = sty;
-    state.mcsrch_state(18) = stmin;
-    state.mcsrch_state(19) = stmax;
-    state.mcsrch_state(20) = width;
-    state.mcsrch_state(21) = width1;
-    state.mcsrch_state(22) = (brackt == true ? 1.0 : 0.0);
-    state.mcsrch_state(23) = (stage1 == true ? 1.0 : 0.0);
-    state.mcsrch_state(24) = (finish == true ? 1.0 : 0.0);
-}
-void LBFGS::mcstep(double& stx, double& fx, double& dx,
-                   double& sty, double& fy, double& dy,
-                   double& stp, double fp, double dp, bool& brackt,
-                   double stmin, double stmax, int& info)
-{
-    bool bound;
-    double gamma, p, q, r, sgnd, stpc, stpf, stpq, theta, s;
-
-    info = 0;
-
-    if ((brackt && ((stp <= std::min(stx, sty)) || (stp >= std::max(stx, sty)))) ||
-            (dx * (stp - stx) >= 0) || (stmax < stmin)) {
-        return;
-    }
-
-    sgnd = dp*(dx/fabs(dx));
-    if (fp > fx) {
-        info = 1;
-        bound = true;
-        theta = 3.0 * (fx - fp) / (stp - stx) + dx + dp;
-        s = std::max(fabs(theta), std::max(fabs(dx), fabs(dp)));
-        gamma = s * sqrt((theta / s) * (theta / s) - (dx / s) * (dp / s));
-        if (stp < stx) {
-            gamma = -gamma;
-        }
-        p = gamma - dx + theta;
-        q = gamma - dx + gamma + dp;
-        r = p / q;
-        stpc = stx + r * (stp - stx);
-        stpq = stx + dx/((fx - fp)/(stp - stx) + dx)/2 * (stp - stx);
-        if (fabs(stpc - stx) < fabs(stpq - stx)) {
-            stpf = stpc;
-        } else {
-            stpf = stpc + (stpq - stpc)/2;
-        }
-        brackt = true;
-
-    } else if (sgnd < 0.0) {
-        info = 2;
-        bound = false;
-        theta = 3.0 * (fx - fp) / (stp - stx) + dx + dp;
-        s = std::max(fabs(theta), std::max(fabs(dx), fabs(dp)));
-        gamma = s * sqrt((theta / s) * (theta / s) - (dx / s) * (dp / s));
-        if (stp > stx) {
-            gamma = -gamma;
-        }
-        p = gamma - dp + theta;
-        q = gamma - dp + gamma + dx;
-        r = p / q;
-        stpc = stp + r * (stx - stp);
-        stpq = stp + dp / (dp - dx) * (stx - stp);
-        stpf = (fabs(stpc - stp) > fabs(stpq - stp)) ? stpc : stpq;
-        brackt = true;
-
-    } else if (fabs(dp) < fabs(dx)) {
-        info = 3;
-        bound = true;
-        theta = 3.0 * (fx - fp) / (stp - stx) + dx + dp;
-        s = std::max(fabs(theta), std::max(fabs(dx), fabs(dp)));
-        gamma = s * sqrt(std::max(0.0, (theta/s)*(theta/s) - (dx/s)*(dp/s)));
-        if (stp > stx) {
-            gamma = -gamma;
-        }
-        p = gamma - dp + theta;
-        q = gamma + (dx - dp) + gamma;
-        r = p / q;
-        if ((r < 0.0) && (gamma != 0.0)) {
-            stpc = stp + r * (stx - stp);
-        } else {
-            stpc = (stp > stx) ? stmax : stmin;
-        }
-
-        stpq = stp + dp / (dp - dx) * (stx - stp);
-        if (brackt) {
-            stpf = (fabs(stp - stpc) < fabs(stp - stpq)) ? stpc : stpq;
-        } else {
-            stpf = (fabs(stp - stpc) > fabs(stp - stpq)) ? stpc : stpq;
-        }
-
-    } else {
-        info = 4;
-        bound = false;
-        if (brackt) {
-            theta = 3.0 * (fp - fy) / (sty - stp) + dy + dp;
-            s = std::max(fabs(theta), std::max(fabs(dy), fabs(dp)));
-            gamma = s * sqrt((theta/s)*(theta/s) - (dy/s)*(dp/s));
-            if (stp > sty) {
-                gamma = -gamma;
-            }
-            p = gamma - dp + theta;
-            q = gamma - dp + gamma + dy;
-            r = p / q;
-            stpc = stp + r * (sty - stp);
-            stpf = stpc;
-        } else {
-            stpf = (stp > stx) ? stmax : stmin;
-        }
-    }
-
-    if (fp > fx) {
-        sty = stp;
-        fy = fp;
-        dy = dp;
-    } else {
-        if (sgnd < 0.0) {
-            sty = stx;
-            fy = fx;
-            dy = dx;
-        }
-        stx = stp;
-        fx = fp;
-        dx = dp;
-    }
-
-    stp = std::max(stmin, std::min(stmax, stpf));
-    if (brackt && bound) {
-        if (sty > stx) {
-            stp = std::min(stx + 0.66*(sty - stx), stp);
-        } else {
-            stp = std::max(stx + 0.66*(sty - stx), stp);
-        }
-    }
-
-    return;
-}
-
-void LBFGS::mcsrch(int n, Eigen::VectorXd& x, double f, Eigen::VectorXd& g, const Eigen::VectorXd& s, double& stp, double ftol, double xtol, int maxfev, int& info, int& nfev, Eigen::VectorXd& wa)
-{
-    double stpmin = 1e-20;
-    double stpmax = 1e20;
-    double p5 = 0.5;
-    double p66 = 0.66;
-    double xtrapf = 4.0;
-    double gtol = 0.9;
-
-    if(info != -1) {
-        infoc = 1;
-        if (n <= 0 || stp <= 0 || ftol < 0 || gtol < 0 || xtol < 0 || stpmin < 0 || stpmax < stpmin || maxfev <= 0 )
-            return;
-
-        dginit = g.dot(s);
-        if (dginit >= 0.0) {
-            std::cout<<"The search direction is not a descent direction."<<std::endl;
-            return;
-        }
-
-        brackt = false;
-        stage1 = true;
-        nfev = 0;
-        finit = f;
-        dgtest = ftol * dginit;
-        width = stpmax - stpmin;
-        width1 = width/p5;
-
-        wa = x;
-
-        stx = 0.0;
-        fx = finit;
-        dgx = dginit;
-        sty = 0.0;
-        fy = finit;
-        dgy = dginit;
-    }
-
-    while(true)
-    {
-        if(info != -1)
-        {
-            if (brackt) {
-                if (stx < sty) {
-                    stmin = stx;
-                    stmax = sty;
-                } else {
-                    stmin = sty;
-                    stmax = stx;
-                }
-            } else {
-                stmin = stx;
-                stmax = stp + xtrapf * (stp - stx);
-            }
-
-            if (stp > stpmax) {
-                stp = stpmax;
-            }
-            if (stp < stpmin) {
-                stp = stpmin;
-            }
-            if ((brackt && ((stp <= stmin) || (stp >= stmax))) || (nfev == maxfev - 1) ||
-                    (!infoc) || (brackt && ((stmax - stmin) <= xtol * stmax))) {
-                stp = stx;
-            }
-
-            x = wa + stp * s;
-            info = -1;
-            return;
-        }
-        info = 0;
-        nfev= nfev + 1;
-        dg = g.dot(s);
-        ftest1 = finit + stp * dgtest;
-
-        if ((brackt && ((stp <= stmin) || (stp >= stmax))) || (!infoc)) {
-            info = 6;
-        }
-        if ((stp == stpmax) && (f <= ftest1) && (dg <= dgtest)) {
-            info = 5;
-        }
-        if ((stp == stpmin) && ((f >= ftest1) || (dg >= dgtest))) {
-            info = 4;
-        }
-        if (nfev >= maxfev) {
-            info = 3;
-        }
-        if (brackt && (stmax - stmin <= xtol * stmax)) {
-            info = 2;
-        }
-        if ((f <= ftest1) && (fabs(dg) <= -gtol * dginit)) {
-            info = 1;
-        }
-        if (info !=0 )
-            return ;
-
-
-        if ( stage1 && f <= ftest1 && dg >= std::min(ftol , gtol) * dginit ) stage1 = false;
-
-        if (stage1 && f <= fx && f > ftest1) {
-            fm = f - stp * dgtest;
-            fxm = fx - stx * dgtest;
-            fym = fy - sty * dgtest;
-            dgm = dg - dgtest;
-            dgxm = dgx - dgtest;
-            dgym = dgy - dgtest;
-            mcstep(stx, fxm, dgxm, sty, fym, dgym, stp, fm, dgm, brackt, stmin, stmax, infoc);
-            fx = fxm + stx * dgtest;
-            fy = fym + sty * dgtest;
-            dgx = dgxm + dgtest;
-            dgy = dgym + dgtest;
-        } else {
-            mcstep(stx, fx, dgx, sty, fy, dgy, stp, f, dg, brackt, stmin, stmax, infoc);
-        }
-
-        if (brackt) {
-            if (fabs(sty - stx) >= p66 * width1) {
-                stp = stx + p5 * (sty - stx);
-            }
-            width1 = width;
-            width = fabs(sty - stx);
-        }
-    }
-}
-
-
-
-void LBFGS::lbfgs(int n, int m, double f, Eigen::VectorXd g, double eps , double xtol)
-{
-    bool execute_entire_while_loop = false;
-    if(iflag == 0) {
-        iter=0;
-        if ( n <= 0 || m <= 0 )
-        {
-            iflag= -3;
-        }
-
-        nfun= 1;
-        point = 0;
-        finish = false;
-        ispt = n + 2*m;
-        iypt = ispt + n*m;
-        npt = 0;
-        w.segment(ispt, n) = (-g).cwiseProduct(diag);
-        stp1 = 1.0 / g.norm();
-        ftol= 0.0001;
-        maxfev= 20;
-        execute_entire_while_loop = true;
-    }
-    while(true) {
-        if(execute_entire_while_loop) {
-            iter++;
-            info = 0;
-            bound=iter-1;
-            if (iter!=1) {
-                if (iter > m) bound = m;
-                double ys = w.segment(iypt + npt, n).dot(w.segment(ispt + npt, n));
-                double yy = w.segment(iypt + npt, n).squaredNorm();
-                diag.setConstant(ys / yy);
-                cp = point;
-                if (point ==0 ) cp =m;
-                w[n + cp-1] = 1.0 / ys;
-                w.head(n) = -g;
-                cp = point;
-                for (int i = 0; i < bound; i++) {
-                    cp -= 1;
-                    if (cp == -1) {
-                        cp = m - 1;
-                    }
-                    sq = w.segment(ispt + cp *n,n).dot(w.head(n));
-                    inmc = n + m + cp;
-                    iycn = iypt + cp * n;
-                    w[inmc] = sq * w[n + cp];
-                    w.head(n) -= w[inmc] * w.segment(iycn, n);
-                }
-                w.head(n)=w.head(n).cwiseProduct(diag);
-
-                for (int i = 0; i < bound; i++) {
-                    yr = w.segment(iypt + cp * n, n).dot(w.head(n));
-                    inmc = n + m + cp;
-                    beta = w[inmc] - w[n + cp] * yr;
-                    iscn = ispt + cp * n;
-                    w.head(n) += beta * w.segment(iscn, n);
-                    cp += 1;
-                    if (cp == m) {
-                        cp = 0;
-                    }
-                }
-                w.segment(ispt + point * n, n) = w.head(n);
-            }
-            nfev = 0;
-            stp = (iter == 1) ? stp1 : 1.0;
-            w.head(n) = g;
-        }
-        mcsrch(n, x, f, g, w.segment(ispt + point * n, n), stp, ftol, xtol, maxfev, info, nfev, diag);
-        if(info == -1) {
-            iflag = 1;
-            return;
-        } else {
-            iflag = -1;
-        }
-        nfun = nfun + nfev;
-        npt = point * n;
-        w.segment(ispt + npt,n) *=stp;
-        w.segment(iypt + npt,n) =g - w.head(n);
-        point = point + 1;
-        if (point == m) {
-            point = 0;
-        }
-        if(g.norm()/std::max(1.0,x.norm())<=eps) {
-            finish = true;
-        }
-        if (finish) {
-            iflag = 0;
-            return;
-        }
-        execute_entire_while_loop = true;
-    }
-}
-
-/**
- *@brief compute exponential of Mi and Vi
- */
-void compute_exp_Mi(int num_labels, Eigen::MatrixXd &Mi, Eigen::VectorXd &Vi) {
-    // take exponential operator
-    for (int m = 0; m < num_labels; m++) {
-        Vi(m) = std::exp(Vi(m));
-        for (int n = 0; n < num_labels; n++) {
-            Mi(m, n) = std::exp(Mi(m, n));
-        }
-    }
-}
-
-Eigen::VectorXd mult(Eigen::MatrixXd Mi, Eigen::VectorXd Vi, bool trans, int num_label)
-{
-    int i=0,j=0,r=0,c=0;
-    Eigen::VectorXd z(num_label);
-    z.fill(0);
-    for (i = 0; i < num_label; i++ )
-    {
-        for (j=0; j< num_label; j++) {
-            r= i;
-            c=j;
-            if(trans) {
-                r= j;
-                c=i;
-            }
-            z(r)+=Mi(i,j)*Vi(c);
-        }
-    }
-    return z;
-}
-
-
-/**
- *@brief compute loglikelihood and gradient using forward-backward algorithm
+ * @brief Compute loglikelihood and gradient using the forward-backward
+ *     algorithm
+ *
+ * Arguments:
+ * - sparse_r: State features, five values (prev_label, curr_label, f_index,
+ *   position, exist) per feature, sorted by position
+ * - dense_m: Observed edge features, five values per position >= 1, with
+ *   f_index at offset 2
+ * - sparse_m: All edge features, three values (f_index, prev_label,
+ *   curr_label) per feature. They are the same at every position.
+ *
+ * All potentials are exponentiated once per sequence with a vectorized
+ * exp(): the edge potentials M (num_labels x num_labels), which do not depend
+ * on the position, and the state potentials V (num_labels x seq_len). The
+ * forward and backward recursions are matrix-vector products with M and its
+ * transpose, scaled at every position to avoid overflow. The expected counts
+ * of all edge features are summed over the positions with a single matrix
+ * product of the forward and backward values, so each edge feature is only
+ * visited once per sequence.
+ *
+ * The expected counts are only computed for the features that fire in the
+ * sequence, and they are subtracted from the gradient in the state right
+ * away. The cost per sequence therefore does not depend on the total number
+ * of features; the gradient is the only dense vector, and it is allocated
+ * once per segment.
  */
 void compute_logli_gradient(LinCrfLBFGSTransitionState<MutableArrayHandle<double> >& state,
                             MappedColumnVector& sparse_r,
                             MappedColumnVector& dense_m,
                             MappedColumnVector& sparse_m) {
-    int r_size = static_cast<int>(sparse_r.size());
-    int sparse_m_size = static_cast<int>(sparse_m.size());
-    int seq_len = static_cast<int>(sparse_r(r_size-2)) + 1;
-
-    Eigen::MatrixXd betas(state.num_labels, seq_len);
-    Eigen::VectorXd scale(seq_len);
-    Eigen::MatrixXd Mi(state.num_labels,state.num_labels);
-    Eigen::VectorXd Vi(state.num_labels);
-    Eigen::VectorXd alpha(state.num_labels);
-    Eigen::VectorXd next_alpha(state.num_labels);
-    Eigen::VectorXd temp(state.num_labels);
-    Eigen::VectorXd ExpF(state.num_features);
-    betas.fill(0);
-    scale.fill(0);
-    alpha.fill(1);
-    next_alpha.fill(0);
-    temp.fill(0);
-    ExpF.fill(0);
-    // compute beta values in a backward fashion
-    // also scale beta-values to 1 to avoid numerical problems
-    scale(seq_len - 1) = state.num_labels;
-    betas.col(seq_len - 1).fill(1.0 / scale(seq_len - 1));
-
-    int index = r_size-1;
-    for (int i = seq_len - 1; i > 0; i--) {
-        Mi.fill(0);
-        Vi.fill(0);
-        // examine all features at position "pos"
-        //(prev_labe, curr_label, f_index, start_pos, exist)
-        while (index-4>=0 && sparse_r(index-1) == i) {
-            int curr_index =  (int)sparse_r(index-3);
-            int f_index =  (int)sparse_r(index-2);
-            Vi(curr_index) += state.coef(f_index);
-            index-=5;
-        }
-        //(f_index, prev_label, curr_label)
-        for(int n=0; n+2<sparse_m_size ; n+=3) {
-            Mi((int)sparse_m(n+1), (int)sparse_m(n+2)) += state.coef((int)sparse_m(n));
-        }
-
-        compute_exp_Mi(state.num_labels, Mi, Vi);
-
-        temp=betas.col(i);
-        temp=temp.cwiseProduct(Vi);
-        betas.col(i -1) = mult(Mi,temp,false,state.num_labels);
-        // scale for the next (backward) beta values
-        scale(i - 1)=betas.col(i-1).sum();
-        betas.col(i - 1)*=(1.0 / scale(i - 1));
-    } // end of beta values computation
-
-    index = 0;
-    // start to compute the log-likelihood of the current sequence
-    for (int j = 0; j < seq_len; j++) {
-        Mi.fill(0);
-        Vi.fill(0);
-        // examine all features at position "pos"
-        int ori_index = index;
-        while (((index+4) <= (r_size-1)) && sparse_r(index+3) == j) {
-            int curr_index =  (int)sparse_r(index+1);
-            int f_index =  (int)sparse_r(index+2);
-            Vi(curr_index) += state.coef(f_index);
-            index+=5;
-        }
-        if(j>=1)
-            for(int n=0; n+2<sparse_m_size ; n+=3) {
-                Mi((int)sparse_m(n+1), (int)sparse_m(n+2)) += state.coef((int)sparse_m(n));
-            }
-
-        compute_exp_Mi(state.num_labels, Mi, Vi);
-
-        if(j>0) {
-            temp = alpha;
-            next_alpha=mult(Mi,temp,true,state.num_labels);
-            next_alpha=next_alpha.cwiseProduct(Vi);
-        } else {
-            next_alpha=Vi;
-        }
-
-
-        index = ori_index;
-        while (((index+4) <= (r_size-1)) && sparse_r(index+3) == j) {
-            int curr_index =  (int)sparse_r(index+1);
-            int f_index =  (int)sparse_r(index+2);
-            int exist = (int)sparse_r(index+4);
-            if (exist == 1) {
-                state.grad(f_index) += 1;
-                state.loglikelihood += state.coef(f_index);
-            }
-            ExpF(f_index) += next_alpha(curr_index) * betas(curr_index,j);
-            index+=5;
-        }
-        // Edge feature
-        if(j>=1) {
-            int f_index = (int)dense_m((j-1)*5+2);
+    Index num_labels = static_cast<uint32_t>(state.num_labels);
+    Index r_size = sparse_r.size();
+    Index sparse_m_size = sparse_m.size();
+    Index seq_len = static_cast<Index>(sparse_r(r_size - 2)) + 1;
+
+    // edge potentials (the same at every position)
+    Matrix M = Matrix::Zero(num_labels, num_labels);
+    for (Index n = 0; n + 2 < sparse_m_size; n += 3) {
+        M(static_cast<Index>(sparse_m(n + 1)),
+          static_cast<Index>(sparse_m(n + 2)))
+            += state.coef(static_cast<Index>(sparse_m(n)));
+    }
+    M = M.array().exp().matrix();
+
+    // state potentials at all positions, and the observed state features
+    Matrix V = Matrix::Zero(num_labels, seq_len);
+    for (Index index = 0; index + 4 < r_size; index += 5) {
+        Index curr_index = static_cast<Index>(sparse_r(index + 1));
+        Index f_index = static_cast<Index>(sparse_r(index + 2));
+        Index pos = static_cast<Index>(sparse_r(index + 3));
+        V(curr_index, pos) += state.coef(f_index);
+        if (sparse_r(index + 4) == 1) {
             state.grad(f_index) += 1;
             state.loglikelihood += state.coef(f_index);
-            //(f_index, prev_label, curr_label)
-            for(int n=0; n+2<sparse_m_size ; n+=3) {
-                int f_index = (int)sparse_m(n);
-                int prev_index = (int)sparse_m(n+1);
-                int curr_index = (int)sparse_m(n+2);
-                ExpF(f_index) += alpha[prev_index] * Vi(curr_index) * Mi(prev_index,curr_index) * betas(curr_index, j);
-            }
         }
+    }
+    V = V.array().exp().matrix();
 
-        alpha = next_alpha;
-        alpha*=(1.0 / scale(j));
+    // observed edge features
+    for (Index j = 1; j < seq_len; j++) {
+        Index f_index = static_cast<Index>(dense_m((j - 1) * 5 + 2));
+        state.grad(f_index) += 1;
+        state.loglikelihood += state.coef(f_index);
     }
 
-    // Zx = sum(alpha_i_n) where i = 1..num_labels, n = seq_len
-    double Zx = alpha.sum();
-    state.loglikelihood -= std::log(Zx);
+    // compute beta values in a backward fashion
+    // also scale beta-values to 1 to avoid numerical problems
+    Matrix betas(num_labels, seq_len);
+    ColumnVector scale(seq_len);
+    scale(seq_len - 1) = static_cast<double>(num_labels);
+    betas.col(seq_len - 1).fill(1.0 / scale(seq_len - 1));
+    for (Index i = seq_len - 1; i > 0; i--) {
+        betas.col(i - 1).noalias() = M * betas.col(i).cwiseProduct(V.col(i));
+        scale(i - 1) = betas.col(i - 1).sum();
+        betas.col(i - 1) *= 1.0 / scale(i - 1);
+    }
 
-    // re-correct the value of seq_logli because Zx was computed from
-    // scaled alpha values
-    for (int k = 0; k < seq_len; k++) {
-        state.loglikelihood -= std::log(scale(k));
+    // forward values, each column scaled by the scale of its position
+    Matrix alphas(num_labels, seq_len);
+    alphas.col(0) = V.col(0) / scale(0);
+    for (Index j = 1; j < seq_len; j++) {
+        alphas.col(j).noalias() = M.transpose() * alphas.col(j - 1);
+        alphas.col(j) = alphas.col(j).cwiseProduct(V.col(j)) / scale(j);
     }
-    // update the gradient vector
-    for (size_t k = 0; k < state.num_features; k++) {
-        state.grad(k) -= ExpF(k) / Zx;
+
+    // Zx = sum(alpha_i_n) where i = 1..num_labels, n = seq_len, and the
+    // log-likelihood is corrected because Zx was computed from scaled alpha
+    // values
+    double Zx = alphas.col(seq_len - 1).sum();
+    state.loglikelihood -= std::log(Zx) + scale.array().log().sum();
+
+    // expected counts of the state features
+    Matrix stateMarginals = alphas.cwiseProduct(betas) * scale.asDiagonal();
+    for (Index index = 0; index + 4 < r_size; index += 5) {
+        Index curr_index = static_cast<Index>(sparse_r(index + 1));
+        Index f_index = static_cast<Index>(sparse_r(index + 2));
+        Index pos = static_cast<Index>(sparse_r(index + 3));
+        state.grad(f_index) -= stateMarginals(curr_index, pos) / Zx;
     }
 
+    // expected counts of the edge features, summed over all positions
+    if (seq_len > 1) {
+        Matrix edgeMarginals(num_labels, num_labels);
+        edgeMarginals.noalias() = alphas.leftCols(seq_len - 1)
+            * V.rightCols(seq_len - 1).cwiseProduct(
+                betas.rightCols(seq_len - 1)).transpose();
+        edgeMarginals = edgeMarginals.cwiseProduct(M);
+        for (Index n = 0; n + 2 < sparse_m_size; n += 3) {
+            state.grad(static_cast<Index>(sparse_m(n)))
+                -= edgeMarginals(static_cast<Index>(sparse_m(n + 1)),
+                    static_cast<Index>(sparse_m(n + 2))) / Zx;
+        }
+    }
 }
 
 /**
  * @brief Compute the log likelihood and gradient vector for each tuple
+ *
+ * Arguments:
+ * - 0: state
+ * - 1: sparse_r, 2: dense_m, 3: sparse_m (features of the sequence)
+ * - 4: feature_size, 5: tag_size
+ * - 6: previous_state (NULL in the first iteration)
+ * - 7: sigma_square (variance of the Gaussian prior, default 100)
+ * - 8: tolerance (default 0.001)
+ * - 9: xtol (estimate of the machine precision, default 1e-16)
+ * - 10: initial_coef (coefficients to start from, e.g., those of an existing
+ *   model; default all 0)
+ *
+ * Arguments 7 to 10 are only used in the first iteration.
  */
 AnyType
 lincrf_lbfgs_step_transition::run(AnyType &args) {
@@ -826,6 +336,36 @@ lincrf_lbfgs_step_transition::run(AnyType &args) {
             LinCrfLBFGSTransitionState<ArrayHandle<double> > previousState = args[6];
             state = previousState;
             state.reset();
+        } else {
+            // configuration parameters, later iterations take them from the
+            // previous state
+            double sigmaSquare = args[7].isNull()
+                ? 100. : args[7].getAs<double>();
+            if (sigmaSquare <= 0.)
+                throw std::runtime_error("Invalid parameter: sigma_square <= "
+                    "0.0");
+            double tolerance = args[8].isNull()
+                ? 0.001 : args[8].getAs<double>();
+            if (tolerance < 0.)
+                throw std::runtime_error("Invalid parameter: tolerance < 0.0");
+            double xtol = args[9].isNull()
+                ? 1.0e-16 : args[9].getAs<double>();
+            if (xtol < 0.)
+                throw std::runtime_error("Invalid parameter: xtol < 0.0");
+
+            state.sigmaSquare = sigmaSquare;
+            state.tolerance = tolerance;
+            state.xtol = xtol;
+
+            // warm start
+            if (!args[10].isNull()) {
+                MappedColumnVector initialCoef
+                    = args[10].getAs<MappedColumnVector>();
+                if (initialCoef.size() != state.coef.size())
+                    throw std::runtime_error("Invalid parameter: "
+                        "initial_coef must have feature_size elements");
+                state.coef = initialCoef;
+            }
         }
     }
     state.numRows++;
@@ -868,7 +408,7 @@ lincrf_lbfgs_step_final::run(AnyType &args) {
 
     // To avoid overfitting, penalize the likelihood with a spherical Gaussian
     // weight prior
-    double sigma_square = 100;
+    double sigma_square = state.sigmaSquare;
     state.loglikelihood -= (state.coef.dot(state.coef)/(2 * sigma_square));
     state.grad -= state.coef/sigma_square;
 
@@ -876,27 +416,17 @@ lincrf_lbfgs_step_final::run(AnyType &args) {
     state.loglikelihood = state.loglikelihood * -1;
     state.grad = -state.grad;
 
-    double eps = 0.001; //accuracy of the solution to be found
-    double xtol = 1.0e-16; //an estimate of the machine precision
+    // The parameters were validated by the transition function, and LBFGS
+    // reports a non-positive number of features or corrections through
+    // check_status()
+    double eps = state.tolerance; //accuracy of the solution to be found
+    double xtol = state.xtol; //an estimate of the machine precision
 
-    assert((state.m > 0) && (state.m <= state.num_features) && (eps >= 0.0));
     LBFGS instance(state);// initialize the lbfgs with state of last iteration
     instance.lbfgs(state.num_features, state.m, state.loglikelihood, state.grad, eps, xtol);// lbfgs optimization
     instance.save_state(state);//save current state for the next iteration of lbfgs
 
-    switch(instance.iflag)
-    {
-    case -1:
-        throw std::logic_error("The line search rountine mcsch failed");
-        break;
-    case -2:
-        throw std::logic_error("The i-th diagonal element of the diagonal inverse Hessian"
-                               "approximation, given in DIAG, is not positive");
-        break;
-    case -3:
-        throw std::logic_error("Improper input parameters for LBFGS n or m are not positive");
-        break;
-    }
+    instance.check_status();
 
     if(!state.coef.is_finite())
         throw NoSolutionFoundException("Over- or underflow in "
@@ -0,0 +1,611 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file viterbi.cpp
+ *
+ * @brief Viterbi decoding for linear-chain Conditional Random Fields
+ *
+ * The factors are the integer scores computed by crf_test_fgen(), i.e., log
+ * potentials multiplied by 1000:
+ * - The m factors are a (nlabel + 2) x nlabel array. Row 0 contains the start
+ *   scores, row p + 1 the scores of the transitions from label p, and the last
+ *   row the end scores.
+ * - The r factors of a document are a doclen x nlabel array of the state
+ *   scores of each token.
+ *
+ * Documents are decoded one after the other with the same m factors. We
+ * therefore convert the m factors only once per query and keep them, together
+ * with all scratch buffers, in the cross-call context of the function (see
+ * AnyType::getUserFunctionContext()). The batch variant decodes several
+ * documents per call, which amortizes the per-call overhead further.
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#include <dbconnector/dbconnector.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "viterbi.hpp"
+
+namespace madlib {
+
+// Use Eigen
+using namespace dbal::eigen_integration;
+
+namespace modules {
+
+namespace crf {
+
+namespace {
+
+template <class Scalar>
+struct MappedScoreMatrix {
+    typedef Eigen::Map<Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> >
+        type;
+};
+typedef Eigen::Map<const Eigen::Matrix<int32_t, Eigen::Dynamic,
+    Eigen::Dynamic> > MappedIntMatrix;
+
+/**
+ * @brief The factors are log potentials multiplied by this constant
+ */
+const double kScoreScale = 1000.;
+
+/**
+ * @brief Integers up to this magnitude (\f$ 2^{24} \f$) are exact in single
+ *     precision
+ */
+const double kMaxExactFloat = 16777216.;
+
+/**
+ * @brief Partial label sequence considered by the k-best search
+ *
+ * \c state is the index <tt>label * topK + rank</tt> of the sequence it
+ * extends (or, for complete sequences, of the sequence itself).
+ */
+template <class Scalar>
+struct Candidate {
+    Scalar score;
+    int32_t state;
+
+    /**
+     * Order by descending score. Ties are broken by the state, so that the
+     * result does not depend on the sort algorithm.
+     */
+    bool operator<(const Candidate& inOther) const {
+        return score > inOther.score
+            || (score == inOther.score && state < inOther.state);
+    }
+};
+
+/**
+ * @brief Model and scratch buffers cached across calls
+ *
+ * The header is followed by the buffers listed in \c Buffer, each aligned to
+ * 16 bytes, and finally by the raw backend representation of the m factors
+ * (\c rawSize bytes), which is what we compare against on each call (see
+ * also regress/predict.cpp). The layout only depends on \c numLabels,
+ * \c topK, and \c maxLength, the maximum document length the buffers can
+ * hold.
+ *
+ * Scores are single-precision floats if possible: The factors are integers,
+ * so all path scores are exact as long as they stay below \f$ 2^{24} \f$ in
+ * magnitude, and twice as many of them fit into a SIMD register. Documents
+ * whose path scores might exceed that bound (see maxPathScore()) are decoded
+ * in double precision instead, which is exact up to \f$ 2^{53} \f$. The
+ * partition function is always computed in double precision.
+ */
+struct ViterbiWorkspace {
+    enum Buffer {
+        // float, numLabels x (numLabels + 2), column j is row j of the m
+        // factors
+        kTransitions,
+        // double, the same as kTransitions
+        kWideTransitions,
+        // double, numLabels x numLabels, entry (c, p) is the potential of the
+        // transition from p to c
+        kExpTransitions,
+        // float or double, numLabels x maxLength (top 1) or
+        // numLabels * topK x 2 (top k)
+        kScores,
+        // int32_t, numLabels * topK x maxLength (top k only)
+        kBackpointers,
+        // Candidate<float> or Candidate<double>, numLabels * topK (top k
+        // only)
+        kCandidates,
+        // double, numLabels x 3
+        kForward,
+        kRaw
+    };
+
+    size_t capacity;
+    size_t rawSize;
+    Index numLabels;
+    Index topK;
+    Index maxLength;
+    // Maximum magnitude of the m factors
+    double maxTransition;
+
+    static ViterbiWorkspace* get(AnyType &args, Index inNumLabels,
+        Index inTopK, Index inMaxLength);
+
+    void decode(const int32_t* inR, Index inLength, int32_t* outResult);
+
+private:
+    static size_t align(size_t inSize) {
+        return (inSize + 15) & ~static_cast<size_t>(15);
+    }
+
+    static size_t sizeOf(int inBuffer, Index inNumLabels, Index inTopK,
+        Index inMaxLength);
+
+    static size_t offsetOf(int inBuffer, Index inNumLabels, Index inTopK,
+        Index inMaxLength) {
+
+        size_t offset = align(sizeof(ViterbiWorkspace));
+        for (int buffer = 0; buffer < inBuffer; ++buffer)
+            offset += align(sizeOf(buffer, inNumLabels, inTopK, inMaxLength));
+        return offset;
+    }
+
+    template <class T>
+    T* buffer(Buffer inBuffer) {
+        return reinterpret_cast<T*>(reinterpret_cast<char*>(this)
+            + offsetOf(inBuffer, numLabels, topK, maxLength));
+    }
+
+    template <class Scalar>
+    typename MappedScoreMatrix<Scalar>::type transitions() {
+        return typename MappedScoreMatrix<Scalar>::type(buffer<Scalar>(
+            sizeof(Scalar) == sizeof(float) ? kTransitions : kWideTransitions),
+            numLabels, numLabels + 2);
+    }
+
+    void setModel(const ArrayHandle<int32_t>& inM);
+    double maxPathScore(const int32_t* inR, Index inLength) const;
+    double logPartition(const int32_t* inR, Index inLength);
+    template <class Scalar>
+    double decodeTop1(const int32_t* inR, Index inLength, int32_t* outLabels);
+    template <class Scalar>
+    void decodeTopK(const int32_t* inR, Index inLength, int32_t* outResult,
+        double inLogPartition);
+};
+
+/**
+ * @brief Size (in bytes) of a buffer
+ */
+size_t
+ViterbiWorkspace::sizeOf(int inBuffer, Index inNumLabels, Index inTopK,
+    Index inMaxLength) {
+
+    size_t numLabels = static_cast<size_t>(inNumLabels);
+    size_t numStates = numLabels * static_cast<size_t>(inTopK);
+    size_t maxLength = static_cast<size_t>(inMaxLength);
+
+    switch (inBuffer) {
+        case kTransitions:
+            return sizeof(float) * numLabels * (numLabels + 2);
+        case kWideTransitions:
+            return sizeof(double) * numLabels * (numLabels + 2);
+        case kExpTransitions:
+            return sizeof(double) * numLabels * numLabels;
+        case kScores:
+            return sizeof(double)
+                * (inTopK == 1 ? numLabels * maxLength : numStates * 2);
+        case kBackpointers:
+            return inTopK == 1 ? 0 : sizeof(int32_t) * numStates * maxLength;
+        case kCandidates:
+            return inTopK == 1 ? 0 : sizeof(Candidate<double>) * numStates;
+        case kForward:
+            return sizeof(double) * numLabels * 3;
+    }
+    return 0;
+}
+
+/**
+ * @brief Return the workspace for the given problem size, with the m factors
+ *     passed as first argument
+ *
+ * The workspace of the previous call is reused if it is large enough, and the
+ * m factors are only converted if they changed. If no cross-call context is
+ * available (e.g., if the function is called from another C++ AL function),
+ * a new workspace is allocated on every call.
+ */
+ViterbiWorkspace*
+ViterbiWorkspace::get(AnyType &args, Index inNumLabels, Index inTopK,
+    Index inMaxLength) {
+
+    AnyType mArg = args[0];
+    const void* raw = mArg.getRawValue();
+    size_t rawSize = mArg.getRawValueSize();
+
+    ViterbiWorkspace* workspace
+        = static_cast<ViterbiWorkspace*>(args.getUserFunctionContext());
+    bool sameShape = workspace && workspace->numLabels == inNumLabels
+        && workspace->topK == inTopK;
+    Index maxLength = sameShape
+        ? std::max(inMaxLength, workspace->maxLength) : inMaxLength;
+    size_t size = offsetOf(kRaw, inNumLabels, inTopK, maxLength) + rawSize;
+
+    if (!workspace || workspace->capacity < size) {
+        // Grow geometrically, so that documents of increasing length do not
+        // cause a reallocation each (the old context is only freed at the
+        // end of the query)
+        if (sameShape) {
+            maxLength = std::max(inMaxLength, 2 * workspace->maxLength);
+            size = offsetOf(kRaw, inNumLabels, inTopK, maxLength) + rawSize;
+        }
+        void* memory = args.allocateUserFunctionContext(size);
+        if (!memory)
+            memory = defaultAllocator().allocate<dbal::FunctionContext,
+                dbal::DoZero, dbal::ThrowBadAlloc>(size);
+        workspace = static_cast<ViterbiWorkspace*>(memory);
+        workspace->capacity = size;
+    }
+
+    if (workspace->numLabels != inNumLabels || workspace->topK != inTopK
+        || workspace->maxLength != maxLength) {
+        // The layout changes, so the converted m factors are lost
+        workspace->numLabels = inNumLabels;
+        workspace->topK = inTopK;
+        workspace->maxLength = maxLength;
+        workspace->rawSize = 0;
+    }
+
+    char* cachedRaw = workspace->buffer<char>(kRaw);
+    if (workspace->rawSize != rawSize
+        || std::memcmp(cachedRaw, raw, rawSize) != 0) {
+
+        // Invalidate the cache while it is being overwritten
+        workspace->rawSize = 0;
+        workspace->setModel(mArg.getAs<ArrayHandle<int32_t> >());
+        std::memcpy(cachedRaw, raw, rawSize);
+        workspace->rawSize = rawSize;
+    }
+    return workspace;
+}
+
+/**
+ * @brief Convert the m factors
+ */
+void
+ViterbiWorkspace::setModel(const ArrayHandle<int32_t>& inM) {
+    if (inM.size() != static_cast<size_t>(numLabels * (numLabels + 2)))
+        throw std::runtime_error("Invalid parameter: mArray must have "
+            "(nlabel + 2) * nlabel elements");
+
+    MappedScoreMatrix<double>::type wideTransitions = transitions<double>();
+    MutableMappedMatrix expTransitions(TransparentHandle<double, dbal::Mutable>(
+        buffer<double>(kExpTransitions)), numLabels, numLabels);
+
+    wideTransitions = MappedIntMatrix(inM.ptr(), numLabels, numLabels + 2)
+        .cast<double>();
+    transitions<float>() = wideTransitions.cast<float>();
+    maxTransition = wideTransitions.cwiseAbs().maxCoeff();
+    expTransitions = (wideTransitions.middleCols(1, numLabels) / kScoreScale)
+        .array().exp().matrix();
+}
+
+/**
+ * @brief Upper bound on the magnitude of the (partial) path scores of a
+ *     document
+ *
+ * A path score is the sum of \c inLength r factors and
+ * <tt>inLength + 1</tt> m factors.
+ */
+double
+ViterbiWorkspace::maxPathScore(const int32_t* inR, Index inLength) const {
+    double maxState = MappedIntMatrix(inR, numLabels, inLength).cast<double>()
+        .cwiseAbs().maxCoeff();
+    return static_cast<double>(inLength) * maxState
+        + static_cast<double>(inLength + 1) * maxTransition;
+}
+
+/**
+ * @brief Decode the k best label sequences of a document
+ *
+ * @param inR The r factors of the document
+ * @param inLength The number of tokens of the document
+ * @param outResult \c topK times <tt>inLength + 1</tt> integers. For each
+ *     label sequence, the labels are followed by the conditional probability
+ *     of the sequence, multiplied by \f$ 10^6 \f$ and truncated. If there are
+ *     less than \c topK label sequences, the remaining ones are filled with
+ *     label -1 and probability 0.
+ */
+void
+ViterbiWorkspace::decode(const int32_t* inR, Index inLength,
+    int32_t* outResult) {
+
+    double logZ = logPartition(inR, inLength);
+    bool isExactInFloat = maxPathScore(inR, inLength) <= kMaxExactFloat;
+
+    if (topK > 1) {
+        if (isExactInFloat)
+            decodeTopK<float>(inR, inLength, outResult, logZ);
+        else
+            decodeTopK<double>(inR, inLength, outResult, logZ);
+        return;
+    }
+
+    double score = isExactInFloat
+        ? decodeTop1<float>(inR, inLength, outResult)
+        : decodeTop1<double>(inR, inLength, outResult);
+    outResult[inLength] = static_cast<int32_t>(1000000.
+        * std::min(std::exp(score / kScoreScale - logZ), 1.));
+}
+
+/**
+ * @brief Logarithm of the partition function (forward algorithm)
+ *
+ * The forward vector is rescaled at each position, and the state scores are
+ * shifted by their maximum before exponentiating, so that long documents do
+ * not underflow.
+ */
+double
+ViterbiWorkspace::logPartition(const int32_t* inR, Index inLength) {
+    MappedScoreMatrix<double>::type transitions
+        = this->transitions<double>();
+    MutableMappedMatrix expTransitions(TransparentHandle<double, dbal::Mutable>(
+        buffer<double>(kExpTransitions)), numLabels, numLabels);
+    MutableMappedMatrix forward(TransparentHandle<double, dbal::Mutable>(
+        buffer<double>(kForward)), numLabels, 3);
+    MappedIntMatrix r(inR, numLabels, inLength);
+
+    double logZ = 0;
+    for (Index t = 0; t < inLength; ++t) {
+        // Column 0: state scores, column 1: forward vector, column 2: forward
+        // vector before the state scores
+        forward.col(0) = r.col(t).cast<double>();
+        if (t == 0)
+            forward.col(0) += transitions.col(0);
+        if (t == inLength - 1)
+            forward.col(0) += transitions.col(numLabels + 1);
+        forward.col(0) /= kScoreScale;
+        double shift = forward.col(0).maxCoeff();
+        forward.col(0) = (forward.col(0).array() - shift).exp().matrix();
+
+        if (t == 0) {
+            forward.col(1) = forward.col(0);
+        } else {
+            forward.col(2).noalias() = expTransitions * forward.col(1);
+            forward.col(1) = forward.col(2).cwiseProduct(forward.col(0));
+        }
+        double scale = forward.col(1).sum();
+        forward.col(1) /= scale;
+        logZ += shift + std::log(scale);
+    }
+    return logZ;
+}
+
+/**
+ * @brief Decode the best label sequence of a document
+ *
+ * For each position and label, we only keep the best score, and take the
+ * maximum over the previous labels one column (i.e., all current labels) at a
+ * time, which Eigen vectorizes. The argmax is not stored but recomputed while
+ * tracing back: It uses the same floating-point operations, so it reproduces
+ * the maximum exactly, and it only costs \f$ O(\text{nlabel}) \f$ per token.
+ *
+ * @returns The score of the best label sequence
+ */
+template <class Scalar>
+double
+ViterbiWorkspace::decodeTop1(const int32_t* inR, Index inLength,
+    int32_t* outLabels) {
+
+    typename MappedScoreMatrix<Scalar>::type transitions
+        = this->transitions<Scalar>();
+    typename MappedScoreMatrix<Scalar>::type scores(buffer<Scalar>(kScores),
+        numLabels, inLength);
+    MappedIntMatrix r(inR, numLabels, inLength);
+
+    scores.col(0) = transitions.col(0) + r.col(0).cast<Scalar>();
+    for (Index t = 1; t < inLength; ++t) {
+        scores.col(t).array() = transitions.col(1).array() + scores(0, t - 1);
+        for (Index p = 1; p < numLabels; ++p)
+            scores.col(t).array() = scores.col(t).array().max(
+                transitions.col(p + 1).array() + scores(p, t - 1));
+        scores.col(t) += r.col(t).cast<Scalar>();
+    }
+    scores.col(inLength - 1) += transitions.col(numLabels + 1);
+
+    Index label;
+    Scalar score = scores.col(inLength - 1).maxCoeff(&label);
+    for (Index t = inLength - 1; t > 0; --t) {
+        outLabels[t] = static_cast<int32_t>(label);
+        (scores.col(t - 1)
+            + transitions.row(label).segment(1, numLabels).transpose())
+            .maxCoeff(&label);
+    }
+    outLabels[0] = static_cast<int32_t>(label);
+    return static_cast<double>(score);
+}
+
+/**
+ * @brief Decode the k best label sequences of a document
+ *
+ * For each position and label, we keep the k best partial label sequences
+ * ending there, sorted by score, together with the sequence each of them
+ * extends. A new position selects the k best out of the nlabel * k
+ * extensions with a partial sort.
+ */
+template <class Scalar>
+void
+ViterbiWorkspace::decodeTopK(const int32_t* inR, Index inLength,
+    int32_t* outResult, double inLogPartition) {
+
+    const Scalar kNoSequence = -std::numeric_limits<Scalar>::infinity();
+    Index numStates = numLabels * topK;
+
+    typename MappedScoreMatrix<Scalar>::type transitions
+        = this->transitions<Scalar>();
+    MappedIntMatrix r(inR, numLabels, inLength);
+    Scalar* previous = buffer<Scalar>(kScores);
+    Scalar* current = previous + numStates;
+    int32_t* backpointers = buffer<int32_t>(kBackpointers);
+    Candidate<Scalar>* candidates = buffer<Candidate<Scalar> >(kCandidates);
+
+    for (Index c = 0; c < numLabels; ++c) {
+        previous[c * topK] = transitions(c, 0) + static_cast<Scalar>(r(c, 0));
+        std::fill(previous + c * topK + 1, previous + (c + 1) * topK,
+            kNoSequence);
+    }
+
+    for (Index t = 1; t < inLength; ++t) {
+        int32_t* back = backpointers + t * numStates;
+        for (Index c = 0; c < numLabels; ++c) {
+            for (Index state = 0; state < numStates; ++state) {
+                candidates[state].score = previous[state]
+                    + transitions(c, state / topK + 1);
+                candidates[state].state = static_cast<int32_t>(state);
+            }
+            std::partial_sort(candidates, candidates + topK,
+                candidates + numStates);
+
+            Scalar stateScore = static_cast<Scalar>(r(c, t));
+            for (Index k = 0; k < topK; ++k) {
+                current[c * topK + k] = candidates[k].score + stateScore;
+                back[c * topK + k] = candidates[k].state;
+            }
+        }
+        std::swap(previous, current);
+    }
+
+    for (Index state = 0; state < numStates; ++state) {
+        candidates[state].score = previous[state]
+            + transitions(state / topK, numLabels + 1);
+        candidates[state].state = static_cast<int32_t>(state);
+    }
+    std::partial_sort(candidates, candidates + topK, candidates + numStates);
+
+    for (Index k = 0; k < topK; ++k) {
+        int32_t* labels = outResult + k * (inLength + 1);
+        if (candidates[k].score == kNoSequence) {
+            std::fill(labels, labels + inLength, -1);
+            labels[inLength] = 0;
+            continue;
+        }
+
+        Index state = candidates[k].state;
+        for (Index t = inLength - 1; t >= 0; --t) {
+            labels[t] = static_cast<int32_t>(state / topK);
+            if (t > 0)
+                state = backpointers[t * numStates + state];
+        }
+        labels[inLength] = static_cast<int32_t>(1000000. * std::min(
+            std::exp(candidates[k].score / kScoreScale - inLogPartition), 1.));
+    }
+}
+
+/**
+ * @brief Return the number of labels, as passed to the functions
+ */
+Index
+numLabelsArgument(const AnyType &inArg) {
+    int32_t numLabels = inArg.getAs<int32_t>();
+    if (numLabels <= 0)
+        throw std::runtime_error("Invalid parameter: nlabel <= 0");
+    return numLabels;
+}
+
+} // namespace
+
+/**
+ * @brief Return the most probable label sequence of a document
+ *
+ * Arguments:
+ * - 0: mArray (m factors)
+ * - 1: rArray (r factors of the document)
+ * - 2: nlabel (number of labels)
+ *
+ * The result contains the label of each token, followed by the conditional
+ * probability of the label sequence, multiplied by \f$ 10^6 \f$ and
+ * truncated.
+ */
+AnyType
+vcrf_top1_label::run(AnyType &args) {
+    Index numLabels = numLabelsArgument(args[2]);
+    ArrayHandle<int32_t> rFactors = args[1].getAs<ArrayHandle<int32_t> >();
+
+    if (rFactors.size() == 0
+        || rFactors.size() % static_cast<size_t>(numLabels) != 0)
+        throw std::runtime_error("Invalid parameter: The number of elements "
+            "of rArray must be a positive multiple of nlabel");
+    Index length = static_cast<Index>(rFactors.size()) / numLabels;
+
+    ViterbiWorkspace* workspace = ViterbiWorkspace::get(args, numLabels, 1,
+        length);
+    MutableArrayHandle<int32_t> result = allocateArray<int32_t,
+        dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(
+            static_cast<size_t>(length + 1));
+    workspace->decode(rFactors.ptr(), length, result.ptr());
+    return result;
+}
+
+/**
+ * @brief Return the k most probable label sequences of each document in a
+ *     batch
+ *
+ * Arguments:
+ * - 0: mArray (m factors)
+ * - 1: rArray (r factors of all documents, concatenated)
+ * - 2: doc_len (number of tokens of each document)
+ * - 3: nlabel (number of labels)
+ * - 4: k (number of label sequences per document)
+ *
+ * For each document, the result contains k label sequences in order of
+ * decreasing probability, each encoded as in vcrf_top1_label(). If a
+ * document has less than k label sequences, the remaining ones consist of
+ * labels -1 and probability 0.
+ */
+AnyType
+vcrf_topk_label_batch::run(AnyType &args) {
+    ArrayHandle<int32_t> rFactors = args[1].getAs<ArrayHandle<int32_t> >();
+    ArrayHandle<int32_t> lengths = args[2].getAs<ArrayHandle<int32_t> >();
+    Index numLabels = numLabelsArgument(args[3]);
+    int32_t topK = args[4].getAs<int32_t>();
+    if (topK <= 0)
+        throw std::runtime_error("Invalid parameter: k <= 0");
+    if (static_cast<int64_t>(numLabels) * topK
+        > std::numeric_limits<int32_t>::max())
+        throw std::runtime_error("Invalid parameter: nlabel * k is too "
+            "large");
+
+    Index numTokens = 0;
+    Index maxLength = 0;
+    for (size_t i = 0; i < lengths.size(); ++i) {
+        if (lengths[i] <= 0)
+            throw std::runtime_error("Invalid parameter: doc_len must only "
+                "contain positive numbers");
+        numTokens += lengths[i];
+        maxLength = std::max(maxLength, static_cast<Index>(lengths[i]));
+    }
+    if (static_cast<size_t>(numTokens * numLabels) != rFactors.size())
+        throw std::runtime_error("Invalid parameter: The number of elements "
+            "of rArray must be nlabel times the sum of doc_len");
+    if (lengths.size() == 0)
+        return Null();
+
+    ViterbiWorkspace* workspace = ViterbiWorkspace::get(args, numLabels, topK,
+        maxLength);
+    MutableArrayHandle<int32_t> result = allocateArray<int32_t,
+        dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(
+            static_cast<size_t>(topK
+                * (numTokens + static_cast<Index>(lengths.size()))));
+
+    const int32_t* r = rFactors.ptr();
+    int32_t* output = result.ptr();
+    for (size_t i = 0; i < lengths.size(); ++i) {
+        workspace->decode(r, lengths[i], output);
+        r += lengths[i] * numLabels;
+        output += topK * (lengths[i] + 1);
+    }
+    return result;
+}
+
+} // namespace crf
+
+} // namespace modules
+
+} // namespace madlib
@@ -0,0 +1,16 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file viterbi.hpp
+ *
+ *//* ----------------------------------------------------------------------- */
+
+/**
+ * @brief Linear-chain CRF: Most probable label sequence of a document
+ */
+DECLARE_UDF(crf, vcrf_top1_label)
+
+/**
+ * @brief Linear-chain CRF: k most probable label sequences of each document
+ *     in a batch
+ */
+DECLARE_UDF(crf, vcrf_topk_label_batch)
@@ -12,5 +12,7 @@
 #include "sample/sample.hpp"
 #include "stats/stats.hpp"
 #include "convex/convex.hpp"
+#include "crf/feature_gen.hpp"
 #include "crf/linear_crf.hpp"
+#include "crf/viterbi.hpp"
 #include "assoc_rules/assoc_rules.hpp"
@@ -8,6 +8,8 @@
 
 #include <dbconnector/dbconnector.hpp>
 
+#include <cstring>
+
 #include "metric.hpp"
 
 namespace madlib {
@@ -18,21 +20,86 @@ namespace linalg {
 
 namespace {
 
-template <class TupleType>
-struct ReverseLexicographicComparator {
-    /**
-     * @brief Return true if the first argument is less than the second
-     */
-    bool operator()(const TupleType& inTuple1, const TupleType& inTuple2) {
-        // This could be a real reverse lexicographic comparator in C++11, but
-        // lacking variadic template arguments, we simply pretend here that
-        // all tuples contain only 2 elements.
-        return std::get<1>(inTuple1) < std::get<1>(inTuple2) ||
-            (std::get<1>(inTuple1) == std::get<1>(inTuple2) &&
-                std::get<0>(inTuple1) < std::get<0>(inTuple2));
+/**
+ * @brief Order column indices by distance, and ties by index
+ */
+class DistanceComparator {
+public:
+    DistanceComparator(const double* inDistances)
+      : mDistances(inDistances) { }
+
+    bool operator()(Index inColumn1, Index inColumn2) const {
+        return mDistances[inColumn1] < mDistances[inColumn2] ||
+            (mDistances[inColumn1] == mDistances[inColumn2] &&
+                inColumn1 < inColumn2);
     }
+
+private:
+    const double* mDistances;
 };
 
+/**
+ * @brief Order (index, distance) pairs by distance, and ties by index
+ */
+template <class TupleType>
+bool
+closerThan(const TupleType& inTuple1, const TupleType& inTuple2) {
+    return std::get<1>(inTuple1) < std::get<1>(inTuple2) ||
+        (std::get<1>(inTuple1) == std::get<1>(inTuple2) &&
+            std::get<0>(inTuple1) < std::get<0>(inTuple2));
+}
+
+/**
+ * @brief Select the columns with the smallest distances
+ *
+ * Columns with infinite or NaN distance are never selected. If there are
+ * fewer columns than requested, the remaining elements are
+ * \f$ (0, \infty) \f$.
+ *
+ * @param inDistances The distance of each column
+ * @param ioCandidates Scratch space, to avoid allocations across calls
+ * @param[out] ioFirst, ioLast The selected (index, distance) pairs, sorted in
+ *     ascending order of distance
+ */
+template <class RandomAccessIterator>
+void
+selectClosestColumns(
+    const ColumnVector& inDistances,
+    std::vector<Index>& ioCandidates,
+    RandomAccessIterator ioFirst,
+    RandomAccessIterator ioLast) {
+
+    // The closest column alone only needs one pass
+    if (ioLast - ioFirst == 1) {
+        Index closest = 0;
+        double minDistance = std::numeric_limits<double>::infinity();
+        for (Index i = 0; i < inDistances.size(); ++i)
+            if (inDistances(i) < minDistance) {
+                closest = i;
+                minDistance = inDistances(i);
+            }
+        *ioFirst = std::make_tuple(closest, minDistance);
+        return;
+    }
+
+    ioCandidates.clear();
+    for (Index i = 0; i < inDistances.size(); ++i)
+        if (inDistances(i) < std::numeric_limits<double>::infinity())
+            ioCandidates.push_back(i);
+
+    size_t numSelected = std::min(ioCandidates.size(),
+        static_cast<size_t>(ioLast - ioFirst));
+    std::partial_sort(ioCandidates.begin(),
+        ioCandidates.begin() + numSelected, ioCandidates.end(),
+        DistanceComparator(inDistances.data()));
+
+    for (size_t i = 0; i < numSelected; ++i, ++ioFirst)
+        *ioFirst = std::make_tuple(ioCandidates[i],
+            inDistances(ioCandidates[i]));
+    std::fill(ioFirst, ioLast,
+        std::make_tuple(0, std::numeric_limits<double>::infinity()));
+}
+
 } // anonymous namespace
 
 /**
@@ -46,6 +113,8 @@ struct ReverseLexicographicComparator {
  *
  * @param inMatrix Matrix \f$ M \f$
  * @param inVector Vector \f$ \vec x \f$
+ * @param ioDistances, ioCandidates Scratch space, to avoid allocations across
+ *     calls (unused if only the closest column is requested)
  * @param[out] outClosestColumns A list of \c NumClosestColumns pairs
  *     \f$ (i, d) \f$ sorted in ascending order of \f$ d \f$, where $i$ is a
  *     0-based column index in \f$ M \f$ and
@@ -58,31 +127,36 @@ closestColumnsAndDistances(
     const MappedMatrix& inMatrix,
     const MappedColumnVector& inVector,
     DistanceFunction& inMetric,
+    ColumnVector& ioDistances,
+    std::vector<Index>& ioCandidates,
     RandomAccessIterator ioFirst,
     RandomAccessIterator ioLast) {
 
-    ReverseLexicographicComparator<
-        typename std::iterator_traits<RandomAccessIterator>::value_type>
-            comparator;
-
-    std::fill(ioFirst, ioLast,
-        std::make_tuple(0, std::numeric_limits<double>::infinity()));
-    for (Index i = 0; i < inMatrix.cols(); ++i) {
-        double currentDist
-            = AnyType_cast<double>(
+    // The closest column alone is found in one pass, without storing all
+    // distances. Ties and non-finite distances are treated as in
+    // selectClosestColumns().
+    if (ioLast - ioFirst == 1) {
+        Index closest = 0;
+        double minDistance = std::numeric_limits<double>::infinity();
+        for (Index i = 0; i < inMatrix.cols(); ++i) {
+            double distance = AnyType_cast<double>(
                 inMetric(MappedColumnVector(inMatrix.col(i)), inVector)
             );
-
-        // outIndicesAndDistances is a heap, so the first element is maximal
-        if (currentDist < std::get<1>(*ioFirst)) {
-            // Unfortunately, the STL does not have a decrease-key function,
-            // so we are wasting a bit of performance here
-            std::pop_heap(ioFirst, ioLast, comparator);
-            *(ioLast - 1) = std::make_tuple(i, currentDist);
-            std::push_heap(ioFirst, ioLast, comparator);
+            if (distance < minDistance) {
+                closest = i;
+                minDistance = distance;
+            }
         }
+        *ioFirst = std::make_tuple(closest, minDistance);
+        return;
     }
-    std::sort_heap(ioFirst, ioLast, comparator);
+
+    ioDistances.resize(inMatrix.cols());
+    for (Index i = 0; i < inMatrix.cols(); ++i)
+        ioDistances(i) = AnyType_cast<double>(
+            inMetric(MappedColumnVector(inMatrix.col(i)), inVector)
+        );
+    selectClosestColumns(ioDistances, ioCandidates, ioFirst, ioLast);
 }
 
 double
@@ -148,28 +222,207 @@ closestColumnsAndDistancesShortcut(
     const MappedMatrix& inMatrix,
     const MappedColumnVector& inVector,
     FunctionHandle &inDist,
+    ColumnVector& ioDistances,
+    std::vector<Index>& ioCandidates,
     RandomAccessIterator ioFirst,
     RandomAccessIterator ioLast) {
 
     // Sorted in the order of expected use
     if (inDist.funcPtr() == funcPtr<squared_dist_norm2>())
         closestColumnsAndDistances(inMatrix, inVector, squaredDistNorm2,
-            ioFirst, ioLast);
+            ioDistances, ioCandidates, ioFirst, ioLast);
     else if (inDist.funcPtr() == funcPtr<dist_norm2>())
         closestColumnsAndDistances(inMatrix, inVector, distNorm2,
-            ioFirst, ioLast);
+            ioDistances, ioCandidates, ioFirst, ioLast);
     else if (inDist.funcPtr() == funcPtr<dist_norm1>())
         closestColumnsAndDistances(inMatrix, inVector, distNorm1,
-            ioFirst, ioLast);
+            ioDistances, ioCandidates, ioFirst, ioLast);
     else if (inDist.funcPtr() == funcPtr<dist_angle>())
         closestColumnsAndDistances(inMatrix, inVector, distAngle,
-            ioFirst, ioLast);
+            ioDistances, ioCandidates, ioFirst, ioLast);
     else if (inDist.funcPtr() == funcPtr<dist_tanimoto>())
         closestColumnsAndDistances(inMatrix, inVector, distTanimoto,
-            ioFirst, ioLast);
+            ioDistances, ioCandidates, ioFirst, ioLast);
     else
         closestColumnsAndDistances(inMatrix, inVector, inDist,
-            ioFirst, ioLast);
+            ioDistances, ioCandidates, ioFirst, ioLast);
+}
+
+/**
+ * @brief Distance functions that can be computed from dot products and norms
+ */
+enum DotProductMetric {
+    kSquaredDistNorm2,
+    kDistNorm2,
+    kDistAngle,
+    kDistTanimoto,
+    kOtherMetric
+};
+
+inline
+DotProductMetric
+dotProductMetric(FunctionHandle &inDist) {
+    if (inDist.funcPtr() == funcPtr<squared_dist_norm2>())
+        return kSquaredDistNorm2;
+    else if (inDist.funcPtr() == funcPtr<dist_norm2>())
+        return kDistNorm2;
+    else if (inDist.funcPtr() == funcPtr<dist_angle>())
+        return kDistAngle;
+    else if (inDist.funcPtr() == funcPtr<dist_tanimoto>())
+        return kDistTanimoto;
+    return kOtherMetric;
+}
+
+/**
+ * @brief Compute the distance between two vectors from their dot product and
+ *     squared norms
+ *
+ * The angle and the Tanimoto distance use the same formulas as distAngle() and
+ * distTanimoto(). The (squared) Euclidean distance uses the expansion
+ * \f$ \| x - y \|^2 = \| x \|^2 + \| y \|^2 - 2 x^T y \f$, where rounding may
+ * cause small negative values. These are clamped to 0.
+ */
+inline
+double
+distFromDotProduct(DotProductMetric inMetric, double inDotProduct,
+    double inSquaredNormX, double inSquaredNormY) {
+
+    switch (inMetric) {
+        case kSquaredDistNorm2:
+            return std::max(
+                inSquaredNormX + inSquaredNormY - 2 * inDotProduct, 0.);
+        case kDistNorm2:
+            return std::sqrt(std::max(
+                inSquaredNormX + inSquaredNormY - 2 * inDotProduct, 0.));
+        case kDistAngle: {
+            double cosine = inDotProduct
+                / (std::sqrt(inSquaredNormX) * std::sqrt(inSquaredNormY));
+            if (cosine > 1)
+                cosine = 1;
+            else if (cosine < -1)
+                cosine = -1;
+            return std::acos(cosine);
+        }
+        case kDistTanimoto: {
+            double tanimoto = inSquaredNormX + inSquaredNormY;
+            return (tanimoto - 2 * inDotProduct) / (tanimoto - inDotProduct);
+        }
+        default:
+            throw std::logic_error("Distance function cannot be computed "
+                "from dot products.");
+    }
+}
+
+/**
+ * @brief Squared 2-norms of the columns of a matrix, together with the raw
+ *     matrix argument they were computed from
+ */
+struct ColumnNormCache {
+    size_t capacity;
+    size_t rawSize;
+    size_t numColumns;
+
+    double* squaredNorms() {
+        return reinterpret_cast<double*>(this + 1);
+    }
+
+    char* raw() {
+        return reinterpret_cast<char*>(squaredNorms() + numColumns);
+    }
+};
+
+/**
+ * @brief Return the squared 2-norms of the columns of the matrix passed as
+ *     first argument, using the cached values if the argument did not change
+ *     since the last call
+ *
+ * If no cross-call context is available (e.g., if the function is called from
+ * another C++ AL function), the norms are recomputed on every call.
+ */
+MappedColumnVector
+cachedSquaredColumnNorms(AnyType &args, const MappedMatrix& inMatrix) {
+    AnyType matrixArg = args[0];
+    const void* raw = matrixArg.getRawValue();
+    size_t rawSize = matrixArg.getRawValueSize();
+    size_t numColumns = static_cast<size_t>(inMatrix.cols());
+
+    ColumnNormCache* cache
+        = static_cast<ColumnNormCache*>(args.getUserFunctionContext());
+    if (cache && cache->rawSize == rawSize
+        && std::memcmp(cache->raw(), raw, rawSize) == 0)
+        return MappedColumnVector(
+            TransparentHandle<double>(cache->squaredNorms()), inMatrix.cols());
+
+    size_t size = sizeof(ColumnNormCache) + sizeof(double) * numColumns
+        + rawSize;
+    if (!cache || cache->capacity < size) {
+        cache = static_cast<ColumnNormCache*>(
+            args.allocateUserFunctionContext(size));
+        if (!cache)
+            cache = static_cast<ColumnNormCache*>(
+                defaultAllocator().allocate<dbal::FunctionContext,
+                    dbal::DoZero, dbal::ThrowBadAlloc>(size));
+        cache->capacity = size;
+    }
+
+    // Invalidate the cache while it is being overwritten
+    cache->rawSize = 0;
+    cache->numColumns = numColumns;
+    for (Index i = 0; i < inMatrix.cols(); ++i)
+        cache->squaredNorms()[i] = inMatrix.col(i).squaredNorm();
+    std::memcpy(cache->raw(), raw, rawSize);
+    cache->rawSize = rawSize;
+    return MappedColumnVector(
+        TransparentHandle<double>(cache->squaredNorms()), inMatrix.cols());
+}
+
+/**
+ * @brief Compute the k columns of a matrix that are closest to a vector, given
+ *     the dot products with all columns
+ *
+ * Column \c inDotProductsColumn of \c inDotProducts contains the dot products
+ * of the vector with all columns of the matrix.
+ *
+ * The selection uses distFromDotProduct(). For the (squared) Euclidean
+ * distance, the distances of the selected columns are then recomputed
+ * directly, so that the returned values do not suffer from cancellation.
+ */
+template <class RandomAccessIterator>
+void
+closestColumnsAndDistancesFromDotProducts(
+    const MappedMatrix& inMatrix,
+    const MappedColumnVector& inVector,
+    DotProductMetric inMetric,
+    const Matrix& inDotProducts,
+    Index inDotProductsColumn,
+    const MappedColumnVector& inSquaredColumnNorms,
+    ColumnVector& ioDistances,
+    std::vector<Index>& ioCandidates,
+    RandomAccessIterator ioFirst,
+    RandomAccessIterator ioLast) {
+
+    double squaredNorm = inVector.squaredNorm();
+    for (Index i = 0; i < inMatrix.cols(); ++i)
+        ioDistances(i) = distFromDotProduct(inMetric,
+            inDotProducts(i, inDotProductsColumn),
+            squaredNorm, inSquaredColumnNorms(i));
+    selectClosestColumns(ioDistances, ioCandidates, ioFirst, ioLast);
+
+    if (inMetric != kSquaredDistNorm2 && inMetric != kDistNorm2)
+        return;
+
+    RandomAccessIterator it = ioFirst;
+    for (; it != ioLast
+        && std::get<1>(*it) < std::numeric_limits<double>::infinity(); ++it) {
+
+        double distance = squaredDistNorm2(
+            MappedColumnVector(inMatrix.col(std::get<0>(*it))), inVector);
+        std::get<1>(*it) = inMetric == kDistNorm2
+            ? std::sqrt(distance) : distance;
+    }
+    std::sort(ioFirst, it,
+        closerThan<typename std::iterator_traits<RandomAccessIterator>
+            ::value_type>);
 }
 
 /**
@@ -187,8 +440,12 @@ closest_column::run(AnyType& args) {
     FunctionHandle dist = args[2].getAs<FunctionHandle>()
         .unsetFunctionCallOptions(FunctionHandle::GarbageCollectionAfterCall);
 
+    // Not used for a single column
+    ColumnVector distances;
+    std::vector<Index> candidates;
     std::tuple<Index, double> result;
-    closestColumnsAndDistancesShortcut(M, x, dist, &result, &result + 1);
+    closestColumnsAndDistancesShortcut(M, x, dist, distances, candidates,
+        &result, &result + 1);
 
     AnyType tuple;
     return tuple
@@ -212,9 +469,11 @@ closest_columns::run(AnyType& args) {
     FunctionHandle dist = args[3].getAs<FunctionHandle>()
         .unsetFunctionCallOptions(FunctionHandle::GarbageCollectionAfterCall);
 
+    ColumnVector columnDistances;
+    std::vector<Index> candidates;
     std::vector<std::tuple<Index, double> > result(num);
-    closestColumnsAndDistancesShortcut(M, x, dist, result.begin(),
-        result.end());
+    closestColumnsAndDistancesShortcut(M, x, dist, columnDistances,
+        candidates, result.begin(), result.end());
 
     MutableArrayHandle<int32_t> indices = allocateArray<int32_t,
         dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(num);
@@ -227,6 +486,89 @@ closest_columns::run(AnyType& args) {
     return tuple << indices << distances;
 }
 
+/**
+ * @brief Compute the columns of a matrix that are closest to each point of a
+ *     block of points
+ *
+ * Arguments:
+ * - 0: M (matrix whose columns are searched)
+ * - 1: X (two-dimensional array, each row contains one point)
+ * - 2: num (number of closest columns per point)
+ * - 3: dist (distance function)
+ *
+ * For the built-in Euclidean, squared Euclidean, angle, and Tanimoto
+ * distances, all dot products between a block of points and the columns of M
+ * are computed with a single matrix product, and the distances are derived
+ * from the dot products and the squared norms. The squared norms of the
+ * columns of M are cached across calls. Other distance functions are evaluated
+ * one column at a time, as in closest_columns().
+ *
+ * The result contains two-dimensional arrays with one row per point.
+ */
+AnyType
+closest_columns_batch::run(AnyType& args) {
+    MappedMatrix M = args[0].getAs<MappedMatrix>();
+    // Each row of the two-dimensional array is a column of X
+    MappedMatrix X = args[1].getAs<MappedMatrix>();
+    uint16_t num = args[2].getAs<uint16_t>();
+    FunctionHandle dist = args[3].getAs<FunctionHandle>()
+        .unsetFunctionCallOptions(FunctionHandle::GarbageCollectionAfterCall);
+
+    if (X.rows() != M.rows())
+        throw std::runtime_error("Inconsistent dimensions of points and "
+            "matrix columns.");
+
+    MutableArrayHandle<int32_t> indices = allocateArray<int32_t,
+        dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(
+            X.cols(), num);
+    MutableArrayHandle<double> distances = allocateArray<double,
+        dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(
+            X.cols(), num);
+
+    // Number of points whose dot products are computed with one matrix
+    // product. This bounds the memory needed for the dot products.
+    const Index kBlockSize = 256;
+
+    DotProductMetric metric = dotProductMetric(dist);
+    std::vector<std::tuple<Index, double> > result(num);
+    ColumnVector columnDistances(M.cols());
+    std::vector<Index> candidates;
+    candidates.reserve(static_cast<size_t>(M.cols()));
+    Matrix dotProducts;
+    MappedColumnVector squaredColumnNorms;
+    if (metric != kOtherMetric) {
+        MappedColumnVector norms = cachedSquaredColumnNorms(args, M);
+        squaredColumnNorms.rebind(norms.memoryHandle(), norms.size());
+    }
+
+    for (Index start = 0; start < X.cols(); start += kBlockSize) {
+        Index blockSize = std::min(kBlockSize, X.cols() - start);
+        if (metric != kOtherMetric) {
+            dotProducts.resize(M.cols(), blockSize);
+            dotProducts.noalias() = trans(M) * X.middleCols(start, blockSize);
+        }
+
+        for (Index j = 0; j < blockSize; ++j) {
+            MappedColumnVector x(X.col(start + j));
+            if (metric == kOtherMetric)
+                closestColumnsAndDistancesShortcut(M, x, dist,
+                    columnDistances, candidates, result.begin(), result.end());
+            else
+                closestColumnsAndDistancesFromDotProducts(M, x, metric,
+                    dotProducts, j, squaredColumnNorms, columnDistances,
+                    candidates, result.begin(), result.end());
+
+            size_t offset = static_cast<size_t>(start + j) * num;
+            for (size_t i = 0; i < num; ++i)
+                std::tie(indices[offset + i], distances[offset + i])
+                    = result[i];
+        }
+    }
+
+    AnyType tuple;
+    return tuple << indices << distances;
+}
+
 
 AnyType
 norm1::run(AnyType& args) {
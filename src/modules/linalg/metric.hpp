@@ -14,6 +14,12 @@ DECLARE_UDF(linalg, closest_column)
  */
 DECLARE_UDF(linalg, closest_columns)
 
+/**
+ * @brief Find the columns in a matrix that are closest to each of a block of
+ *     vectors
+ */
+DECLARE_UDF(linalg, closest_columns_batch)
+
 
 /**
  * @brief Compute the 1-norm
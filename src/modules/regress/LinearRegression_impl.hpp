@@ -41,13 +41,18 @@ inline
 void
 LinearRegressionAccumulator<Container>::bind(ByteStream_type& inStream) {
     inStream
-        >> numRows >> widthOfX >> y_sum >> y_square_sum;
+        >> numRows >> widthOfX >> blockSize >> numBufferedRows
+        >> y_sum >> y_square_sum;
     uint16_t actualWidthOfX = widthOfX.isNull()
         ? static_cast<uint16_t>(0)
         : static_cast<uint16_t>(widthOfX);
+    uint16_t actualBlockSize = blockSize.isNull()
+        ? static_cast<uint16_t>(0)
+        : static_cast<uint16_t>(blockSize);
     inStream
         >> X_transp_Y.rebind(actualWidthOfX)
-        >> X_transp_X.rebind(actualWidthOfX, actualWidthOfX);
+        >> X_transp_X.rebind(actualWidthOfX, actualWidthOfX)
+        >> rowBuffer.rebind(actualWidthOfX, actualBlockSize);
 }
 
 /**
@@ -56,6 +61,10 @@ LinearRegressionAccumulator<Container>::bind(ByteStream_type& inStream) {
  * We update the number of rows \f$ n \f$, the partial
  * sums \f$ \sum_{i=1}^n y_i \f$ and \f$ \sum_{i=1}^n y_i^2 \f$, the matrix
  * \f$ X^T X \f$, and the vector \f$ X^T \boldsymbol y \f$.
+ *
+ * If \c blockSize is positive, \f$ \boldsymbol x \f$ is only copied into
+ * \c rowBuffer, and \f$ X^T X \f$ is updated with one symmetric rank-k
+ * update once \c blockSize rows have been collected. See flush().
  */
 template <class Container>
 inline
@@ -90,10 +99,38 @@ LinearRegressionAccumulator<Container>::operator<<(const tuple_type& inTuple) {
 
     // X^T X is symmetric, so it is sufficient to only fill a triangular part
     // of the matrix
-    triangularView<Lower>(X_transp_X) += x * trans(x);
+    if (blockSize > 0) {
+        rowBuffer.col(numBufferedRows) = x;
+        numBufferedRows++;
+        if (numBufferedRows == blockSize)
+            flush();
+    } else {
+        triangularView<Lower>(X_transp_X) += x * trans(x);
+    }
     return *this;
 }
 
+/**
+ * @brief Add all buffered rows to \f$ X^T X \f$
+ *
+ * A rank-1 update per row is memory-bound once the number of independent
+ * variables exceeds a few hundred: Each row streams the whole (lower
+ * triangular part of the) matrix through the cache. Adding a block of
+ * \f$ k \f$ rows \f$ B \f$ at once as \f$ X^T X \mathrel{+}= B B^T \f$ is a
+ * BLAS-3 operation (SYRK) that reads the matrix only once per block.
+ */
+template <class Container>
+inline
+void
+LinearRegressionAccumulator<Container>::flush() {
+    if (numBufferedRows == 0)
+        return;
+
+    X_transp_X.template selfadjointView<Eigen::Lower>().rankUpdate(
+        rowBuffer.leftCols(numBufferedRows));
+    numBufferedRows = 0;
+}
+
 /**
  * @brief Merge with another accumulation state
  */
@@ -114,11 +151,15 @@ LinearRegressionAccumulator<Container>::operator<<(
         throw std::runtime_error("Inconsistent numbers of independent "
             "variables.");
 
+    flush();
     numRows += inOther.numRows;
     y_sum += inOther.y_sum;
     y_square_sum += inOther.y_square_sum;
     X_transp_Y.noalias() += inOther.X_transp_Y;
     triangularView<Lower>(X_transp_X) += inOther.X_transp_X;
+    if (inOther.numBufferedRows > 0)
+        X_transp_X.template selfadjointView<Eigen::Lower>().rankUpdate(
+            inOther.rowBuffer.leftCols(inOther.numBufferedRows));
     return *this;
 }
 
@@ -134,6 +175,125 @@ LinearRegressionAccumulator<Container>::operator=(
 }
 
 
+/**
+ * @brief Estimate the 1-norm of the inverse of a symmetric positive definite
+ *     matrix, given its \f$ L D L^T \f$ decomposition
+ *
+ * This is Hager's method with Higham's refinements, as used by the LAPACK
+ * condition estimators (e.g., \c dpocon). It needs at most 11 solves with the
+ * decomposition, i.e., \f$ O(k^2) \f$ operations. The estimate is a lower
+ * bound that is rarely off by more than a factor of 3.
+ */
+template <class LDLTType>
+inline
+double
+estimateNorm1OfInverse(const LDLTType& inLDLT) {
+    const int kMaxIterations = 5;
+    const Index size = inLDLT.rows();
+    double estimate = 0;
+
+    ColumnVector x = ColumnVector::Constant(size,
+        1. / static_cast<double>(size));
+    for (int i = 0; i < kMaxIterations; ++i) {
+        ColumnVector y = inLDLT.solve(x);
+        double norm = y.lpNorm<1>();
+        if (i > 0 && norm <= estimate)
+            break;
+        estimate = norm;
+
+        // The matrix is symmetric, so solving with the transpose is the same
+        ColumnVector signs(size);
+        for (Index j = 0; j < size; ++j)
+            signs(j) = y(j) >= 0 ? 1. : -1.;
+        ColumnVector z = inLDLT.solve(signs);
+        Index maxIndex;
+        double maxAbs = z.cwiseAbs().maxCoeff(&maxIndex);
+        if (i > 0 && maxAbs <= dot(z, x))
+            break;
+        x.setZero();
+        x(maxIndex) = 1;
+    }
+
+    // Higham's alternative estimate guards against the (rare) cases in which
+    // the iteration gets stuck
+    for (Index i = 0; i < size; ++i)
+        x(i) = (i % 2 == 0 ? 1. : -1.) * (1. + (size > 1
+            ? static_cast<double>(i) / static_cast<double>(size - 1) : 0.));
+    double alternative = 2. * ColumnVector(inLDLT.solve(x)).lpNorm<1>()
+        / (3. * static_cast<double>(size));
+    return std::max(estimate, alternative);
+}
+
+/**
+ * @brief Estimate the condition number of a symmetric positive definite matrix
+ *
+ * The largest eigenvalue is approximated with the power method, the smallest
+ * with inverse iteration (using the given \f$ L D L^T \f$ decomposition of the
+ * matrix). Each iteration costs only \f$ O(k^2) \f$, and the number of
+ * iterations is small and fixed, so the result is only an estimate (and a
+ * lower bound). It is used for reporting; whether the decomposition is
+ * accurate enough is decided with estimateNorm1OfInverse().
+ *
+ * @param inMatrix Matrix of which only the lower triangular part is referenced
+ * @param inLDLT The \f$ L D L^T \f$ decomposition of \c inMatrix
+ */
+template <class LDLTType>
+inline
+double
+estimateConditionNo(const Matrix& inMatrix, const LDLTType& inLDLT) {
+    const int kMaxIterations = 30;
+    const double kTolerance = 1e-6;
+    const Index size = inMatrix.rows();
+    double largestEigenvalue = 0;
+    double largestInverseEigenvalue = 0;
+    bool converged = false;
+
+    ColumnVector v = ColumnVector::Constant(size, 1. / std::sqrt(
+        static_cast<double>(size)));
+    for (int i = 0; i < kMaxIterations && !converged; ++i) {
+        ColumnVector w = inMatrix.selfadjointView<Eigen::Lower>() * v;
+        double rayleighQuotient = dot(v, w);
+        converged = std::fabs(rayleighQuotient - largestEigenvalue)
+            <= kTolerance * rayleighQuotient;
+        largestEigenvalue = rayleighQuotient;
+        v = w / w.norm();
+    }
+
+    converged = false;
+    v.fill(1. / std::sqrt(static_cast<double>(size)));
+    for (int i = 0; i < kMaxIterations && !converged; ++i) {
+        ColumnVector w = inLDLT.solve(v);
+        double rayleighQuotient = dot(v, w);
+        converged = std::fabs(rayleighQuotient - largestInverseEigenvalue)
+            <= kTolerance * rayleighQuotient;
+        largestInverseEigenvalue = rayleighQuotient;
+        v = w / w.norm();
+    }
+
+    return largestEigenvalue * largestInverseEigenvalue;
+}
+
+/**
+ * @brief Return the diagonal of the inverse of a matrix, given its
+ *     \f$ L D L^T \f$ decomposition
+ *
+ * With \f$ P^T L D L^T P \f$ being the decomposition and
+ * \f$ W = L^{-1} \f$, we have \f$ (L^{-T} D^{-1} L^{-1})_{kk}
+ * = \sum_m W_{mk}^2 / D_m \f$. The full inverse is never formed.
+ */
+template <class LDLTType>
+inline
+ColumnVector
+diagonalOfInverse(const LDLTType& inLDLT) {
+    Matrix inverseOfL = Matrix::Identity(inLDLT.rows(), inLDLT.cols());
+    inLDLT.matrixL().solveInPlace(inverseOfL);
+
+    ColumnVector permutedDiagonal =
+        (inverseOfL.array().square().colwise()
+            / inLDLT.vectorD().array()).colwise().sum().transpose();
+    return inLDLT.transpositionsP().transpose() * permutedDiagonal;
+}
+
 template <class Container>
 LinearRegression::LinearRegression(
     const LinearRegressionAccumulator<Container>& inState) {
@@ -141,12 +301,24 @@ LinearRegression::LinearRegression(
     compute(inState);
 }
 
+inline
+LinearRegression::LinearRegression(uint64_t inNumRows, uint16_t inWidthOfX,
+    double inYSum, double inYSquareSum, const Matrix& inX_transp_X,
+    const ColumnVector& inX_transp_Y) {
+
+    compute(inNumRows, inWidthOfX, inYSum, inYSquareSum, inX_transp_X,
+        inX_transp_Y);
+}
+
 /**
  * @brief Transform a linear-regression accumulation state into a result
  *
  * The result of the accumulation phase is \f$ X^T X \f$ and
- * \f$ X^T \boldsymbol y \f$. We first compute the pseudo-inverse, then the
- * regression coefficients, the model statistics, etc.
+ * \f$ X^T \boldsymbol y \f$. If \f$ X^T X \f$ is positive definite and
+ * well-conditioned, we compute the regression coefficients and the diagonal of
+ * the inverse from an \f$ L D L^T \f$ Cholesky decomposition. Otherwise, we
+ * fall back to computing the pseudo-inverse from the eigen decomposition. We
+ * then compute the model statistics, etc.
  *
  * @sa For the mathematical description, see \ref grp_linreg.
  */
@@ -156,32 +328,81 @@ LinearRegression&
 LinearRegression::compute(
     const LinearRegressionAccumulator<Container>& inState) {
 
+    // The state is immutable here, so rows that are still buffered have to be
+    // added to a copy of X^T X
+    Matrix X_transp_X = inState.X_transp_X;
+    if (inState.numBufferedRows > 0)
+        X_transp_X.selfadjointView<Eigen::Lower>().rankUpdate(
+            inState.rowBuffer.leftCols(inState.numBufferedRows));
+
+    return compute(inState.numRows, inState.widthOfX, inState.y_sum,
+        inState.y_square_sum, X_transp_X, inState.X_transp_Y);
+}
+
+/**
+ * @brief Compute the result from the sufficient statistics
+ *
+ * @param inX_transp_X Matrix \f$ X^T X \f$ of which only the lower
+ *     triangular part is referenced
+ *
+ * This is used by the aggregate state above and by the per-group states of
+ * grouped linear regression.
+ */
+inline
+LinearRegression&
+LinearRegression::compute(uint64_t inNumRows, uint16_t inWidthOfX,
+    double inYSum, double inYSquareSum, const Matrix& inX_transp_X,
+    const ColumnVector& inX_transp_Y) {
+
     Allocator& allocator = defaultAllocator();
 
     // The following checks were introduced with MADLIB-138. It still seems
     // useful to have clear error messages in case of infinite input values.
-    if (!isfinite(inState.X_transp_X) || !isfinite(inState.X_transp_Y))
+    if (!isfinite(inX_transp_X) || !isfinite(inX_transp_Y))
         throw std::domain_error("Design matrix is not finite.");
 
-    SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
-        inState.X_transp_X, EigenvaluesOnly, ComputePseudoInverse);
-
-    // Precompute (X^T * X)^+
-    Matrix inverse_of_X_transp_X = decomposition.pseudoInverse();
-    conditionNo = decomposition.conditionNo();
-
     // Vector of coefficients: For efficiency reasons, we want to return this
     // by reference, so we need to bind to db memory
-    coef.rebind(allocator.allocateArray<double>(inState.widthOfX));
-    coef.noalias() = inverse_of_X_transp_X * inState.X_transp_Y;
+    coef.rebind(allocator.allocateArray<double>(inWidthOfX));
+
+    // The LDL^T decomposition takes about a quarter of the floating-point
+    // operations that the tridiagonalization for the eigenvalues alone takes.
+    // In the (common) well-conditioned case, we therefore never need an eigen
+    // decomposition or the full p x p inverse. Up to the following condition
+    // number, the LDL^T solution loses at most 8 significant digits. We
+    // compare it with an estimate of the 1-norm condition number, which is an
+    // upper bound of the 2-norm condition number for symmetric matrices.
+    const double kMaxConditionNoForCholesky = 1e8;
+    ColumnVector diagonal_of_inverse_of_X_transp_X;
+    Eigen::LDLT<Matrix> ldlt
+        = inX_transp_X.selfadjointView<Eigen::Lower>().ldlt();
+
+    if (ldlt.vectorD().minCoeff() > 0
+        && Matrix(inX_transp_X.selfadjointView<Eigen::Lower>()).cwiseAbs()
+                .colwise().sum().maxCoeff() * estimateNorm1OfInverse(ldlt)
+            < kMaxConditionNoForCholesky) {
+
+        conditionNo = estimateConditionNo(inX_transp_X, ldlt);
+        coef = ldlt.solve(inX_transp_Y);
+        diagonal_of_inverse_of_X_transp_X = diagonalOfInverse(ldlt);
+    } else {
+        SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
+            inX_transp_X, EigenvaluesOnly, ComputePseudoInverse);
+
+        // Precompute (X^T * X)^+
+        const Matrix& inverse_of_X_transp_X = decomposition.pseudoInverse();
+        conditionNo = decomposition.conditionNo();
+        coef.noalias() = inverse_of_X_transp_X * inX_transp_Y;
+        diagonal_of_inverse_of_X_transp_X = inverse_of_X_transp_X.diagonal();
+    }
 
     // explained sum of squares (regression sum of squares)
-    double ess = dot(inState.X_transp_Y, coef)
-        - (inState.y_sum * inState.y_sum / static_cast<double>(inState.numRows));
+    double ess = dot(inX_transp_Y, coef)
+        - (inYSum * inYSum / static_cast<double>(inNumRows));
 
     // total sum of squares
-    double tss = inState.y_square_sum
-        - (inState.y_sum * inState.y_sum / static_cast<double>(inState.numRows));
+    double tss = inYSquareSum
+        - (inYSum * inYSum / static_cast<double>(inNumRows));
 
     // With infinite precision, the following checks are pointless. But due to
     // floating-point arithmetic, this need not hold at this point.
@@ -208,20 +429,21 @@ LinearRegression::compute(
     double rss = tss - ess;
 
     // Variance is also called the mean square error
-	double variance = rss / static_cast<double>(inState.numRows - inState.widthOfX);
+	double variance = rss / static_cast<double>(inNumRows - inWidthOfX);
 
     // Vector of standard errors and t-statistics: For efficiency reasons, we
     // want to return these by reference, so we need to bind to db memory
-    stdErr.rebind(allocator.allocateArray<double>(inState.widthOfX));
-    tStats.rebind(allocator.allocateArray<double>(inState.widthOfX));
-    for (int i = 0; i < inState.widthOfX; i++) {
+    stdErr.rebind(allocator.allocateArray<double>(inWidthOfX));
+    tStats.rebind(allocator.allocateArray<double>(inWidthOfX));
+    for (int i = 0; i < inWidthOfX; i++) {
         // In an abundance of caution, we see a tiny possibility that numerical
         // instabilities in the pinv operation can lead to negative values on
         // the main diagonal of even a SPD matrix
-        if (inverse_of_X_transp_X(i,i) < 0) {
+        if (diagonal_of_inverse_of_X_transp_X(i) < 0) {
             stdErr(i) = 0;
         } else {
-            stdErr(i) = std::sqrt( variance * inverse_of_X_transp_X(i,i) );
+            stdErr(i) = std::sqrt(
+                variance * diagonal_of_inverse_of_X_transp_X(i) );
         }
 
         if (coef(i) == 0 && stdErr(i) == 0) {
@@ -238,13 +460,13 @@ LinearRegression::compute(
 
     // Vector of p-values: For efficiency reasons, we want to return this
     // by reference, so we need to bind to db memory
-    pValues.rebind(allocator.allocateArray<double>(inState.widthOfX));
-    if (inState.numRows > inState.widthOfX)
-        for (int i = 0; i < inState.widthOfX; i++)
+    pValues.rebind(allocator.allocateArray<double>(inWidthOfX));
+    if (inNumRows > inWidthOfX)
+        for (int i = 0; i < inWidthOfX; i++)
             pValues(i) = 2. * prob::cdf(
                 boost::math::complement(
                     prob::students_t(
-                        static_cast<double>(inState.numRows - inState.widthOfX)
+                        static_cast<double>(inNumRows - inWidthOfX)
                     ),
                     std::fabs(tStats(i))
                 ));
@@ -32,21 +32,31 @@ public:
         const LinearRegressionAccumulator<OtherContainer>& inOther);
     template <class OtherContainer> LinearRegressionAccumulator& operator=(
         const LinearRegressionAccumulator<OtherContainer>& inOther);
+    void flush();
 
     uint64_type numRows;
     uint16_type widthOfX;
+    uint16_type blockSize;
+    uint16_type numBufferedRows;
     double_type y_sum;
     double_type y_square_sum;
     ColumnVector_type X_transp_Y;
     Matrix_type X_transp_X;
+    Matrix_type rowBuffer;
 };
 
 class LinearRegression {
 public:
     template <class Container> LinearRegression(
         const LinearRegressionAccumulator<Container>& inState);
+    LinearRegression(uint64_t inNumRows, uint16_t inWidthOfX, double inYSum,
+        double inYSquareSum, const Matrix& inX_transp_X,
+        const ColumnVector& inX_transp_Y);
     template <class Container> LinearRegression& compute(
         const LinearRegressionAccumulator<Container>& inState);
+    LinearRegression& compute(uint64_t inNumRows, uint16_t inWidthOfX,
+        double inYSum, double inYSquareSum, const Matrix& inX_transp_X,
+        const ColumnVector& inX_transp_Y);
 
     MutableNativeColumnVector coef;
     double r2;
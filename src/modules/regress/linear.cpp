@@ -7,6 +7,8 @@
  *//* ----------------------------------------------------------------------- */
 
 #include <dbconnector/dbconnector.hpp>
+#include <modules/shared/HandleTraits.hpp>
+#include <modules/shared/GroupArena.hpp>
 
 #include "LinearRegression_proto.hpp"
 #include "LinearRegression_impl.hpp"
@@ -27,6 +29,15 @@ linregr_transition::run(AnyType& args) {
     double y = args[1].getAs<double>();
     MappedColumnVector x = args[2].getAs<MappedColumnVector>();
 
+    // The optional fourth argument is the number of rows to buffer before
+    // updating X^T X. It only has an effect before the first row.
+    if (args.numFields() > 3 && state.numRows == 0) {
+        int32_t blockSize = args[3].getAs<int32_t>();
+        if (blockSize < 0 || blockSize > std::numeric_limits<uint16_t>::max())
+            throw std::domain_error("Block size must be between 0 and 65535.");
+        state.blockSize = static_cast<uint16_t>(blockSize);
+    }
+
     state << MutableLinRegrState::tuple_type(x, y);
     return state.storage();
 }
@@ -60,6 +71,192 @@ linregr_final::run(AnyType& args) {
     return tuple;
 }
 
+/**
+ * @brief Slot of one group in the state of grouped linear regression
+ *
+ * Each slot holds the same sufficient statistics as
+ * LinearRegressionAccumulator (without the row buffer).
+ */
+template <class Handle>
+class LinRegrGroup {
+public:
+    static inline uint32_t slotSize(uint16_t inWidthOfX) {
+        return 4 + inWidthOfX + static_cast<uint32_t>(inWidthOfX) * inWidthOfX;
+    }
+
+    /**
+     * @brief Rebind to a slot
+     *
+     * Slot layout:
+     * - 0: key (group key)
+     * - 1: numRows (number of rows of the group)
+     * - 2: y_sum (sum of dependent variables)
+     * - 3: y_square_sum (sum of squares of dependent variables)
+     * - 4: X_transp_Y (X^T y)
+     * - 4 + widthOfX: X_transp_X (X^T X, only the lower triangular part is
+     *   used)
+     */
+    void rebind(typename HandleTraits<Handle>::DoublePtr inSlot,
+        uint16_t inWidthOfX) {
+
+        key.rebind(&inSlot[0]);
+        numRows.rebind(&inSlot[1]);
+        y_sum.rebind(&inSlot[2]);
+        y_square_sum.rebind(&inSlot[3]);
+        X_transp_Y.rebind(&inSlot[4], inWidthOfX);
+        X_transp_X.rebind(&inSlot[4 + inWidthOfX], inWidthOfX, inWidthOfX);
+    }
+
+    typename HandleTraits<Handle>::ReferenceToInt64 key;
+    typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
+    typename HandleTraits<Handle>::ReferenceToDouble y_sum;
+    typename HandleTraits<Handle>::ReferenceToDouble y_square_sum;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap X_transp_Y;
+    typename HandleTraits<Handle>::MatrixTransparentHandleMap X_transp_X;
+};
+
+typedef GroupArena<ArrayHandle<double>, LinRegrGroup> LinRegrGroupedState;
+typedef GroupArena<MutableArrayHandle<double>, LinRegrGroup>
+    MutableLinRegrGroupedState;
+
+/**
+ * @brief Transition function of grouped linear regression
+ *
+ * Arguments:
+ * - 0: Current state
+ * - 1: Group key (BIGINT)
+ * - 2: y value
+ * - 3: x value
+ *
+ * All groups are accumulated in a single state, so that one aggregate call
+ * computes the models of all groups. Each row takes expected constant time to
+ * find its group, plus the \f$ O(k^2) \f$ update of \f$ X^T X \f$.
+ */
+AnyType
+linregr_grouped_transition::run(AnyType& args) {
+    MutableLinRegrGroupedState state = args[0];
+    int64_t key = args[1].getAs<int64_t>();
+    double y = args[2].getAs<double>();
+    MappedColumnVector x = args[3].getAs<MappedColumnVector>();
+
+    // The following checks were introduced with MADLIB-138. It still seems
+    // useful to have clear error messages in case of infinite input values.
+    if (!std::isfinite(y))
+        throw std::domain_error("Dependent variables are not finite.");
+    else if (!x.is_finite())
+        throw std::domain_error("Design matrix is not finite.");
+
+    if (state.numRows == 0) {
+        if (x.size() > std::numeric_limits<uint16_t>::max())
+            throw std::domain_error("Number of independent variables cannot be "
+                "larger than 65535.");
+
+        state.initialize(*this, static_cast<uint16_t>(x.size()));
+    } else if (state.widthOfX != static_cast<uint16_t>(x.size())) {
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+    }
+
+    LinRegrGroup<MutableArrayHandle<double> > group;
+    state.insert(*this, key, group);
+
+    state.numRows++;
+    group.numRows++;
+    group.y_sum += y;
+    group.y_square_sum += y * y;
+    group.X_transp_Y.noalias() += x * y;
+    triangularView<Lower>(group.X_transp_X) += x * trans(x);
+    return state;
+}
+
+/**
+ * @brief Merge transition states of grouped linear regression
+ */
+AnyType
+linregr_grouped_merge_states::run(AnyType& args) {
+    MutableLinRegrGroupedState stateLeft = args[0];
+    LinRegrGroupedState stateRight = args[1];
+
+    // We first handle the trivial case where this function is called with one
+    // of the states being the initial state
+    if (stateLeft.numRows == 0)
+        return stateRight;
+    else if (stateRight.numRows == 0)
+        return stateLeft;
+    else if (stateLeft.widthOfX != stateRight.widthOfX)
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+
+    LinRegrGroup<ArrayHandle<double> > groupRight;
+    LinRegrGroup<MutableArrayHandle<double> > groupLeft;
+    for (uint64_t i = 0; i < stateRight.numGroups; ++i) {
+        stateRight.group(i, groupRight);
+        stateLeft.insert(*this, groupRight.key, groupLeft);
+
+        groupLeft.numRows += groupRight.numRows;
+        groupLeft.y_sum += groupRight.y_sum;
+        groupLeft.y_square_sum += groupRight.y_square_sum;
+        groupLeft.X_transp_Y.noalias() += groupRight.X_transp_Y;
+        triangularView<Lower>(groupLeft.X_transp_X) += groupRight.X_transp_X;
+    }
+    stateLeft.numRows += stateRight.numRows;
+    return stateLeft;
+}
+
+/**
+ * @brief Cross-call context of linregr_grouped_result
+ */
+struct LinRegrGroupedResultContext {
+    LinRegrGroupedResultContext(const AnyType &inState)
+      : state(inState), nextGroup(0) { }
+
+    LinRegrGroupedState state;
+    uint64_t nextGroup;
+};
+
+/**
+ * @brief Initialize the iteration over all groups of the state
+ */
+void *
+linregr_grouped_result::SRF_init(AnyType &args) {
+    // This is called in the multi-call memory context, so the context lives
+    // until the last call
+    return new LinRegrGroupedResultContext(args[0]);
+}
+
+/**
+ * @brief Return the result of the next group
+ *
+ * The columns are the group key followed by the columns of linregr_final.
+ */
+AnyType
+linregr_grouped_result::SRF_next(void *user_fctx, bool *is_last_call) {
+    LinRegrGroupedResultContext *context
+        = static_cast<LinRegrGroupedResultContext*>(user_fctx);
+
+    if (context->nextGroup >= context->state.numGroups) {
+        *is_last_call = true;
+        return Null();
+    }
+
+    LinRegrGroup<ArrayHandle<double> > group;
+    context->state.group(context->nextGroup++, group);
+    *is_last_call = false;
+
+    uint16_t widthOfX = context->state.widthOfX;
+    LinearRegression result(group.numRows, widthOfX, group.y_sum,
+        group.y_square_sum, group.X_transp_X, group.X_transp_Y);
+
+    AnyType tuple;
+    tuple << static_cast<int64_t>(group.key) << result.coef << result.r2
+        << result.stdErr << result.tStats
+        << (group.numRows > widthOfX
+            ? result.pValues
+            : Null())
+        << result.conditionNo;
+    return tuple;
+}
+
 } // namespace regress
 
 } // namespace modules
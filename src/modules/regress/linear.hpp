@@ -19,3 +19,18 @@ DECLARE_UDF(regress, linregr_merge_states)
  */
 DECLARE_UDF(regress, linregr_final)
 
+
+/**
+ * @brief Grouped linear regression: Transition function
+ */
+DECLARE_UDF(regress, linregr_grouped_transition)
+
+/**
+ * @brief Grouped linear regression: State merge function
+ */
+DECLARE_UDF(regress, linregr_grouped_merge_states)
+
+/**
+ * @brief Grouped linear regression: Return one result row per group
+ */
+DECLARE_SR_UDF(regress, linregr_grouped_result)
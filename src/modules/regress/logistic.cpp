@@ -4,13 +4,18 @@
  *
  * @brief Logistic-Regression functions
  *
- * We implement the conjugate-gradient method and the iteratively-reweighted-
- * least-squares method.
+ * We implement the conjugate-gradient method, the iteratively-reweighted-
+ * least-squares method (also for many groups at once), the incremental
+ * gradient method, and the limited-memory BFGS method.
  *
  *//* ----------------------------------------------------------------------- */
 #include <limits>
+#include <sstream>
 #include <dbconnector/dbconnector.hpp>
 #include <modules/shared/HandleTraits.hpp>
+#include <modules/shared/GroupArena.hpp>
+#include <modules/shared/LBFGS.hpp>
+#include <modules/shared/StepSizePolicy.hpp>
 #include <modules/prob/boost.hpp>
 
 #include "logistic.hpp"
@@ -370,7 +375,10 @@ public:
     LogRegrIRLSTransitionState(const AnyType &inArray)
         : mStorage(inArray.getAs<Handle>()) {
 
-        rebind(static_cast<uint16_t>(mStorage[0]));
+        uint16_t actualWidthOfX = static_cast<uint16_t>(mStorage[0]);
+        rebind(actualWidthOfX, static_cast<uint16_t>(
+            mStorage[3 + actualWidthOfX * actualWidthOfX
+                + 2 * actualWidthOfX]));
     }
 
     /**
@@ -387,12 +395,20 @@ public:
      * @brief Initialize the iteratively-reweighted-least-squares state.
      *
      * This function is only called for the first iteration, for the first row.
+     *
+     * @param inBlockSize Number of rows to buffer before updating
+     *     \f$ X^T A X \f$ with a single weighted rank-k update. If 0, rows are
+     *     not buffered.
      */
-    inline void initialize(const Allocator &inAllocator, uint16_t inWidthOfX) {
+    inline void initialize(const Allocator &inAllocator, uint16_t inWidthOfX,
+        uint16_t inBlockSize = 0) {
+
         mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
-            dbal::DoZero, dbal::ThrowBadAlloc>(arraySize(inWidthOfX));
-        rebind(inWidthOfX);
+            dbal::DoZero, dbal::ThrowBadAlloc>(
+                arraySize(inWidthOfX, inBlockSize));
+        rebind(inWidthOfX, inBlockSize);
         widthOfX = inWidthOfX;
+        blockSize = inBlockSize;
     }
 
     /**
@@ -420,6 +436,10 @@ public:
             throw std::logic_error("Internal error: Incompatible transition "
                 "states");
 
+        flush();
+        addBlock(inOtherState.X_buffer.leftCols(inOtherState.numBufferedRows),
+            inOtherState.y_buffer.head(inOtherState.numBufferedRows));
+
         numRows += inOtherState.numRows;
         X_transp_Az += inOtherState.X_transp_Az;
         X_transp_AX += inOtherState.X_transp_AX;
@@ -435,17 +455,69 @@ public:
         X_transp_Az.fill(0);
         X_transp_AX.fill(0);
         logLikelihood = 0;
+        numBufferedRows = 0;
+    }
+
+    /**
+     * @brief Process all buffered rows
+     */
+    inline void flush() {
+        addBlock(X_buffer.leftCols(numBufferedRows),
+            y_buffer.head(numBufferedRows));
+        numBufferedRows = 0;
     }
 
 private:
-    static inline uint32_t arraySize(const uint16_t inWidthOfX) {
-        return 3 + inWidthOfX * inWidthOfX + 2 * inWidthOfX;
+    static inline uint32_t arraySize(const uint16_t inWidthOfX,
+        const uint16_t inBlockSize) {
+
+        return 5 + inWidthOfX * inWidthOfX + 2 * inWidthOfX
+            + inBlockSize * (inWidthOfX + 1);
+    }
+
+    /**
+     * @brief Add the contribution of a block of rows to the intra-iteration
+     *     fields (except numRows)
+     *
+     * The weights of all rows are computed at once, and \f$ X^T A X \f$ is
+     * updated by a single rank-k update with the rows scaled by
+     * \f$ \sqrt{a_i} \f$.
+     *
+     * @param inX Matrix whose columns are the buffered rows
+     * @param inY Vector of buffered dependent variables (each 1 or -1)
+     */
+    template <class XType, class YType>
+    void addBlock(const Eigen::MatrixBase<XType> &inX,
+        const Eigen::MatrixBase<YType> &inY) {
+
+        if (inX.cols() == 0)
+            return;
+
+        // xc_i = x^T_i c
+        ColumnVector xc = trans(inX) * coef;
+
+        // sigma(xc_i) and sigma(-xc_i), see logregr_irls_step_transition
+        ColumnVector sigmaXc = (1. + (-xc).array().exp()).inverse();
+        ColumnVector sigmaMinusXc = (1. + xc.array().exp()).inverse();
+        ColumnVector a = sigmaXc.cwiseProduct(sigmaMinusXc);
+        ColumnVector az(xc.size());
+        for (Index i = 0; i < xc.size(); ++i) {
+            az(i) = xc(i) * a(i) + (inY(i) > 0 ? sigmaMinusXc(i) : sigmaXc(i))
+                * inY(i);
+            logLikelihood -= std::log(1. + std::exp(-inY(i) * xc(i)));
+        }
+
+        X_transp_Az.noalias() += inX * az;
+        Matrix scaledX = inX * a.cwiseSqrt().asDiagonal();
+        X_transp_AX.template selfadjointView<Eigen::Lower>()
+            .rankUpdate(scaledX);
     }
 
     /**
      * @brief Rebind to a new storage array
      *
      * @param inWidthOfX The number of independent variables.
+     * @param inBlockSize The number of rows that can be buffered.
      *
      * Array layout (iteration refers to one aggregate-function call):
      * Inter-iteration components (updated in final function):
@@ -457,14 +529,28 @@ private:
      * - 2 + widthOfX: X_transp_Az (X^T A z)
      * - 2 + 2 * widthOfX: X_transp_AX (X^T A X)
      * - 2 + widthOfX^2 + 2 * widthOfX: logLikelihood ( ln(l(c)) )
+     * - 3 + widthOfX^2 + 2 * widthOfX: blockSize (number of rows that can be
+     *   buffered, 0 if rows are not buffered)
+     * - 4 + widthOfX^2 + 2 * widthOfX: numBufferedRows (number of rows in the
+     *   buffer)
+     * - 5 + widthOfX^2 + 2 * widthOfX: y_buffer (buffered dependent variables)
+     * - 5 + widthOfX^2 + 2 * widthOfX + blockSize: X_buffer (buffered rows, one
+     *   per column)
      */
-    void rebind(uint16_t inWidthOfX = 0) {
+    void rebind(uint16_t inWidthOfX = 0, uint16_t inBlockSize = 0) {
         widthOfX.rebind(&mStorage[0]);
         coef.rebind(&mStorage[1], inWidthOfX);
         numRows.rebind(&mStorage[1 + inWidthOfX]);
         X_transp_Az.rebind(&mStorage[2 + inWidthOfX], inWidthOfX);
         X_transp_AX.rebind(&mStorage[2 + 2 * inWidthOfX], inWidthOfX, inWidthOfX);
         logLikelihood.rebind(&mStorage[2 + inWidthOfX * inWidthOfX + 2 * inWidthOfX]);
+        blockSize.rebind(&mStorage[3 + inWidthOfX * inWidthOfX + 2 * inWidthOfX]);
+        numBufferedRows.rebind(
+            &mStorage[4 + inWidthOfX * inWidthOfX + 2 * inWidthOfX]);
+        y_buffer.rebind(&mStorage[5 + inWidthOfX * inWidthOfX + 2 * inWidthOfX],
+            inBlockSize);
+        X_buffer.rebind(&mStorage[5 + inWidthOfX * inWidthOfX + 2 * inWidthOfX
+            + inBlockSize], inWidthOfX, inBlockSize);
     }
 
     Handle mStorage;
@@ -477,6 +563,10 @@ public:
     typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap X_transp_Az;
     typename HandleTraits<Handle>::MatrixTransparentHandleMap X_transp_AX;
     typename HandleTraits<Handle>::ReferenceToDouble logLikelihood;
+    typename HandleTraits<Handle>::ReferenceToUInt16 blockSize;
+    typename HandleTraits<Handle>::ReferenceToUInt16 numBufferedRows;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap y_buffer;
+    typename HandleTraits<Handle>::MatrixTransparentHandleMap X_buffer;
 };
 
 AnyType
@@ -534,6 +624,57 @@ logregr_irls_step_transition::run(AnyType &args) {
     return state;
 }
 
+/**
+ * @brief Perform the blocked iteratively-reweighted-least-squares transition
+ *     step
+ *
+ * Rows are only buffered in the transition state. Once the buffer is full, the
+ * weights of all buffered rows are computed at once and \f$ X^T A X \f$ is
+ * updated by a single weighted rank-k update (instead of one rank-1 update per
+ * row). The result is the same as with logregr_irls_step_transition.
+ */
+AnyType
+logregr_irls_blocked_step_transition::run(AnyType &args) {
+    LogRegrIRLSTransitionState<MutableArrayHandle<double> > state = args[0];
+    double y = args[1].getAs<bool>() ? 1. : -1.;
+    MappedColumnVector x = args[2].getAs<MappedColumnVector>();
+
+    if (!x.is_finite())
+        throw std::domain_error("Design matrix is not finite.");
+
+    if (state.numRows == 0) {
+        if (x.size() > std::numeric_limits<uint16_t>::max())
+            throw std::domain_error("Number of independent variables cannot be "
+                "larger than 65535.");
+
+        // Limit the buffer to about 1 MB, but use at least 16 and at most 256
+        // rows per block
+        uint16_t blockSize = static_cast<uint16_t>(std::min<Index>(256,
+            std::max<Index>(16, 131072 / (x.size() + 1))));
+        state.initialize(*this, static_cast<uint16_t>(x.size()), blockSize);
+        if (!args[3].isNull()) {
+            LogRegrIRLSTransitionState<ArrayHandle<double> > previousState = args[3];
+
+            state = previousState;
+            state.reset();
+        }
+    }
+
+    if (x.size() != state.widthOfX)
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+
+    Index row = state.numBufferedRows;
+    state.numRows++;
+    state.y_buffer(row) = y;
+    state.X_buffer.col(row) = x;
+    state.numBufferedRows++;
+    if (state.numBufferedRows == state.blockSize)
+        state.flush();
+
+    return state;
+}
+
 /**
  * @brief Perform the perliminary aggregation function: Merge transition states
  */
@@ -567,6 +708,9 @@ logregr_irls_step_final::run(AnyType &args) {
     if (state.numRows == 0)
         return Null();
 
+    // Rows still buffered by the blocked variant
+    state.flush();
+
     // See MADLIB-138. At least on certain platforms and with certain versions,
     // LAPACK will run into an infinite loop if pinv() is called for non-finite
     // matrices. We extend the check also to the dependent variables.
@@ -618,6 +762,321 @@ internal_logregr_irls_result::run(AnyType &args) {
         state.X_transp_Az, state.logLikelihood, state.X_transp_AX(0,0));
 }
 
+/**
+ * @brief Slot of one group in the state of grouped logistic regression
+ *
+ * Each group has its own coefficients and IRLS fields, and converges
+ * independently of the other groups. Once a group has converged, its slot is
+ * not updated any more (in particular, the intra-iteration fields are not
+ * reset), so that the result function can still read its final values.
+ */
+template <class Handle>
+class LogRegrIRLSGroup {
+public:
+    static inline uint32_t slotSize(uint16_t inWidthOfX) {
+        return 7 + 2 * inWidthOfX
+            + static_cast<uint32_t>(inWidthOfX) * inWidthOfX;
+    }
+
+    /**
+     * @brief Reset the intra-iteration fields.
+     */
+    inline void reset() {
+        numRows = 0;
+        logLikelihood = 0;
+        X_transp_Az.fill(0);
+        X_transp_AX.fill(0);
+    }
+
+    /**
+     * @brief Rebind to a slot
+     *
+     * Slot layout (iteration refers to one aggregate-function call):
+     * Inter-iteration components (updated in final function):
+     * - 0: key (group key)
+     * - 1: converged (whether the group has converged)
+     * - 2: numIterations (number of IRLS steps of this group)
+     * - 3: lastLogLikelihood (log-likelihood in the previous iteration)
+     * - 4: conditionNo (condition number of X^T A X in the last step)
+     *
+     * Intra-iteration components (updated in transition step):
+     * - 5: numRows (number of rows of the group in this iteration)
+     * - 6: logLikelihood ( ln(l(c)) )
+     * - 7: coef (vector of coefficients, inter-iteration)
+     * - 7 + widthOfX: X_transp_Az (X^T A z, after the final function the
+     *   diagonal of (X^T A X)^+)
+     * - 7 + 2 * widthOfX: X_transp_AX (X^T A X, only the lower triangular
+     *   part is used)
+     */
+    void rebind(typename HandleTraits<Handle>::DoublePtr inSlot,
+        uint16_t inWidthOfX) {
+
+        key.rebind(&inSlot[0]);
+        converged.rebind(&inSlot[1]);
+        numIterations.rebind(&inSlot[2]);
+        lastLogLikelihood.rebind(&inSlot[3]);
+        conditionNo.rebind(&inSlot[4]);
+        numRows.rebind(&inSlot[5]);
+        logLikelihood.rebind(&inSlot[6]);
+        coef.rebind(&inSlot[7], inWidthOfX);
+        X_transp_Az.rebind(&inSlot[7 + inWidthOfX], inWidthOfX);
+        X_transp_AX.rebind(&inSlot[7 + 2 * inWidthOfX], inWidthOfX,
+            inWidthOfX);
+    }
+
+    typename HandleTraits<Handle>::ReferenceToInt64 key;
+    typename HandleTraits<Handle>::ReferenceToBool converged;
+    typename HandleTraits<Handle>::ReferenceToUInt32 numIterations;
+    typename HandleTraits<Handle>::ReferenceToDouble lastLogLikelihood;
+    typename HandleTraits<Handle>::ReferenceToDouble conditionNo;
+
+    typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
+    typename HandleTraits<Handle>::ReferenceToDouble logLikelihood;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap coef;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap X_transp_Az;
+    typename HandleTraits<Handle>::MatrixTransparentHandleMap X_transp_AX;
+};
+
+typedef GroupArena<ArrayHandle<double>, LogRegrIRLSGroup>
+    LogRegrIRLSGroupedState;
+typedef GroupArena<MutableArrayHandle<double>, LogRegrIRLSGroup>
+    MutableLogRegrIRLSGroupedState;
+
+/**
+ * @brief Perform the grouped iteratively-reweighted-least-squares transition
+ *     step
+ *
+ * Arguments:
+ * - 0: Current state
+ * - 1: Group key (BIGINT)
+ * - 2: y value (BOOLEAN)
+ * - 3: x value
+ * - 4: Previous state
+ * - 5: Precision (only used in the first iteration)
+ *
+ * Rows of groups that have already converged only cost the hash lookup.
+ */
+AnyType
+logregr_irls_grouped_step_transition::run(AnyType &args) {
+    MutableLogRegrIRLSGroupedState state = args[0];
+    int64_t key = args[1].getAs<int64_t>();
+    double y = args[2].getAs<bool>() ? 1. : -1.;
+    MappedColumnVector x = args[3].getAs<MappedColumnVector>();
+
+    // The following check was added with MADLIB-138.
+    if (!x.is_finite())
+        throw std::domain_error("Design matrix is not finite.");
+
+    if (state.numRows == 0) {
+        if (x.size() > std::numeric_limits<uint16_t>::max())
+            throw std::domain_error("Number of independent variables cannot be "
+                "larger than 65535.");
+
+        if (!args[4].isNull()) {
+            LogRegrIRLSGroupedState previousState = args[4];
+            if (previousState.widthOfX != x.size())
+                throw std::runtime_error("Inconsistent numbers of independent "
+                    "variables.");
+
+            state.initialize(*this, previousState);
+            LogRegrIRLSGroup<MutableArrayHandle<double> > group;
+            for (uint64_t i = 0; i < state.numGroups; ++i) {
+                state.group(i, group);
+                if (!group.converged)
+                    group.reset();
+            }
+        } else {
+            state.initialize(*this, static_cast<uint16_t>(x.size()));
+            state.precision = args[5].getAs<double>();
+        }
+    } else if (state.widthOfX != x.size()) {
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+    }
+
+    state.numRows++;
+
+    LogRegrIRLSGroup<MutableArrayHandle<double> > group;
+    if (state.insert(*this, key, group))
+        state.numActiveGroups++;
+    if (group.converged)
+        return state;
+
+    // Now do the transition step. See logregr_irls_step_transition.
+    group.numRows++;
+    double xc = dot(x, group.coef);
+    double a = sigma(xc) * sigma(-xc);
+    double az = xc * a + sigma(-y * xc) * y;
+
+    group.X_transp_Az.noalias() += x * az;
+    triangularView<Lower>(group.X_transp_AX) += x * trans(x) * a;
+    group.logLikelihood -= std::log( 1. + std::exp(-y * xc) );
+    return state;
+}
+
+/**
+ * @brief Perform the perliminary aggregation function: Merge transition states
+ */
+AnyType
+logregr_irls_grouped_step_merge_states::run(AnyType &args) {
+    MutableLogRegrIRLSGroupedState stateLeft = args[0];
+    LogRegrIRLSGroupedState stateRight = args[1];
+
+    // We first handle the trivial case where this function is called with one
+    // of the states being the initial state
+    if (stateLeft.numRows == 0)
+        return stateRight;
+    else if (stateRight.numRows == 0)
+        return stateLeft;
+    else if (stateLeft.widthOfX != stateRight.widthOfX)
+        throw std::logic_error("Internal error: Incompatible transition "
+            "states");
+
+    // Both states started from the same previous state, so groups only
+    // contained in one of them are new in this iteration
+    LogRegrIRLSGroup<ArrayHandle<double> > groupRight;
+    LogRegrIRLSGroup<MutableArrayHandle<double> > groupLeft;
+    for (uint64_t i = 0; i < stateRight.numGroups; ++i) {
+        stateRight.group(i, groupRight);
+        if (stateLeft.insert(*this, groupRight.key, groupLeft)) {
+            stateLeft.numActiveGroups++;
+            groupLeft.coef = groupRight.coef;
+        }
+        if (groupRight.converged)
+            continue;
+
+        groupLeft.numRows += groupRight.numRows;
+        groupLeft.logLikelihood += groupRight.logLikelihood;
+        groupLeft.X_transp_Az += groupRight.X_transp_Az;
+        groupLeft.X_transp_AX += groupRight.X_transp_AX;
+    }
+    stateLeft.numRows += stateRight.numRows;
+    return stateLeft;
+}
+
+/**
+ * @brief Perform one IRLS step for each group that has not converged yet
+ *
+ * A group has converged once its log-likelihood changes by less than the
+ * precision between two iterations (the same criterion as for
+ * internal_logregr_irls_step_distance).
+ */
+AnyType
+logregr_irls_grouped_step_final::run(AnyType &args) {
+    // We request a mutable object. Depending on the backend, this might perform
+    // a deep copy.
+    MutableLogRegrIRLSGroupedState state = args[0];
+
+    // Aggregates that haven't seen any data just return Null.
+    if (state.numRows == 0)
+        return Null();
+
+    LogRegrIRLSGroup<MutableArrayHandle<double> > group;
+    for (uint64_t i = 0; i < state.numGroups; ++i) {
+        state.group(i, group);
+        if (group.converged)
+            continue;
+
+        if (!group.X_transp_AX.is_finite() || !group.X_transp_Az.is_finite()) {
+            std::stringstream errorMsg;
+            errorMsg << "Over- or underflow in intermediate calulation of "
+                "group " << static_cast<int64_t>(group.key) << ". Input data "
+                "is likely of poor numerical condition.";
+            throw NoSolutionFoundException(errorMsg.str());
+        }
+
+        SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
+            group.X_transp_AX, EigenvaluesOnly, ComputePseudoInverse);
+        Matrix inverse_of_X_transp_AX = decomposition.pseudoInverse();
+
+        group.coef.noalias() = inverse_of_X_transp_AX * group.X_transp_Az;
+        if (!group.coef.is_finite()) {
+            std::stringstream errorMsg;
+            errorMsg << "Over- or underflow in Newton step of group "
+                << static_cast<int64_t>(group.key) << ", while updating "
+                "coefficients. Input data is likely of poor numerical "
+                "condition.";
+            throw NoSolutionFoundException(errorMsg.str());
+        }
+
+        // As in logregr_irls_step_final, we keep the diagonal of the inverse
+        // for the result function
+        group.X_transp_Az = inverse_of_X_transp_AX.diagonal();
+        group.conditionNo = decomposition.conditionNo();
+
+        group.numIterations++;
+        if (group.numIterations > 1 && std::abs(group.logLikelihood
+                - group.lastLogLikelihood) < state.precision) {
+            group.converged = true;
+            state.numActiveGroups -= 1;
+        }
+        group.lastLogLikelihood = group.logLikelihood;
+    }
+
+    return state;
+}
+
+/**
+ * @brief Return the number of groups that have not converged yet
+ */
+AnyType
+internal_logregr_irls_grouped_num_active::run(AnyType &args) {
+    LogRegrIRLSGroupedState state = args[0];
+
+    return static_cast<int64_t>(state.numActiveGroups);
+}
+
+/**
+ * @brief Cross-call context of internal_logregr_irls_grouped_result
+ */
+struct LogRegrIRLSGroupedResultContext {
+    LogRegrIRLSGroupedResultContext(const AnyType &inState)
+      : state(inState), nextGroup(0) { }
+
+    LogRegrIRLSGroupedState state;
+    uint64_t nextGroup;
+};
+
+/**
+ * @brief Initialize the iteration over all groups of the state
+ */
+void *
+internal_logregr_irls_grouped_result::SRF_init(AnyType &args) {
+    // This is called in the multi-call memory context, so the context lives
+    // until the last call
+    return new LogRegrIRLSGroupedResultContext(args[0]);
+}
+
+/**
+ * @brief Return the coefficients and diagnostic statistics of the next group
+ */
+AnyType
+internal_logregr_irls_grouped_result::SRF_next(void *user_fctx,
+    bool *is_last_call) {
+
+    LogRegrIRLSGroupedResultContext *context
+        = static_cast<LogRegrIRLSGroupedResultContext*>(user_fctx);
+
+    if (context->nextGroup >= context->state.numGroups) {
+        *is_last_call = true;
+        return Null();
+    }
+
+    LogRegrIRLSGroup<ArrayHandle<double> > group;
+    context->state.group(context->nextGroup++, group);
+    *is_last_call = false;
+
+    AnyType result = stateToResult(*this, group.coef, group.X_transp_Az,
+        group.logLikelihood, group.conditionNo);
+
+    AnyType tuple;
+    tuple << static_cast<int64_t>(group.key);
+    for (uint16_t i = 0; i < result.numFields(); ++i)
+        tuple << result[i];
+    tuple << static_cast<int32_t>(group.numIterations);
+    return tuple;
+}
+
 /**
  * @brief Inter- and intra-iteration state for incremental gradient
  *        method for logistic regression
@@ -625,10 +1084,10 @@ internal_logregr_irls_result::run(AnyType &args) {
  * TransitionState encapsualtes the transition state during the
  * logistic-regression aggregate function. To the database, the state is
  * exposed as a single DOUBLE PRECISION array, to the C++ code it is a proper
- * object containing scalars, a vector, and a matrix.
+ * object containing scalars and vectors.
  *
  * Note: We assume that the DOUBLE PRECISION array is initialized by the
- * database with length at least 4, and all elemenets are 0.
+ * database with length at least 7, and all elemenets are 0.
  */
 template <class Handle>
 class LogRegrIGDTransitionState {
@@ -639,7 +1098,8 @@ public:
     LogRegrIGDTransitionState(const AnyType &inArray)
         : mStorage(inArray.getAs<Handle>()) {
 
-        rebind(static_cast<uint16_t>(mStorage[0]));
+        rebind(static_cast<uint16_t>(mStorage[0]),
+            static_cast<StepSizePolicy>(static_cast<int>(mStorage[2])));
     }
 
     /**
@@ -653,15 +1113,18 @@ public:
     }
 
     /**
-     * @brief Initialize the conjugate-gradient state.
+     * @brief Initialize the incremental-gradient state.
      *
      * This function is only called for the first iteration, for the first row.
      */
-    inline void initialize(const Allocator &inAllocator, uint16_t inWidthOfX) {
+    inline void initialize(const Allocator &inAllocator, uint16_t inWidthOfX,
+        StepSizePolicy inPolicy) {
+
         mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
-            dbal::DoZero, dbal::ThrowBadAlloc>(arraySize(inWidthOfX));
-        rebind(inWidthOfX);
+            dbal::DoZero, dbal::ThrowBadAlloc>(arraySize(inWidthOfX, inPolicy));
+        rebind(inWidthOfX, inPolicy);
         widthOfX = inWidthOfX;
+        stepsizePolicy = static_cast<uint16_t>(inPolicy);
     }
 
     /**
@@ -685,7 +1148,8 @@ public:
         const LogRegrIGDTransitionState<OtherHandle> &inOtherState) {
 
         if (mStorage.size() != inOtherState.mStorage.size() ||
-            widthOfX != inOtherState.widthOfX)
+            widthOfX != inOtherState.widthOfX ||
+            stepsizePolicy != inOtherState.stepsizePolicy)
             throw std::logic_error("Internal error: Incompatible transition "
                 "states");
 
@@ -700,50 +1164,106 @@ public:
 		coef = double(numRows) / totalNumRows * coef
 			+ double(inOtherState.numRows) / totalNumRows * inOtherState.coef;
 
+        // Both the squared gradients (AdaGrad) and the iterates (averaging)
+        // of this iteration are simply summed up
+        incrAccumulator += inOtherState.incrAccumulator;
+
         numRows += inOtherState.numRows;
-        X_transp_AX += inOtherState.X_transp_AX;
         logLikelihood += inOtherState.logLikelihood;
         return *this;
     }
 
     /**
-     * @brief Reset the inter-iteration fields.
+     * @brief Reset the intra-iteration fields.
      */
     inline void reset() {
-		// FIXME: HAYING: stepsize if hard-coded here now
-        stepsize = .1;
         numRows = 0;
-        X_transp_AX.fill(0);
         logLikelihood = 0;
+        incrAccumulator.setZero();
+    }
+
+    /**
+     * @brief Fold the intra-iteration accumulator into the inter-iteration
+     *     fields at the end of an iteration
+     */
+    inline void finishIteration() {
+        if (stepsizePolicy == kAdaGradStepSize) {
+            accumulator += incrAccumulator;
+            incrAccumulator.setZero();
+        } else if (stepsizePolicy == kAveragingStepSize) {
+            foldAverage(accumulator, incrAccumulator, numUpdates, numRows);
+        }
+        numUpdates += numRows;
+        numPasses++;
+    }
+
+    /**
+     * @brief The model of this state
+     *
+     * This is the vector of coefficients, except for Polyak-Ruppert averaging
+     * where it is the average of all iterates.
+     */
+    inline const typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap&
+    model() const {
+        return stepsizePolicy == kAveragingStepSize ? accumulator : coef;
     }
 
 private:
-    static inline uint32_t arraySize(const uint16_t inWidthOfX) {
-        return 4 + inWidthOfX * inWidthOfX + inWidthOfX;
+    static inline uint32_t arraySize(const uint16_t inWidthOfX,
+        const StepSizePolicy inPolicy) {
+
+        return 7 + inWidthOfX + 2 * accumulatorSize(inWidthOfX, inPolicy);
+    }
+
+    static inline uint16_t accumulatorSize(const uint16_t inWidthOfX,
+        const StepSizePolicy inPolicy) {
+
+        return hasAccumulator(inPolicy) ? inWidthOfX : 0;
     }
+
     /**
      * @brief Rebind to a new storage array
      *
      * @param inWidthOfX The number of independent variables.
+     * @param inPolicy The step-size policy
      *
      * Array layout (iteration refers to one aggregate-function call):
      * Inter-iteration components (updated in final function):
      * - 0: widthOfX (number of coefficients)
-     * - 1: stepsize (step size of gradient steps)
-     * - 2: coef (vector of coefficients)
+     * - 1: stepsize (initial step size of gradient steps)
+     * - 2: stepsizePolicy (see StepSizePolicy)
+     * - 3: numPasses (number of completed iterations)
+     * - 4: numUpdates (number of rows processed in completed iterations)
+     * - 5: coef (vector of coefficients)
+     * - 5 + widthOfX: accumulator (AdaGrad: sums of squared gradients,
+     *   averaging: average of all iterates; empty for other policies)
      *
      * Intra-iteration components (updated in transition step):
-     * - 2 + widthOfX: numRows (number of rows already processed in this iteration)
-     * - 3 + widthOfX: X_transp_AX (X^T A X)
-     * - 3 + widthOfX * widthOfX + widthOfX: logLikelihood ( ln(l(c)) )
+     *   accumulatorSize = widthOfX for AdaGrad and averaging, 0 otherwise
+     * - 5 + widthOfX + accumulatorSize: numRows (number of rows already
+     *   processed in this iteration)
+     * - 6 + widthOfX + accumulatorSize: logLikelihood ( ln(l(c)) )
+     * - 7 + widthOfX + accumulatorSize: incrAccumulator (AdaGrad: sums of
+     *   squared gradients, averaging: sum of iterates, both only of this
+     *   iteration)
+     *
+     * The state is linear in the number of independent variables. The
+     * Hessian \f$ X^T A X \f$ (which is only needed for the diagnostic
+     * statistics) is computed by LogRegrIGDHessianState in a separate pass.
      */
-    void rebind(uint16_t inWidthOfX) {
+    void rebind(uint16_t inWidthOfX, StepSizePolicy inPolicy) {
+        uint16_t accSize = accumulatorSize(inWidthOfX, inPolicy);
+
         widthOfX.rebind(&mStorage[0]);
         stepsize.rebind(&mStorage[1]);
-        coef.rebind(&mStorage[2], inWidthOfX);
-        numRows.rebind(&mStorage[2 + inWidthOfX]);
-        X_transp_AX.rebind(&mStorage[3 + inWidthOfX], inWidthOfX, inWidthOfX);
-        logLikelihood.rebind(&mStorage[3 + inWidthOfX * inWidthOfX + inWidthOfX]);
+        stepsizePolicy.rebind(&mStorage[2]);
+        numPasses.rebind(&mStorage[3]);
+        numUpdates.rebind(&mStorage[4]);
+        coef.rebind(&mStorage[5], inWidthOfX);
+        accumulator.rebind(&mStorage[5 + inWidthOfX], accSize);
+        numRows.rebind(&mStorage[5 + inWidthOfX + accSize]);
+        logLikelihood.rebind(&mStorage[6 + inWidthOfX + accSize]);
+        incrAccumulator.rebind(&mStorage[7 + inWidthOfX + accSize], accSize);
     }
 
     Handle mStorage;
@@ -751,58 +1271,209 @@ private:
 public:
     typename HandleTraits<Handle>::ReferenceToUInt16 widthOfX;
     typename HandleTraits<Handle>::ReferenceToDouble stepsize;
+    typename HandleTraits<Handle>::ReferenceToUInt16 stepsizePolicy;
+    typename HandleTraits<Handle>::ReferenceToUInt64 numPasses;
+    typename HandleTraits<Handle>::ReferenceToUInt64 numUpdates;
     typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap coef;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap accumulator;
 
     typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
-	typename HandleTraits<Handle>::MatrixTransparentHandleMap X_transp_AX;
     typename HandleTraits<Handle>::ReferenceToDouble logLikelihood;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap
+        incrAccumulator;
 };
 
-AnyType
-logregr_igd_step_transition::run(AnyType &args) {
-    LogRegrIGDTransitionState<MutableArrayHandle<double> > state = args[0];
-    double y = args[1].getAs<bool>() ? 1. : -1.;
-    MappedColumnVector x = args[2].getAs<MappedColumnVector>();
-
-    // The following check was added with MADLIB-138.
-    if (!x.is_finite())
-        throw std::domain_error("Design matrix is not finite.");
-
-	// We only know the number of independent variables after seeing the first
-    // row.
-    if (state.numRows == 0) {
-        if (x.size() > std::numeric_limits<uint16_t>::max())
-            throw std::domain_error("Number of independent variables cannot be "
-                "larger than 65535.");
-
-        state.initialize(*this, static_cast<uint16_t>(x.size()));
+/**
+ * @brief State for computing the Hessian of the log-likelihood for the
+ *     coefficients found by the incremental gradient method or by L-BFGS
+ *
+ * This is the state of an aggregate that is run once after the incremental
+ * gradient method or L-BFGS has converged. To the database, the state is
+ * exposed as a single DOUBLE PRECISION array.
+ *
+ * Note: We assume that the DOUBLE PRECISION array is initialized by the
+ * database with length at least 2, and all elemenets are 0.
+ */
+template <class Handle>
+class LogRegrIGDHessianState {
+    template <class OtherHandle>
+    friend class LogRegrIGDHessianState;
 
-		// For the first iteration, the previous state is NULL
-        if (!args[3].isNull()) {
-			LogRegrIGDTransitionState<ArrayHandle<double> > previousState = args[3];
+public:
+    LogRegrIGDHessianState(const AnyType &inArray)
+        : mStorage(inArray.getAs<Handle>()) {
 
-            state = previousState;
-            state.reset();
-        }
+        rebind(static_cast<uint16_t>(mStorage[0]));
     }
 
-    // Now do the transition step
-    state.numRows++;
-
-    // xc = x^T_i c
-    double xc = dot(x, state.coef);
-    double scale = state.stepsize * sigma(-xc * y) * y;
-	state.coef += scale * x;
-
-    // Note: previous coefficients are used for Hessian and log likelihood
-	if (!args[3].isNull()) {
-		LogRegrIGDTransitionState<ArrayHandle<double> > previousState = args[3];
+    /**
+     * @brief Convert to backend representation
+     *
+     * We define this function so that we can use State in the
+     * argument list and as a return type.
+     */
+    inline operator AnyType() const {
+        return mStorage;
+    }
 
-		double previous_xc = dot(x, previousState.coef);
+    /**
+     * @brief Initialize the state.
+     *
+     * This function is only called for the first row.
+     */
+    inline void initialize(const Allocator &inAllocator, uint16_t inWidthOfX) {
+        mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
+            dbal::DoZero, dbal::ThrowBadAlloc>(arraySize(inWidthOfX));
+        rebind(inWidthOfX);
+        widthOfX = inWidthOfX;
+    }
+
+    /**
+     * @brief Merge with another State object
+     */
+    template <class OtherHandle>
+    LogRegrIGDHessianState &operator+=(
+        const LogRegrIGDHessianState<OtherHandle> &inOtherState) {
+
+        if (mStorage.size() != inOtherState.mStorage.size() ||
+            widthOfX != inOtherState.widthOfX)
+            throw std::logic_error("Internal error: Incompatible transition "
+                "states");
+
+        numRows += inOtherState.numRows;
+        X_transp_AX += inOtherState.X_transp_AX;
+        return *this;
+    }
+
+    /**
+     * @brief Add the contribution of one row to the (lower triangle of the)
+     *     Hessian
+     *
+     * @param inX The independent variables of the row
+     * @param inCoef The coefficients at which the Hessian is computed
+     */
+    template <class Vector>
+    inline void update(const MappedColumnVector &inX, const Vector &inCoef) {
+        if (inX.size() != widthOfX)
+            throw std::runtime_error("Inconsistent numbers of independent "
+                "variables.");
+
+        numRows++;
+
+        double xc = dot(inX, inCoef);
 
         // a_i = sigma(x_i c) sigma(-x_i c)
-		double a = sigma(previous_xc) * sigma(-previous_xc);
-		triangularView<Lower>(state.X_transp_AX) += x * trans(x) * a;
+        double a = sigma(xc) * sigma(-xc);
+        triangularView<Lower>(X_transp_AX) += inX * trans(inX) * a;
+    }
+
+private:
+    static inline uint32_t arraySize(const uint16_t inWidthOfX) {
+        return 2 + inWidthOfX * inWidthOfX;
+    }
+
+    /**
+     * @brief Rebind to a new storage array
+     *
+     * @param inWidthOfX The number of independent variables.
+     *
+     * Array layout:
+     * - 0: widthOfX (number of coefficients)
+     * - 1: numRows (number of rows already processed)
+     * - 2: X_transp_AX (X^T A X)
+     */
+    void rebind(uint16_t inWidthOfX) {
+        widthOfX.rebind(&mStorage[0]);
+        numRows.rebind(&mStorage[1]);
+        X_transp_AX.rebind(&mStorage[2], inWidthOfX, inWidthOfX);
+    }
+
+    Handle mStorage;
+
+public:
+    typename HandleTraits<Handle>::ReferenceToUInt16 widthOfX;
+    typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
+    typename HandleTraits<Handle>::MatrixTransparentHandleMap X_transp_AX;
+};
+
+/**
+ * @brief Perform the incremental-gradient transition step
+ *
+ * Arguments:
+ * - 0: state
+ * - 1: y (dependent variable)
+ * - 2: x (independent variables)
+ * - 3: previous_state (NULL in the first iteration)
+ * - 4: stepsize_policy (see StepSizePolicy; only used in the first iteration)
+ * - 5: stepsize (initial step size; only used in the first iteration)
+ */
+AnyType
+logregr_igd_step_transition::run(AnyType &args) {
+    LogRegrIGDTransitionState<MutableArrayHandle<double> > state = args[0];
+    double y = args[1].getAs<bool>() ? 1. : -1.;
+    MappedColumnVector x = args[2].getAs<MappedColumnVector>();
+
+    // The following check was added with MADLIB-138.
+    if (!x.is_finite())
+        throw std::domain_error("Design matrix is not finite.");
+
+	// We only know the number of independent variables after seeing the first
+    // row.
+    if (state.numRows == 0) {
+        if (x.size() > std::numeric_limits<uint16_t>::max())
+            throw std::domain_error("Number of independent variables cannot be "
+                "larger than 65535.");
+
+		// For the first iteration, the previous state is NULL
+        if (!args[3].isNull()) {
+			LogRegrIGDTransitionState<ArrayHandle<double> > previousState = args[3];
+            if (previousState.widthOfX != x.size())
+                throw std::runtime_error("Inconsistent numbers of independent "
+                    "variables.");
+
+            state.initialize(*this, previousState.widthOfX,
+                static_cast<StepSizePolicy>(
+                    static_cast<uint16_t>(previousState.stepsizePolicy)));
+            state = previousState;
+            state.reset();
+        } else {
+            StepSizePolicy policy
+                = stepSizePolicyFromString(args[4].getAs<char*>());
+            double stepsize = args[5].getAs<double>();
+            if (stepsize <= 0.)
+                throw std::runtime_error("Invalid parameter: stepsize <= 0.0");
+
+            state.initialize(*this, static_cast<uint16_t>(x.size()), policy);
+            state.stepsize = stepsize;
+        }
+    }
+
+    // Now do the transition step
+    state.numRows++;
+
+    // xc = x^T_i c
+    double xc = dot(x, state.coef);
+    // The gradient of l_i(c) is g * x_i
+    double g = sigma(-xc * y) * y;
+    StepSizePolicy policy = static_cast<StepSizePolicy>(
+        static_cast<uint16_t>(state.stepsizePolicy));
+    if (policy == kAdaGradStepSize) {
+        state.incrAccumulator.array() += (g * x).array().square();
+        state.coef.array() += state.stepsize * g * x.array()
+            / ((state.accumulator + state.incrAccumulator).array().sqrt()
+                + kAdaGradEpsilon);
+    } else {
+        state.coef += scheduledStepSize(policy, state.stepsize,
+            state.numPasses) * g * x;
+        if (policy == kAveragingStepSize)
+            state.incrAccumulator += state.coef;
+    }
+
+    // Note: previous coefficients are used for the log likelihood
+	if (!args[3].isNull()) {
+		LogRegrIGDTransitionState<ArrayHandle<double> > previousState = args[3];
+
+		double previous_xc = dot(x, previousState.model());
 
 		// l_i(c) = - ln(1 + exp(-y_i * c^T x_i))
 		state.logLikelihood -= std::log( 1. + std::exp(-y * previous_xc) );
@@ -834,12 +1505,15 @@ logregr_igd_step_merge_states::run(AnyType &args) {
 /**
  * @brief Perform the logistic-regression final step
  *
- * All that we do here is to test whether we have seen any data. If not, we
- * return NULL. Otherwise, we return the transition state unaltered.
+ * We test whether we have seen any data. If not, we return NULL. Otherwise, we
+ * fold the step-size accumulators of this iteration into the inter-iteration
+ * fields.
  */
 AnyType
 logregr_igd_step_final::run(AnyType &args) {
-    LogRegrIRLSTransitionState<ArrayHandle<double> > state = args[0];
+    // We request a mutable object. Depending on the backend, this might perform
+    // a deep copy.
+    LogRegrIGDTransitionState<MutableArrayHandle<double> > state = args[0];
 
     if(!state.coef.is_finite())
         throw NoSolutionFoundException("Over- or underflow in "
@@ -850,6 +1524,7 @@ logregr_igd_step_final::run(AnyType &args) {
     if (state.numRows == 0)
         return Null();
 
+    state.finishIteration();
     return state;
 }
 
@@ -864,15 +1539,423 @@ internal_logregr_igd_step_distance::run(AnyType &args) {
     return std::abs(stateLeft.logLikelihood - stateRight.logLikelihood);
 }
 
+/**
+ * @brief Accumulate the Hessian for the coefficients of the incremental
+ *     gradient method
+ *
+ * Arguments:
+ * - 0: state (LogRegrIGDHessianState)
+ * - 1: x (independent variables)
+ * - 2: igd_state (the final state of the incremental gradient method)
+ */
+AnyType
+logregr_igd_hessian_transition::run(AnyType &args) {
+    LogRegrIGDHessianState<MutableArrayHandle<double> > state = args[0];
+    MappedColumnVector x = args[1].getAs<MappedColumnVector>();
+    LogRegrIGDTransitionState<ArrayHandle<double> > igdState = args[2];
+
+    if (!x.is_finite())
+        throw std::domain_error("Design matrix is not finite.");
+
+    if (state.numRows == 0)
+        state.initialize(*this, igdState.widthOfX);
+
+    state.update(x, igdState.model());
+    return state;
+}
+
+/**
+ * @brief Merge Hessian states
+ */
+AnyType
+logregr_igd_hessian_merge_states::run(AnyType &args) {
+    LogRegrIGDHessianState<MutableArrayHandle<double> > stateLeft = args[0];
+    LogRegrIGDHessianState<ArrayHandle<double> > stateRight = args[1];
+
+    if (stateLeft.numRows == 0)
+        return stateRight;
+    else if (stateRight.numRows == 0)
+        return stateLeft;
+
+    stateLeft += stateRight;
+    return stateLeft;
+}
+
 /**
  * @brief Return the coefficients and diagnostic statistics of the state
+ *
+ * Arguments:
+ * - 0: state (final state of the incremental gradient method)
+ * - 1: hessian_state (result of logregr_igd_hessian() for these
+ *   coefficients). If NULL, only the coefficients and the log-likelihood are
+ *   returned.
  */
 AnyType
 internal_logregr_igd_result::run(AnyType &args) {
+    if (args[0].isNull())
+        return Null();
+
     LogRegrIGDTransitionState<ArrayHandle<double> > state = args[0];
 
+    if (args[1].isNull()) {
+        AnyType tuple;
+        tuple << state.model() << static_cast<double>(state.logLikelihood)
+            << Null() << Null() << Null() << Null() << Null();
+        return tuple;
+    }
+
+    LogRegrIGDHessianState<ArrayHandle<double> > hessianState = args[1];
+    if (hessianState.widthOfX != state.widthOfX)
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+
     SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
-        state.X_transp_AX, EigenvaluesOnly, ComputePseudoInverse);
+        hessianState.X_transp_AX, EigenvaluesOnly, ComputePseudoInverse);
+
+    return stateToResult(*this, state.model(),
+        decomposition.pseudoInverse().diagonal(), state.logLikelihood,
+        decomposition.conditionNo());
+}
+
+/**
+ * @brief Inter- and intra-iteration state for the limited-memory BFGS method
+ *        for logistic regression
+ *
+ * Each iteration (aggregate-function call) evaluates the log-likelihood and its
+ * gradient at the current coefficients. The final function then lets L-BFGS
+ * (see LBFGS) choose the coefficients of the next iteration, which is either a
+ * trial point of the line search or the start of a new quasi-Newton step. In
+ * contrast to IRLS, the state is linear in the number of independent
+ * variables.
+ *
+ * Note: We assume that the DOUBLE PRECISION array is initialized by the
+ * database with length at least 64, and all elemenets are 0.
+ */
+template <class Handle>
+class LogRegrLBFGSTransitionState {
+    template <class OtherHandle>
+    friend class LogRegrLBFGSTransitionState;
+
+public:
+    LogRegrLBFGSTransitionState(const AnyType &inArray)
+        : mStorage(inArray.getAs<Handle>()) {
+
+        rebind(static_cast<uint16_t>(mStorage[1]));
+    }
+
+    /**
+     * @brief Convert to backend representation
+     *
+     * We define this function so that we can use State in the
+     * argument list and as a return type.
+     */
+    inline operator AnyType() const {
+        return mStorage;
+    }
+
+    /**
+     * @brief Initialize the L-BFGS state.
+     *
+     * This function is only called for the first row of each iteration.
+     */
+    inline void initialize(const Allocator &inAllocator, uint16_t inWidthOfX) {
+        mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
+            dbal::DoZero, dbal::ThrowBadAlloc>(arraySize(inWidthOfX));
+        rebind(inWidthOfX);
+        widthOfX = inWidthOfX;
+        diag.fill(1);
+    }
+
+    /**
+     * @brief We need to support assigning the previous state
+     */
+    template <class OtherHandle>
+    LogRegrLBFGSTransitionState &operator=(
+        const LogRegrLBFGSTransitionState<OtherHandle> &inOtherState) {
+
+        for (size_t i = 0; i < mStorage.size(); i++)
+            mStorage[i] = inOtherState.mStorage[i];
+        return *this;
+    }
+
+    /**
+     * @brief Merge with another State object by copying the intra-iteration
+     *     fields
+     */
+    template <class OtherHandle>
+    LogRegrLBFGSTransitionState &operator+=(
+        const LogRegrLBFGSTransitionState<OtherHandle> &inOtherState) {
+
+        if (mStorage.size() != inOtherState.mStorage.size() ||
+            widthOfX != inOtherState.widthOfX)
+            throw std::logic_error("Internal error: Incompatible transition "
+                "states");
+
+        numRows += inOtherState.numRows;
+        logLikelihood += inOtherState.logLikelihood;
+        gradient += inOtherState.gradient;
+        return *this;
+    }
+
+    /**
+     * @brief Reset the intra-iteration fields.
+     */
+    inline void reset() {
+        numRows = 0;
+        logLikelihood = 0;
+        gradient.fill(0);
+    }
+
+    static const int m = 7; // The number of corrections used in the L-BFGS update
+
+private:
+    static inline uint32_t arraySize(const uint16_t inWidthOfX) {
+        return 50 + 3 * inWidthOfX + LBFGS::workspaceSize(inWidthOfX, m);
+    }
+
+    /**
+     * @brief Rebind to a new storage array
+     *
+     * @param inWidthOfX The number of independent variables.
+     *
+     * Array layout (iteration refers to one aggregate-function call):
+     * Inter-iteration components (updated in final function):
+     *   w = LBFGS::workspaceSize(widthOfX, m)
+     * - 0: iteration (number of completed iterations)
+     * - 1: widthOfX (number of coefficients)
+     * - 2: coef (vector of coefficients, the point of the next evaluation)
+     * - 2 + widthOfX: diag (diagonal of the inverse Hessian approximation)
+     * - 2 + 2 * widthOfX: ws (work space of L-BFGS)
+     * - 2 + 2 * widthOfX + w: lbfgs_state (scalars of L-BFGS)
+     * - 23 + 2 * widthOfX + w: mcsrch_state (scalars of the line search)
+     *
+     * Intra-iteration components (updated in transition step):
+     * - 48 + 2 * widthOfX + w: numRows (number of rows already processed in
+     *   this iteration)
+     * - 49 + 2 * widthOfX + w: logLikelihood ( ln(l(c)) )
+     * - 50 + 2 * widthOfX + w: gradient (gradient of the log-likelihood)
+     */
+    void rebind(uint16_t inWidthOfX) {
+        uint32_t w = LBFGS::workspaceSize(inWidthOfX, m);
+
+        iteration.rebind(&mStorage[0]);
+        widthOfX.rebind(&mStorage[1]);
+        coef.rebind(&mStorage[2], inWidthOfX);
+        diag.rebind(&mStorage[2 + inWidthOfX], inWidthOfX);
+        ws.rebind(&mStorage[2 + 2 * inWidthOfX], w);
+        lbfgs_state.rebind(&mStorage[2 + 2 * inWidthOfX + w],
+            LBFGS::kLBFGSStateSize);
+        mcsrch_state.rebind(&mStorage[23 + 2 * inWidthOfX + w],
+            LBFGS::kLineSearchStateSize);
+        numRows.rebind(&mStorage[48 + 2 * inWidthOfX + w]);
+        logLikelihood.rebind(&mStorage[49 + 2 * inWidthOfX + w]);
+        gradient.rebind(&mStorage[50 + 2 * inWidthOfX + w], inWidthOfX);
+    }
+
+    Handle mStorage;
+
+public:
+    typename HandleTraits<Handle>::ReferenceToUInt32 iteration;
+    typename HandleTraits<Handle>::ReferenceToUInt16 widthOfX;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap coef;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap diag;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap ws;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap lbfgs_state;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap mcsrch_state;
+
+    typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
+    typename HandleTraits<Handle>::ReferenceToDouble logLikelihood;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap gradient;
+};
+
+/**
+ * @brief Perform the L-BFGS transition step
+ *
+ * Only the log-likelihood and its gradient are accumulated, which takes
+ * O(widthOfX) time and space per row.
+ */
+AnyType
+logregr_lbfgs_step_transition::run(AnyType &args) {
+    LogRegrLBFGSTransitionState<MutableArrayHandle<double> > state = args[0];
+    double y = args[1].getAs<bool>() ? 1. : -1.;
+    MappedColumnVector x = args[2].getAs<MappedColumnVector>();
+
+    // The following check was added with MADLIB-138.
+    if (!x.is_finite())
+        throw std::domain_error("Design matrix is not finite.");
+
+    // We only know the number of independent variables after seeing the first
+    // row.
+    if (state.numRows == 0) {
+        if (x.size() > std::numeric_limits<uint16_t>::max())
+            throw std::domain_error("Number of independent variables cannot be "
+                "larger than 65535.");
+
+        state.initialize(*this, static_cast<uint16_t>(x.size()));
+
+        // For the first iteration, the previous state is NULL
+        if (!args[3].isNull()) {
+            LogRegrLBFGSTransitionState<ArrayHandle<double> > previousState
+                = args[3];
+            if (previousState.widthOfX != x.size())
+                throw std::runtime_error("Inconsistent numbers of independent "
+                    "variables.");
+
+            state = previousState;
+            state.reset();
+        }
+    }
+
+    // Now do the transition step
+    state.numRows++;
+
+    // xc = x^T_i c
+    double xc = dot(x, state.coef);
+
+    // The gradient of l_i(c) is sigma(-y_i c^T x_i) y_i x_i
+    state.gradient.noalias() += sigma(-y * xc) * y * x;
+
+    // l_i(c) = - ln(1 + exp(-y_i * c^T x_i))
+    state.logLikelihood -= std::log(1. + std::exp(-y * xc));
+
+    return state;
+}
+
+/**
+ * @brief Perform the perliminary aggregation function: Merge transition states
+ */
+AnyType
+logregr_lbfgs_step_merge_states::run(AnyType &args) {
+    LogRegrLBFGSTransitionState<MutableArrayHandle<double> > stateLeft = args[0];
+    LogRegrLBFGSTransitionState<ArrayHandle<double> > stateRight = args[1];
+
+    // We first handle the trivial case where this function is called with one
+    // of the states being the initial state
+    if (stateLeft.numRows == 0)
+        return stateRight;
+    else if (stateRight.numRows == 0)
+        return stateLeft;
+
+    // Merge states together and return
+    stateLeft += stateRight;
+    return stateLeft;
+}
+
+/**
+ * @brief Perform the logistic-regression final step
+ *
+ * L-BFGS minimizes, so we pass the negative log-likelihood and gradient. Once
+ * L-BFGS has converged, the state is returned unchanged (its coefficients are
+ * those of the last evaluation), so that further iterations do not restart
+ * the method.
+ */
+AnyType
+logregr_lbfgs_step_final::run(AnyType &args) {
+    // We request a mutable object. Depending on the backend, this might perform
+    // a deep copy.
+    LogRegrLBFGSTransitionState<MutableArrayHandle<double> > state = args[0];
+
+    // Aggregates that haven't seen any data just return Null.
+    if (state.numRows == 0)
+        return Null();
+
+    if (!state.gradient.is_finite())
+        throw NoSolutionFoundException("Over- or underflow in intermediate "
+            "calulation. Input data is likely of poor numerical condition.");
+
+    if (state.iteration > 0 && LBFGS::converged(state.lbfgs_state))
+        return state;
+
+    double eps = 0.001; // accuracy of the solution to be found
+    double xtol = 1.0e-16; // an estimate of the machine precision
+
+    LBFGS instance(state);
+    instance.lbfgs(state.widthOfX, state.m, -state.logLikelihood,
+        -state.gradient, eps, xtol);
+    instance.save_state(state);
+    instance.check_status();
+
+    if (!state.coef.is_finite())
+        throw NoSolutionFoundException("Over- or underflow in L-BFGS step, "
+            "while updating coefficients. Input data is likely of poor "
+            "numerical condition.");
+
+    state.iteration++;
+    return state;
+}
+
+/**
+ * @brief Return the distance between two states
+ *
+ * Within a line search, the log-likelihood of consecutive trial points can be
+ * arbitrarily close, so the difference in log-likelihood is not a useful
+ * convergence criterion. We therefore return 0 once L-BFGS has converged
+ * (relative norm of the gradient below 0.001), and infinity otherwise.
+ */
+AnyType
+internal_logregr_lbfgs_step_distance::run(AnyType &args) {
+    LogRegrLBFGSTransitionState<ArrayHandle<double> > state = args[0];
+
+    if (state.iteration > 0 && LBFGS::converged(state.lbfgs_state))
+        return 0.;
+
+    return std::numeric_limits<double>::infinity();
+}
+
+/**
+ * @brief Accumulate the Hessian for the coefficients of L-BFGS
+ *
+ * Arguments:
+ * - 0: state (LogRegrIGDHessianState)
+ * - 1: x (independent variables)
+ * - 2: lbfgs_state (the final state of L-BFGS)
+ */
+AnyType
+logregr_lbfgs_hessian_transition::run(AnyType &args) {
+    LogRegrIGDHessianState<MutableArrayHandle<double> > state = args[0];
+    MappedColumnVector x = args[1].getAs<MappedColumnVector>();
+    LogRegrLBFGSTransitionState<ArrayHandle<double> > lbfgsState = args[2];
+
+    if (!x.is_finite())
+        throw std::domain_error("Design matrix is not finite.");
+
+    if (state.numRows == 0)
+        state.initialize(*this, lbfgsState.widthOfX);
+
+    state.update(x, lbfgsState.coef);
+    return state;
+}
+
+/**
+ * @brief Return the coefficients and diagnostic statistics of the state
+ *
+ * Arguments:
+ * - 0: state (final state of L-BFGS)
+ * - 1: hessian_state (result of logregr_lbfgs_hessian() for these
+ *   coefficients). If NULL, only the coefficients and the log-likelihood are
+ *   returned.
+ */
+AnyType
+internal_logregr_lbfgs_result::run(AnyType &args) {
+    if (args[0].isNull())
+        return Null();
+
+    LogRegrLBFGSTransitionState<ArrayHandle<double> > state = args[0];
+
+    if (args[1].isNull()) {
+        AnyType tuple;
+        tuple << state.coef << static_cast<double>(state.logLikelihood)
+            << Null() << Null() << Null() << Null() << Null();
+        return tuple;
+    }
+
+    LogRegrIGDHessianState<ArrayHandle<double> > hessianState = args[1];
+    if (hessianState.widthOfX != state.widthOfX)
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+
+    SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
+        hessianState.X_transp_AX, EigenvaluesOnly, ComputePseudoInverse);
 
     return stateToResult(*this, state.coef,
         decomposition.pseudoInverse().diagonal(), state.logLikelihood,
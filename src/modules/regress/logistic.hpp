@@ -38,6 +38,15 @@ DECLARE_UDF(regress, internal_logregr_cg_result)
  */
 DECLARE_UDF(regress, logregr_irls_step_transition)
 
+/**
+ * @brief Logistic regression (blocked iteratively-reweighted-lest-squares
+ *     step): Transition function
+ *
+ * The merge, final, distance, and result functions are shared with the
+ * unblocked variant.
+ */
+DECLARE_UDF(regress, logregr_irls_blocked_step_transition)
+
 /**
  * @brief Logistic regression (iteratively-reweighted-lest-squares step):
  *     State merge function
@@ -85,7 +94,83 @@ DECLARE_UDF(regress, logregr_igd_step_final)
 DECLARE_UDF(regress, internal_logregr_igd_step_distance)
 
 /**
- * @brief Logistic regression (iteratively-reweighted-lest-squares step):
- *     Convert transition state to result tuple
+ * @brief Logistic regression (incremetal-gradient): Hessian for the final
+ *     coefficients, transition function
+ */
+DECLARE_UDF(regress, logregr_igd_hessian_transition)
+
+/**
+ * @brief Logistic regression (incremetal-gradient): Hessian for the final
+ *     coefficients, state merge function
+ */
+DECLARE_UDF(regress, logregr_igd_hessian_merge_states)
+
+/**
+ * @brief Logistic regression (incremetal-gradient): Convert transition state
+ *     (and Hessian state) to result tuple
  */
 DECLARE_UDF(regress, internal_logregr_igd_result)
+
+
+/**
+ * @brief Logistic regression (L-BFGS step): Transition function
+ */
+DECLARE_UDF(regress, logregr_lbfgs_step_transition)
+
+/**
+ * @brief Logistic regression (L-BFGS step): State merge function
+ */
+DECLARE_UDF(regress, logregr_lbfgs_step_merge_states)
+
+/**
+ * @brief Logistic regression (L-BFGS step): Final function
+ */
+DECLARE_UDF(regress, logregr_lbfgs_step_final)
+
+/**
+ * @brief Logistic regression (L-BFGS step): Difference in log-likelihood
+ *     between two transition states
+ */
+DECLARE_UDF(regress, internal_logregr_lbfgs_step_distance)
+
+/**
+ * @brief Logistic regression (L-BFGS): Hessian for the final coefficients,
+ *     transition function
+ */
+DECLARE_UDF(regress, logregr_lbfgs_hessian_transition)
+
+/**
+ * @brief Logistic regression (L-BFGS): Convert transition state (and Hessian
+ *     state) to result tuple
+ */
+DECLARE_UDF(regress, internal_logregr_lbfgs_result)
+
+/**
+ * @brief Logistic regression (grouped iteratively-reweighted-lest-squares
+ *     step): Transition function
+ */
+DECLARE_UDF(regress, logregr_irls_grouped_step_transition)
+
+/**
+ * @brief Logistic regression (grouped iteratively-reweighted-lest-squares
+ *     step): State merge function
+ */
+DECLARE_UDF(regress, logregr_irls_grouped_step_merge_states)
+
+/**
+ * @brief Logistic regression (grouped iteratively-reweighted-lest-squares
+ *     step): Final function
+ */
+DECLARE_UDF(regress, logregr_irls_grouped_step_final)
+
+/**
+ * @brief Logistic regression (grouped iteratively-reweighted-lest-squares
+ *     step): Number of groups that have not converged yet
+ */
+DECLARE_UDF(regress, internal_logregr_irls_grouped_num_active)
+
+/**
+ * @brief Logistic regression (grouped iteratively-reweighted-lest-squares
+ *     step): Return one result row per group
+ */
+DECLARE_SR_UDF(regress, internal_logregr_irls_grouped_result)
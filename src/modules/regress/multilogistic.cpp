@@ -4,13 +4,16 @@
  *
  * @brief Multinomial Logistic-Regression functions
  *
- * We implement the iteratively-reweighted-least-squares method.
+ * We implement the iteratively-reweighted-least-squares method (with the full
+ * Hessian or with a block-diagonal approximation) and the limited-memory BFGS
+ * method.
  *
  *//* ----------------------------------------------------------------------- */
 
 #include <dbconnector/dbconnector.hpp>
 
 #include <modules/shared/HandleTraits.hpp>
+#include <modules/shared/LBFGS.hpp>
 #include <modules/prob/boost.hpp>
 #include "multilogistic.hpp"
 
@@ -428,6 +431,731 @@ internal_mlogregr_irls_result::run(AnyType &args) {
 }
 
 
+/**
+ * @brief Inter- and intra-iteration state for iteratively-reweighted-least-
+ *        squares method for multinomial logistic regression, with a
+ *        block-diagonal approximation of the Hessian
+ *
+ * The Hessian \f$ X^T A X \f$ of the log-likelihood is a matrix of size
+ * (numCategories * widthOfX)^2. This state only keeps its numCategories
+ * diagonal blocks of size widthOfX^2, i.e., it ignores the coupling between
+ * different categories. Each iteration then solves one small system per
+ * category. Since the resulting step is only an approximation of the Newton
+ * step, it may decrease the log-likelihood. In that case, the step is halved
+ * (and the log-likelihood evaluated again) until the log-likelihood does not
+ * decrease.
+ *
+ * Note: We assume that the DOUBLE PRECISION array is initialized by the
+ * database with length at least 7, and all elemenets are 0.
+ */
+template <class Handle>
+class MLogRegrIRLSBlockDiagTransitionState {
+    template <class OtherHandle>
+    friend class MLogRegrIRLSBlockDiagTransitionState;
+
+public:
+    MLogRegrIRLSBlockDiagTransitionState(const AnyType &inArray)
+        : mStorage(inArray.getAs<Handle>()) {
+
+        rebind(static_cast<uint16_t>(mStorage[0]),
+            static_cast<uint16_t>(mStorage[1]));
+    }
+
+    /**
+     * @brief Convert to backend representation
+     *
+     * We define this function so that we can use State in the
+     * argument list and as a return type.
+     */
+    inline operator AnyType() const {
+        return mStorage;
+    }
+
+    /**
+     * @brief Initialize the state.
+     *
+     * This function is only called for the first row of each iteration.
+     */
+    inline void initialize(const Allocator &inAllocator, uint16_t inWidthOfX,
+        uint16_t inNumCategories) {
+
+        mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
+            dbal::DoZero, dbal::ThrowBadAlloc>(
+                arraySize(inWidthOfX, inNumCategories));
+        rebind(inWidthOfX, inNumCategories);
+        widthOfX = inWidthOfX;
+        numCategories = inNumCategories;
+        stepsize = 1;
+    }
+
+    /**
+     * @brief We need to support assigning the previous state
+     */
+    template <class OtherHandle>
+    MLogRegrIRLSBlockDiagTransitionState &operator=(
+        const MLogRegrIRLSBlockDiagTransitionState<OtherHandle> &inOtherState) {
+
+        for (size_t i = 0; i < mStorage.size(); i++)
+            mStorage[i] = inOtherState.mStorage[i];
+        return *this;
+    }
+
+    /**
+     * @brief Merge with another State object by copying the intra-iteration
+     *     fields
+     */
+    template <class OtherHandle>
+    MLogRegrIRLSBlockDiagTransitionState &operator+=(
+        const MLogRegrIRLSBlockDiagTransitionState<OtherHandle> &inOtherState) {
+
+        if (mStorage.size() != inOtherState.mStorage.size() ||
+            widthOfX != inOtherState.widthOfX ||
+            numCategories != inOtherState.numCategories)
+            throw std::logic_error("Internal error: Incompatible transition "
+                "states");
+
+        numRows += inOtherState.numRows;
+        logLikelihood += inOtherState.logLikelihood;
+        gradient += inOtherState.gradient;
+        X_transp_AX += inOtherState.X_transp_AX;
+        return *this;
+    }
+
+    /**
+     * @brief Reset the intra-iteration fields.
+     */
+    inline void reset() {
+        numRows = 0;
+        logLikelihood = 0;
+        gradient.fill(0);
+        X_transp_AX.fill(0);
+    }
+
+private:
+    static inline uint32_t arraySize(const uint16_t inWidthOfX,
+        const uint16_t inNumCategories) {
+
+        uint32_t numCoef = static_cast<uint32_t>(inWidthOfX) * inNumCategories;
+        return 7 + 4 * numCoef + numCoef * inWidthOfX;
+    }
+
+    /**
+     * @brief Rebind to a new storage array
+     *
+     * @param inWidthOfX The number of independent variables.
+     * @param inNumCategories The number of categories, not counting the
+     *     reference category
+     *
+     * Array layout (iteration refers to one aggregate-function call):
+     * Inter-iteration components (updated in final function):
+     *   n = numCategories * widthOfX
+     * - 0: widthOfX (number of independent variables)
+     * - 1: numCategories (number of categories, not counting the reference
+     *   category)
+     * - 2: stepsize (multiple of direction that coef differs from acceptedCoef)
+     * - 3: numAccepted (number of steps accepted so far)
+     * - 4: acceptedLogLikelihood (log-likelihood at acceptedCoef)
+     * - 5: coef (coefficients used in the next iteration, same layout as in
+     *   MLogRegrIRLSTransitionState)
+     * - 5 + n: acceptedCoef (coefficients with the largest log-likelihood so
+     *   far)
+     * - 5 + 2 * n: direction (approximate Newton step from acceptedCoef)
+     *
+     * Intra-iteration components (updated in transition step):
+     * - 5 + 3 * n: numRows (number of rows already processed in this
+     *   iteration)
+     * - 6 + 3 * n: logLikelihood ( ln(l(c)) )
+     * - 7 + 3 * n: gradient (gradient of the log-likelihood)
+     * - 7 + 4 * n: X_transp_AX (widthOfX x n matrix: the diagonal blocks of
+     *   X^T A X, one after the other)
+     */
+    void rebind(uint16_t inWidthOfX, uint16_t inNumCategories) {
+        uint32_t n = static_cast<uint32_t>(inWidthOfX) * inNumCategories;
+
+        widthOfX.rebind(&mStorage[0]);
+        numCategories.rebind(&mStorage[1]);
+        stepsize.rebind(&mStorage[2]);
+        numAccepted.rebind(&mStorage[3]);
+        acceptedLogLikelihood.rebind(&mStorage[4]);
+        coef.rebind(&mStorage[5], n);
+        acceptedCoef.rebind(&mStorage[5 + n], n);
+        direction.rebind(&mStorage[5 + 2 * n], n);
+        numRows.rebind(&mStorage[5 + 3 * n]);
+        logLikelihood.rebind(&mStorage[6 + 3 * n]);
+        gradient.rebind(&mStorage[7 + 3 * n], n);
+        X_transp_AX.rebind(&mStorage[7 + 4 * n], inWidthOfX, n);
+    }
+
+    Handle mStorage;
+
+public:
+    typename HandleTraits<Handle>::ReferenceToUInt16 widthOfX;
+    typename HandleTraits<Handle>::ReferenceToUInt16 numCategories;
+    typename HandleTraits<Handle>::ReferenceToDouble stepsize;
+    typename HandleTraits<Handle>::ReferenceToUInt64 numAccepted;
+    typename HandleTraits<Handle>::ReferenceToDouble acceptedLogLikelihood;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap coef;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap acceptedCoef;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap direction;
+
+    typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
+    typename HandleTraits<Handle>::ReferenceToDouble logLikelihood;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap gradient;
+    typename HandleTraits<Handle>::MatrixTransparentHandleMap X_transp_AX;
+};
+
+/**
+ * @brief IRLS transition with block-diagonal Hessian
+ *
+ * Arguments: See mlogregr_irls_step_transition
+ *
+ * Each row takes O(numCategories * widthOfX^2) time.
+ */
+AnyType
+mlogregr_irls_blockdiag_step_transition::run(AnyType &args) {
+    MLogRegrIRLSBlockDiagTransitionState<MutableArrayHandle<double> > state
+        = args[0];
+
+    MappedColumnVector x = args[3].getAs<MappedColumnVector>();
+    int32_t category = args[1].getAs<int32_t>();
+    // Number of categories after pivoting (We pivot around the last category)
+    int32_t numCategories = (args[2].getAs<int32_t>() - 1);
+
+    // The following check was added with MADLIB-138.
+    if (!x.is_finite())
+        throw std::domain_error("Design matrix is not finite.");
+
+    if (state.numRows == 0) {
+        if (x.size() > std::numeric_limits<uint16_t>::max())
+            throw std::domain_error("Number of independent variables cannot be "
+                "larger than 65535.");
+
+        if (numCategories < 1)
+            throw std::domain_error("Number of cateogires must be at least 2");
+
+        state.initialize(*this, static_cast<uint16_t>(x.size()),
+            static_cast<uint16_t>(numCategories));
+
+        if (!args[4].isNull()) {
+            MLogRegrIRLSBlockDiagTransitionState<ArrayHandle<double> >
+                previousState = args[4];
+            if (previousState.widthOfX != x.size()
+                || previousState.numCategories != numCategories)
+                throw std::runtime_error("Inconsistent numbers of independent "
+                    "variables.");
+
+            state = previousState;
+            state.reset();
+        }
+    }
+
+    if (category > numCategories || category < 0)
+        throw std::domain_error("Invalid category. Categories must be integer "
+            "values between 0 and (number of categories - 1).");
+
+    // Now do the transition step
+    state.numRows++;
+
+    Index p = x.size();
+
+    // t1 = -C x, where coefficient (j, i) of the matrix C is stored at index
+    // j + numCategories * i
+    ColumnVector t1 = ColumnVector::Zero(numCategories);
+    for (Index i = 0; i < p; ++i)
+        t1 -= x(i) * state.coef.segment(i * numCategories, numCategories);
+
+    // We subtract the maximum before exponentiating, so that large linear
+    // predictors do not overflow.
+    double maxT1 = std::max(0., t1.maxCoeff());
+    ColumnVector pi = (t1.array() - maxT1).exp();
+    double t3 = std::exp(-maxT1) + pi.sum();
+    pi /= t3;
+
+    // The gradient of l_i(c) with respect to C is (pi - y_i) x_i^T (see
+    // mlogregr_lbfgs_step_transition)
+    ColumnVector piMinusY = pi;
+    if (category < numCategories)
+        piMinusY(category) -= 1.;
+    for (Index i = 0; i < p; ++i)
+        state.gradient.segment(i * numCategories, numCategories)
+            += x(i) * piMinusY;
+
+    // Diagonal block j of -H is sum_i pi_j (1 - pi_j) x_i x_i^T
+    Matrix xxTrans = x * trans(x);
+    for (Index j = 0; j < numCategories; ++j)
+        state.X_transp_AX.block(0, j * p, p, p)
+            += (pi(j) * (1. - pi(j))) * xxTrans;
+
+    // l_i(c) = y_i^T t1 - ln(1 + sum_k exp(t1_k))
+    state.logLikelihood += (category < numCategories ? t1(category) : 0.)
+        - (maxT1 + std::log(t3));
+
+    return state;
+}
+
+/**
+ * @brief Perform the perliminary aggregation function: Merge transition states
+ */
+AnyType
+mlogregr_irls_blockdiag_step_merge_states::run(AnyType &args) {
+    MLogRegrIRLSBlockDiagTransitionState<MutableArrayHandle<double> > stateLeft
+        = args[0];
+    MLogRegrIRLSBlockDiagTransitionState<ArrayHandle<double> > stateRight
+        = args[1];
+
+    // We first handle the trivial case where this function is called with one
+    // of the states being the initial state
+    if (stateLeft.numRows == 0)
+        return stateRight;
+    else if (stateRight.numRows == 0)
+        return stateLeft;
+
+    // Merge states together and return
+    stateLeft += stateRight;
+    return stateLeft;
+}
+
+/**
+ * @brief Perform the IRLS final step with block-diagonal Hessian
+ *
+ * If the log-likelihood decreased, we halve the step and try again.
+ * Otherwise, we accept the coefficients and solve one system per category for
+ * the next step.
+ */
+AnyType
+mlogregr_irls_blockdiag_step_final::run(AnyType &args) {
+    // We request a mutable object. Depending on the backend, this might perform
+    // a deep copy.
+    MLogRegrIRLSBlockDiagTransitionState<MutableArrayHandle<double> > state
+        = args[0];
+
+    // Aggregates that haven't seen any data just return Null.
+    if (state.numRows == 0)
+        return Null();
+
+    if (!state.X_transp_AX.is_finite() || !state.gradient.is_finite())
+        throw NoSolutionFoundException("Over- or underflow in intermediate "
+            "calulation. Input data is likely of poor numerical condition.");
+
+    if (state.numAccepted > 0
+        && static_cast<double>(state.logLikelihood)
+            < static_cast<double>(state.acceptedLogLikelihood)) {
+
+        state.stepsize = 0.5 * state.stepsize;
+        state.coef = state.acceptedCoef
+            + static_cast<double>(state.stepsize) * state.direction;
+        return state;
+    }
+
+    state.acceptedCoef = state.coef;
+    state.acceptedLogLikelihood = state.logLikelihood;
+    state.numAccepted++;
+    state.stepsize = 1;
+
+    Index p = state.widthOfX;
+    Index numCategories = state.numCategories;
+    ColumnVector gradientOfCategory(p);
+    for (Index j = 0; j < numCategories; ++j) {
+        for (Index i = 0; i < p; ++i)
+            gradientOfCategory(i) = state.gradient(j + i * numCategories);
+
+        SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
+            state.X_transp_AX.block(0, j * p, p, p), EigenvaluesOnly,
+            ComputePseudoInverse);
+        ColumnVector step = decomposition.pseudoInverse() * gradientOfCategory;
+
+        for (Index i = 0; i < p; ++i)
+            state.direction(j + i * numCategories) = step(i);
+    }
+    state.coef = state.acceptedCoef + state.direction;
+
+    if(!state.coef.is_finite())
+        throw NoSolutionFoundException("Over- or underflow in Newton step, "
+            "while updating coefficients. Input data is likely of poor "
+            "numerical condition.");
+
+    return state;
+}
+
+/**
+ * @brief Return the difference in log-likelihood between two states
+ */
+AnyType
+internal_mlogregr_irls_blockdiag_step_distance::run(AnyType &args) {
+    MLogRegrIRLSBlockDiagTransitionState<ArrayHandle<double> > stateLeft
+        = args[0];
+    MLogRegrIRLSBlockDiagTransitionState<ArrayHandle<double> > stateRight
+        = args[1];
+
+    return std::abs(stateLeft.logLikelihood - stateRight.logLikelihood);
+}
+
+/**
+ * @brief Return the coefficients and the log-likelihood of the state
+ *
+ * The result are the coefficients with the largest log-likelihood found so
+ * far. The state only contains an approximation of the Hessian, so the
+ * diagnostic statistics are NULL.
+ */
+AnyType
+internal_mlogregr_irls_blockdiag_result::run(AnyType &args) {
+    MLogRegrIRLSBlockDiagTransitionState<ArrayHandle<double> > state = args[0];
+
+    AnyType tuple;
+    tuple << state.acceptedCoef
+        << static_cast<double>(state.acceptedLogLikelihood)
+        << Null() << Null() << Null() << Null() << Null();
+    return tuple;
+}
+
+/**
+ * @brief Inter- and intra-iteration state for the limited-memory BFGS method
+ *        for multinomial logistic regression
+ *
+ * Each iteration (aggregate-function call) evaluates the log-likelihood and its
+ * gradient at the current coefficients, and the final function lets L-BFGS
+ * (see LBFGS) choose the coefficients of the next iteration. In contrast to
+ * IRLS, the state is linear in the number of coefficients, i.e., it does not
+ * contain the (numCategories * widthOfX)^2 Hessian.
+ *
+ * Note: We assume that the DOUBLE PRECISION array is initialized by the
+ * database with length at least 65, and all elemenets are 0.
+ */
+template <class Handle>
+class MLogRegrLBFGSTransitionState {
+    template <class OtherHandle>
+    friend class MLogRegrLBFGSTransitionState;
+
+public:
+    MLogRegrLBFGSTransitionState(const AnyType &inArray)
+        : mStorage(inArray.getAs<Handle>()) {
+
+        rebind(static_cast<uint16_t>(mStorage[1]),
+            static_cast<uint16_t>(mStorage[2]));
+    }
+
+    /**
+     * @brief Convert to backend representation
+     *
+     * We define this function so that we can use State in the
+     * argument list and as a return type.
+     */
+    inline operator AnyType() const {
+        return mStorage;
+    }
+
+    /**
+     * @brief Initialize the L-BFGS state.
+     *
+     * This function is only called for the first row of each iteration.
+     */
+    inline void initialize(const Allocator &inAllocator, uint16_t inWidthOfX,
+        uint16_t inNumCategories) {
+
+        mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
+            dbal::DoZero, dbal::ThrowBadAlloc>(
+                arraySize(inWidthOfX, inNumCategories));
+        rebind(inWidthOfX, inNumCategories);
+        widthOfX = inWidthOfX;
+        numCategories = inNumCategories;
+        diag.fill(1);
+    }
+
+    /**
+     * @brief We need to support assigning the previous state
+     */
+    template <class OtherHandle>
+    MLogRegrLBFGSTransitionState &operator=(
+        const MLogRegrLBFGSTransitionState<OtherHandle> &inOtherState) {
+
+        for (size_t i = 0; i < mStorage.size(); i++)
+            mStorage[i] = inOtherState.mStorage[i];
+        return *this;
+    }
+
+    /**
+     * @brief Merge with another State object by copying the intra-iteration
+     *     fields
+     */
+    template <class OtherHandle>
+    MLogRegrLBFGSTransitionState &operator+=(
+        const MLogRegrLBFGSTransitionState<OtherHandle> &inOtherState) {
+
+        if (mStorage.size() != inOtherState.mStorage.size() ||
+            widthOfX != inOtherState.widthOfX ||
+            numCategories != inOtherState.numCategories)
+            throw std::logic_error("Internal error: Incompatible transition "
+                "states");
+
+        numRows += inOtherState.numRows;
+        logLikelihood += inOtherState.logLikelihood;
+        gradient += inOtherState.gradient;
+        return *this;
+    }
+
+    /**
+     * @brief Reset the intra-iteration fields.
+     */
+    inline void reset() {
+        numRows = 0;
+        logLikelihood = 0;
+        gradient.fill(0);
+    }
+
+    static const int m = 7; // The number of corrections used in the L-BFGS update
+
+private:
+    static inline uint32_t arraySize(const uint16_t inWidthOfX,
+        const uint16_t inNumCategories) {
+
+        uint32_t numCoef = static_cast<uint32_t>(inWidthOfX) * inNumCategories;
+        return 51 + 3 * numCoef + LBFGS::workspaceSize(numCoef, m);
+    }
+
+    /**
+     * @brief Rebind to a new storage array
+     *
+     * @param inWidthOfX The number of independent variables.
+     * @param inNumCategories The number of categories, not counting the
+     *     reference category
+     *
+     * Array layout (iteration refers to one aggregate-function call):
+     * Inter-iteration components (updated in final function):
+     *   n = numCategories * widthOfX, w = LBFGS::workspaceSize(n, m)
+     * - 0: iteration (number of completed iterations)
+     * - 1: widthOfX (number of independent variables)
+     * - 2: numCategories (number of categories, not counting the reference
+     *   category)
+     * - 3: coef (numCategories x widthOfX matrix of coefficients in
+     *   column-major order, the point of the next evaluation)
+     * - 3 + n: diag (diagonal of the inverse Hessian approximation)
+     * - 3 + 2 * n: ws (work space of L-BFGS)
+     * - 3 + 2 * n + w: lbfgs_state (scalars of L-BFGS)
+     * - 24 + 2 * n + w: mcsrch_state (scalars of the line search)
+     *
+     * Intra-iteration components (updated in transition step):
+     * - 49 + 2 * n + w: numRows (number of rows already processed in this
+     *   iteration)
+     * - 50 + 2 * n + w: logLikelihood ( ln(l(c)) )
+     * - 51 + 2 * n + w: gradient (gradient of the log-likelihood, same layout
+     *   as coef)
+     */
+    void rebind(uint16_t inWidthOfX, uint16_t inNumCategories) {
+        uint32_t n = static_cast<uint32_t>(inWidthOfX) * inNumCategories;
+        uint32_t w = LBFGS::workspaceSize(n, m);
+
+        iteration.rebind(&mStorage[0]);
+        widthOfX.rebind(&mStorage[1]);
+        numCategories.rebind(&mStorage[2]);
+        coef.rebind(&mStorage[3], n);
+        diag.rebind(&mStorage[3 + n], n);
+        ws.rebind(&mStorage[3 + 2 * n], w);
+        lbfgs_state.rebind(&mStorage[3 + 2 * n + w], LBFGS::kLBFGSStateSize);
+        mcsrch_state.rebind(&mStorage[24 + 2 * n + w],
+            LBFGS::kLineSearchStateSize);
+        numRows.rebind(&mStorage[49 + 2 * n + w]);
+        logLikelihood.rebind(&mStorage[50 + 2 * n + w]);
+        gradient.rebind(&mStorage[51 + 2 * n + w], n);
+    }
+
+    Handle mStorage;
+
+public:
+    typename HandleTraits<Handle>::ReferenceToUInt32 iteration;
+    typename HandleTraits<Handle>::ReferenceToUInt16 widthOfX;
+    typename HandleTraits<Handle>::ReferenceToUInt16 numCategories;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap coef;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap diag;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap ws;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap lbfgs_state;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap mcsrch_state;
+
+    typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
+    typename HandleTraits<Handle>::ReferenceToDouble logLikelihood;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap gradient;
+};
+
+/**
+ * @brief L-BFGS Transition
+ *
+ * Arguments (Matched with PSQL wrapped)
+ * - 0: Current State
+ * - 1: y value (Integer)
+ * - 2: numCategories (Integer)
+ * - 3: X value (Column Vector)
+ * - 4: Previous State
+ *
+ * Only the log-likelihood and its gradient are accumulated, which takes
+ * O(numCategories * widthOfX) time and space per row.
+ */
+AnyType
+mlogregr_lbfgs_step_transition::run(AnyType &args) {
+    MLogRegrLBFGSTransitionState<MutableArrayHandle<double> > state = args[0];
+
+    MappedColumnVector x = args[3].getAs<MappedColumnVector>();
+    int32_t category = args[1].getAs<int32_t>();
+    // Number of categories after pivoting (We pivot around the last category)
+    int32_t numCategories = (args[2].getAs<int32_t>() - 1);
+
+    // The following check was added with MADLIB-138.
+    if (!x.is_finite())
+        throw std::domain_error("Design matrix is not finite.");
+
+    if (state.numRows == 0) {
+        if (x.size() > std::numeric_limits<uint16_t>::max())
+            throw std::domain_error("Number of independent variables cannot be "
+                "larger than 65535.");
+
+        if (numCategories < 1)
+            throw std::domain_error("Number of cateogires must be at least 2");
+
+        state.initialize(*this, static_cast<uint16_t>(x.size()),
+            static_cast<uint16_t>(numCategories));
+
+        if (!args[4].isNull()) {
+            MLogRegrLBFGSTransitionState<ArrayHandle<double> > previousState
+                = args[4];
+            if (previousState.widthOfX != x.size()
+                || previousState.numCategories != numCategories)
+                throw std::runtime_error("Inconsistent numbers of independent "
+                    "variables.");
+
+            state = previousState;
+            state.reset();
+        }
+    }
+
+    if (category > numCategories || category < 0)
+        throw std::domain_error("Invalid category. Categories must be integer "
+            "values between 0 and (number of categories - 1).");
+
+    // Now do the transition step
+    state.numRows++;
+
+    // t1 = -C x, where coefficient (j, i) of the matrix C is stored at index
+    // j + numCategories * i
+    ColumnVector t1 = ColumnVector::Zero(numCategories);
+    for (Index i = 0; i < x.size(); ++i)
+        t1 -= x(i) * state.coef.segment(i * numCategories, numCategories);
+
+    // pi_j = exp(t1_j) / (1 + sum_k exp(t1_k)). We subtract the maximum before
+    // exponentiating, so that large linear predictors do not overflow.
+    double maxT1 = std::max(0., t1.maxCoeff());
+    ColumnVector pi = (t1.array() - maxT1).exp();
+    double t3 = std::exp(-maxT1) + pi.sum();
+    pi /= t3;
+
+    // The gradient of l_i(c) with respect to C is (pi - y_i) x_i^T, where y_i
+    // is the indicator vector of the category (all zeros for the reference
+    // category). Note the sign: The linear predictors are -C x.
+    ColumnVector piMinusY = pi;
+    if (category < numCategories)
+        piMinusY(category) -= 1.;
+    for (Index i = 0; i < x.size(); ++i)
+        state.gradient.segment(i * numCategories, numCategories)
+            += x(i) * piMinusY;
+
+    // l_i(c) = y_i^T t1 - ln(1 + sum_k exp(t1_k))
+    state.logLikelihood += (category < numCategories ? t1(category) : 0.)
+        - (maxT1 + std::log(t3));
+
+    return state;
+}
+
+/**
+ * @brief Perform the perliminary aggregation function: Merge transition states
+ */
+AnyType
+mlogregr_lbfgs_step_merge_states::run(AnyType &args) {
+    MLogRegrLBFGSTransitionState<MutableArrayHandle<double> > stateLeft = args[0];
+    MLogRegrLBFGSTransitionState<ArrayHandle<double> > stateRight = args[1];
+
+    // We first handle the trivial case where this function is called with one
+    // of the states being the initial state
+    if (stateLeft.numRows == 0)
+        return stateRight;
+    else if (stateRight.numRows == 0)
+        return stateLeft;
+
+    // Merge states together and return
+    stateLeft += stateRight;
+    return stateLeft;
+}
+
+/**
+ * @brief Perform the L-BFGS final step
+ *
+ * See logregr_lbfgs_step_final.
+ */
+AnyType
+mlogregr_lbfgs_step_final::run(AnyType &args) {
+    // We request a mutable object. Depending on the backend, this might perform
+    // a deep copy.
+    MLogRegrLBFGSTransitionState<MutableArrayHandle<double> > state = args[0];
+
+    // Aggregates that haven't seen any data just return Null.
+    if (state.numRows == 0)
+        return Null();
+
+    if (!state.gradient.is_finite())
+        throw NoSolutionFoundException("Over- or underflow in intermediate "
+            "calulation. Input data is likely of poor numerical condition.");
+
+    if (state.iteration > 0 && LBFGS::converged(state.lbfgs_state))
+        return state;
+
+    double eps = 0.001; // accuracy of the solution to be found
+    double xtol = 1.0e-16; // an estimate of the machine precision
+
+    LBFGS instance(state);
+    instance.lbfgs(static_cast<int>(state.coef.size()), state.m,
+        -state.logLikelihood, -state.gradient, eps, xtol);
+    instance.save_state(state);
+    instance.check_status();
+
+    if (!state.coef.is_finite())
+        throw NoSolutionFoundException("Over- or underflow in L-BFGS step, "
+            "while updating coefficients. Input data is likely of poor "
+            "numerical condition.");
+
+    state.iteration++;
+    return state;
+}
+
+/**
+ * @brief Return the distance between two states
+ *
+ * Within a line search, the log-likelihood of consecutive trial points can be
+ * arbitrarily close, so the difference in log-likelihood is not a useful
+ * convergence criterion. We therefore return 0 once L-BFGS has converged
+ * (relative norm of the gradient below 0.001), and infinity otherwise.
+ */
+AnyType
+internal_mlogregr_lbfgs_step_distance::run(AnyType &args) {
+    MLogRegrLBFGSTransitionState<ArrayHandle<double> > state = args[0];
+
+    if (state.iteration > 0 && LBFGS::converged(state.lbfgs_state))
+        return 0.;
+
+    return std::numeric_limits<double>::infinity();
+}
+
+/**
+ * @brief Return the coefficients and the log-likelihood of the state
+ *
+ * The state does not contain the Hessian, so the diagnostic statistics are
+ * NULL.
+ */
+AnyType
+internal_mlogregr_lbfgs_result::run(AnyType &args) {
+    MLogRegrLBFGSTransitionState<ArrayHandle<double> > state = args[0];
+
+    AnyType tuple;
+    tuple << state.coef << static_cast<double>(state.logLikelihood)
+        << Null() << Null() << Null() << Null() << Null();
+    return tuple;
+}
+
 /**
  * @brief Compute the diagnostic statistics
  *
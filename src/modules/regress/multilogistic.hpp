@@ -35,3 +35,61 @@ DECLARE_UDF(regress, internal_mlogregr_irls_step_distance)
  */
 DECLARE_UDF(regress, internal_mlogregr_irls_result)
 
+
+/**
+ * @brief Multi Logistic regression (IRLS step with block-diagonal Hessian):
+ *     Transition function
+ */
+DECLARE_UDF(regress, mlogregr_irls_blockdiag_step_transition)
+
+/**
+ * @brief Multi Logistic regression (IRLS step with block-diagonal Hessian):
+ *     State merge function
+ */
+DECLARE_UDF(regress, mlogregr_irls_blockdiag_step_merge_states)
+
+/**
+ * @brief Multi Logistic regression (IRLS step with block-diagonal Hessian):
+ *     Final function
+ */
+DECLARE_UDF(regress, mlogregr_irls_blockdiag_step_final)
+
+/**
+ * @brief Multi Logistic regression (IRLS step with block-diagonal Hessian):
+ *     Difference in log-likelihood between two transition states
+ */
+DECLARE_UDF(regress, internal_mlogregr_irls_blockdiag_step_distance)
+
+/**
+ * @brief Multi Logistic regression (IRLS step with block-diagonal Hessian):
+ *     Convert transition state to result tuple
+ */
+DECLARE_UDF(regress, internal_mlogregr_irls_blockdiag_result)
+
+
+/**
+ * @brief Multi Logistic regression (L-BFGS step): Transition function
+ */
+DECLARE_UDF(regress, mlogregr_lbfgs_step_transition)
+
+/**
+ * @brief Multi Logistic regression (L-BFGS step): State merge function
+ */
+DECLARE_UDF(regress, mlogregr_lbfgs_step_merge_states)
+
+/**
+ * @brief Multi Logistic regression (L-BFGS step): Final function
+ */
+DECLARE_UDF(regress, mlogregr_lbfgs_step_final)
+
+/**
+ * @brief Multi Logistic regression (L-BFGS step): Difference in
+ *     log-likelihood between two transition states
+ */
+DECLARE_UDF(regress, internal_mlogregr_lbfgs_step_distance)
+
+/**
+ * @brief Multi Logistic regression (L-BFGS step): Convert transition state to
+ *     result tuple
+ */
+DECLARE_UDF(regress, internal_mlogregr_lbfgs_result)
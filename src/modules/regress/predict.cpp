@@ -0,0 +1,284 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file predict.cpp
+ *
+ * @brief Scoring functions for linear, logistic, and multinomial logistic
+ *     regression models
+ *
+ * Scoring is typically done for many rows with the same model. We therefore
+ * convert the coefficient array only once per query and keep it in the
+ * cross-call context of the function (see
+ * AnyType::getUserFunctionContext()). Each function also exists in a batch
+ * variant that scores a two-dimensional array of rows with a single matrix
+ * product, which amortizes the per-call overhead over many rows.
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#include <dbconnector/dbconnector.hpp>
+
+#include <cstring>
+
+#include "predict.hpp"
+
+namespace madlib {
+
+// Use Eigen
+using namespace dbal::eigen_integration;
+
+namespace modules {
+
+namespace regress {
+
+namespace {
+
+/**
+ * @brief Coefficients cached across calls
+ *
+ * The header is followed by the converted coefficients (\c numCoef doubles)
+ * and then by the raw backend representation of the coefficient array
+ * (\c rawSize bytes). The raw representation is what we compare against on
+ * each call: It is neither detoasted nor decompressed, so for a TOASTed model
+ * the comparison is just one of a TOAST pointer.
+ */
+struct CoefficientCache {
+    size_t capacity;
+    size_t rawSize;
+    size_t numCoef;
+
+    double* coef() {
+        return reinterpret_cast<double*>(this + 1);
+    }
+
+    char* raw() {
+        return reinterpret_cast<char*>(coef() + numCoef);
+    }
+};
+
+/**
+ * @brief Return the coefficient vector passed as first argument, using the
+ *     cached copy if the argument did not change since the last call
+ *
+ * If no cross-call context is available (e.g., if the function is called from
+ * another C++ AL function), the coefficients are converted on every call.
+ */
+MappedColumnVector
+cachedCoefficients(AnyType &args) {
+    AnyType coefArg = args[0];
+    const void* raw = coefArg.getRawValue();
+    size_t rawSize = coefArg.getRawValueSize();
+
+    CoefficientCache* cache
+        = static_cast<CoefficientCache*>(args.getUserFunctionContext());
+    if (cache && cache->rawSize == rawSize
+        && std::memcmp(cache->raw(), raw, rawSize) == 0)
+        return MappedColumnVector(TransparentHandle<double>(cache->coef()),
+            static_cast<Index>(cache->numCoef));
+
+    MappedColumnVector coef = coefArg.getAs<MappedColumnVector>();
+    size_t size = sizeof(CoefficientCache)
+        + sizeof(double) * static_cast<size_t>(coef.size()) + rawSize;
+    if (!cache || cache->capacity < size) {
+        cache = static_cast<CoefficientCache*>(
+            args.allocateUserFunctionContext(size));
+        if (!cache)
+            return coef;
+        cache->capacity = size;
+    }
+
+    // Invalidate the cache while it is being overwritten
+    cache->rawSize = 0;
+    cache->numCoef = static_cast<size_t>(coef.size());
+    std::copy(coef.data(), coef.data() + coef.size(), cache->coef());
+    std::memcpy(cache->raw(), raw, rawSize);
+    cache->rawSize = rawSize;
+    return MappedColumnVector(TransparentHandle<double>(cache->coef()),
+        coef.size());
+}
+
+/**
+ * @brief Logistic function
+ */
+inline double sigma(double x) {
+    return 1. / (1. + std::exp(-x));
+}
+
+/**
+ * @brief Category probabilities of multinomial logistic regression
+ *
+ * The coefficients are stored as a matrix with one row per non-reference
+ * category (see multilogistic.cpp). The linear predictors are negated, and the
+ * reference category (the last one) has linear predictor 0. We subtract the
+ * maximum before exponentiating, so that large linear predictors do not
+ * overflow.
+ *
+ * @param inLinearPredictors Vector of \f$ -c_j^T x \f$, one per non-reference
+ *     category
+ * @param outProb Vector of probabilities, one per category (including the
+ *     reference category)
+ */
+template <class VectorType, class ResultType>
+inline
+void
+softmaxWithReference(const VectorType& inLinearPredictors,
+    ResultType outProb) {
+
+    Index numCategories = inLinearPredictors.size();
+    double maxPredictor = std::max(0., inLinearPredictors.maxCoeff());
+
+    outProb.head(numCategories)
+        = (inLinearPredictors.array() - maxPredictor).exp();
+    outProb(numCategories) = std::exp(-maxPredictor);
+    outProb /= outProb.sum();
+}
+
+/**
+ * @brief Number of non-reference categories of a multinomial logistic
+ *     regression model
+ */
+inline
+Index
+numNonReferenceCategories(const MappedColumnVector& inCoef, Index inWidthOfX) {
+    if (inWidthOfX == 0 || inCoef.size() % inWidthOfX != 0
+        || inCoef.size() == 0)
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+    return inCoef.size() / inWidthOfX;
+}
+
+} // namespace
+
+/**
+ * @brief Predict the dependent variable of a single row
+ *
+ * Arguments:
+ * - 0: coef (coefficients as returned by linregr)
+ * - 1: x (independent variables)
+ */
+AnyType
+linregr_predict::run(AnyType &args) {
+    MappedColumnVector coef = cachedCoefficients(args);
+    MappedColumnVector x = args[1].getAs<MappedColumnVector>();
+
+    if (x.size() != coef.size())
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+
+    return dot(coef, x);
+}
+
+/**
+ * @brief Predict the dependent variables of a block of rows
+ *
+ * Arguments:
+ * - 0: coef (coefficients as returned by linregr)
+ * - 1: X (two-dimensional array, each row contains the independent variables
+ *   of one row of the design matrix)
+ */
+AnyType
+linregr_predict_batch::run(AnyType &args) {
+    MappedColumnVector coef = cachedCoefficients(args);
+    // Each row of the two-dimensional array is a column of X
+    MappedMatrix X = args[1].getAs<MappedMatrix>();
+
+    if (X.rows() != coef.size())
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+
+    MutableNativeColumnVector prediction(allocateArray<double>(X.cols()));
+    prediction = trans(X) * coef;
+    return prediction;
+}
+
+/**
+ * @brief Predict the probability of a single row being \c TRUE
+ *
+ * Arguments:
+ * - 0: coef (coefficients as returned by logregr)
+ * - 1: x (independent variables)
+ */
+AnyType
+logregr_predict_prob::run(AnyType &args) {
+    MappedColumnVector coef = cachedCoefficients(args);
+    MappedColumnVector x = args[1].getAs<MappedColumnVector>();
+
+    if (x.size() != coef.size())
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+
+    return sigma(dot(coef, x));
+}
+
+/**
+ * @brief Predict the probabilities of a block of rows being \c TRUE
+ *
+ * Arguments: See linregr_predict_batch
+ */
+AnyType
+logregr_predict_prob_batch::run(AnyType &args) {
+    MappedColumnVector coef = cachedCoefficients(args);
+    MappedMatrix X = args[1].getAs<MappedMatrix>();
+
+    if (X.rows() != coef.size())
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+
+    MutableNativeColumnVector prob(allocateArray<double>(X.cols()));
+    prob = trans(X) * coef;
+    for (Index i = 0; i < prob.size(); ++i)
+        prob(i) = sigma(prob(i));
+    return prob;
+}
+
+/**
+ * @brief Predict the category probabilities of a single row
+ *
+ * Arguments:
+ * - 0: coef (coefficients as returned by mlogregr)
+ * - 1: x (independent variables)
+ *
+ * The result contains one probability per category. The last category is the
+ * reference category.
+ */
+AnyType
+mlogregr_predict_prob::run(AnyType &args) {
+    MappedColumnVector coef = cachedCoefficients(args);
+    MappedColumnVector x = args[1].getAs<MappedColumnVector>();
+    Index numCategories = numNonReferenceCategories(coef, x.size());
+    MappedMatrix coefMatrix(coef.memoryHandle(), numCategories, x.size());
+
+    ColumnVector linearPredictors = -coefMatrix * x;
+    MutableNativeColumnVector prob(allocateArray<double>(numCategories + 1));
+    softmaxWithReference(linearPredictors, prob.segment(0, prob.size()));
+    return prob;
+}
+
+/**
+ * @brief Predict the category probabilities of a block of rows
+ *
+ * Arguments: See linregr_predict_batch
+ *
+ * The result is a two-dimensional array with one row per input row, and one
+ * column per category.
+ */
+AnyType
+mlogregr_predict_prob_batch::run(AnyType &args) {
+    MappedColumnVector coef = cachedCoefficients(args);
+    MappedMatrix X = args[1].getAs<MappedMatrix>();
+    Index numCategories = numNonReferenceCategories(coef, X.rows());
+    MappedMatrix coefMatrix(coef.memoryHandle(), numCategories, X.rows());
+
+    Matrix linearPredictors = -coefMatrix * X;
+    // Each column of prob becomes a row of the two-dimensional result array
+    MutableNativeMatrix prob(
+        allocateArray<double>(X.cols(), numCategories + 1),
+        numCategories + 1, X.cols());
+    for (Index i = 0; i < X.cols(); ++i)
+        softmaxWithReference(linearPredictors.col(i), prob.col(i));
+    return prob;
+}
+
+} // namespace regress
+
+} // namespace modules
+
+} // namespace madlib
@@ -0,0 +1,39 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file predict.hpp
+ *
+ *//* ----------------------------------------------------------------------- */
+
+/**
+ * @brief Linear regression: Predict the dependent variable of a single row
+ */
+DECLARE_UDF(regress, linregr_predict)
+
+/**
+ * @brief Linear regression: Predict the dependent variables of a block of rows
+ */
+DECLARE_UDF(regress, linregr_predict_batch)
+
+/**
+ * @brief Logistic regression: Predict the probability of a single row being
+ *     \c TRUE
+ */
+DECLARE_UDF(regress, logregr_predict_prob)
+
+/**
+ * @brief Logistic regression: Predict the probabilities of a block of rows
+ *     being \c TRUE
+ */
+DECLARE_UDF(regress, logregr_predict_prob_batch)
+
+/**
+ * @brief Multinomial logistic regression: Predict the category probabilities
+ *     of a single row
+ */
+DECLARE_UDF(regress, mlogregr_predict_prob)
+
+/**
+ * @brief Multinomial logistic regression: Predict the category probabilities
+ *     of a block of rows
+ */
+DECLARE_UDF(regress, mlogregr_predict_prob_batch)
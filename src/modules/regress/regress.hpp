@@ -7,5 +7,7 @@
  * -------------------------------------------------------------------------- */
 
 #include "linear.hpp"
+#include "sparse_linear.hpp"
 #include "logistic.hpp"
 #include "multilogistic.hpp"
+#include "predict.hpp"
@@ -0,0 +1,398 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file sparse_linear.cpp
+ *
+ * @brief Linear-regression functions for sparse, very wide design matrices
+ *
+ * In contrast to linear.cpp, the number of independent variables is only
+ * limited by the size of a sparse vector (2^31 - 1), and the transition state
+ * only stores the non-zero entries of \f$ X^T X \f$. The coefficients are
+ * computed with the (Jacobi-preconditioned) conjugate-gradient method, so no
+ * dense pseudo-inverse is ever formed.
+ *
+ *//* ----------------------------------------------------------------------- */
+#include <limits>
+#include <dbconnector/dbconnector.hpp>
+#include <modules/shared/HandleTraits.hpp>
+
+#include "sparse_linear.hpp"
+
+namespace madlib {
+
+// Use Eigen
+using namespace dbal::eigen_integration;
+
+namespace modules {
+
+namespace regress {
+
+/**
+ * @brief Transition state for linear regression with a sparse \f$ X^T X \f$
+ *
+ * The lower triangular part of \f$ X^T X \f$ is kept in an open-addressing
+ * hash table (with linear probing) that lives inside the DOUBLE PRECISION
+ * array. Each slot consists of a row index, a column index, and a value. Row
+ * and column indices are stored with an offset of 1, so that a zero row index
+ * marks an empty slot. The table capacity is always a power of 2, and the table
+ * is rehashed into a new array once it is half full.
+ *
+ * Note: We assume that the DOUBLE PRECISION array is initialized by the
+ * database with length 6, and all elemenets are 0.
+ */
+template <class Handle>
+class LinRegrSparseTransitionState {
+    template <class OtherHandle>
+    friend class LinRegrSparseTransitionState;
+
+public:
+    LinRegrSparseTransitionState(const AnyType &inArray)
+        : mStorage(inArray.getAs<Handle>()) {
+
+        rebind(static_cast<uint32_t>(mStorage[0]),
+            static_cast<uint64_t>(mStorage[3]));
+    }
+
+    /**
+     * @brief Convert to backend representation
+     *
+     * We define this function so that we can use State in the
+     * argument list and as a return type.
+     */
+    inline operator AnyType() const {
+        return mStorage;
+    }
+
+    /**
+     * @brief Initialize the state.
+     *
+     * This function is only called for the first row.
+     */
+    inline void initialize(const Allocator &inAllocator, uint32_t inWidthOfX,
+        uint64_t inCapacity) {
+
+        mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
+            dbal::DoZero, dbal::ThrowBadAlloc>(arraySize(inWidthOfX,
+                inCapacity));
+        rebind(inWidthOfX, inCapacity);
+        widthOfX = inWidthOfX;
+        capacity = inCapacity;
+    }
+
+    /**
+     * @brief Add a value to entry (inRow, inCol) of \f$ X^T X \f$
+     *
+     * The caller has to ensure <tt>inRow >= inCol</tt>. If a new entry would
+     * make the hash table more than half full, the table is first rehashed
+     * into a new array with twice the capacity.
+     */
+    inline void addToGram(const Allocator &inAllocator, uint32_t inRow,
+        uint32_t inCol, double inValue) {
+
+        Index slot = findSlot(inRow, inCol);
+        if (rowIndices(slot) == 0) {
+            if (2 * (numEntries + 1) > capacity) {
+                grow(inAllocator, 2 * capacity);
+                slot = findSlot(inRow, inCol);
+            }
+            rowIndices(slot) = static_cast<double>(inRow) + 1.;
+            colIndices(slot) = static_cast<double>(inCol) + 1.;
+            numEntries++;
+        }
+        values(slot) += inValue;
+    }
+
+    /**
+     * @brief Merge with another State object
+     */
+    template <class OtherHandle>
+    void merge(const Allocator &inAllocator,
+        const LinRegrSparseTransitionState<OtherHandle> &inOtherState) {
+
+        if (widthOfX != inOtherState.widthOfX)
+            throw std::runtime_error("Inconsistent numbers of independent "
+                "variables.");
+
+        numRows += inOtherState.numRows;
+        y_sum += inOtherState.y_sum;
+        y_square_sum += inOtherState.y_square_sum;
+        X_transp_Y += inOtherState.X_transp_Y;
+        for (Index slot = 0; slot < inOtherState.rowIndices.size(); ++slot)
+            if (inOtherState.rowIndices(slot) != 0)
+                addToGram(inAllocator,
+                    static_cast<uint32_t>(inOtherState.rowIndices(slot) - 1.),
+                    static_cast<uint32_t>(inOtherState.colIndices(slot) - 1.),
+                    inOtherState.values(slot));
+    }
+
+    /**
+     * @brief Compute \f$ X^T X \boldsymbol v \f$
+     */
+    template <class Derived>
+    inline void gramTimes(const Eigen::MatrixBase<Derived> &inVec,
+        ColumnVector &outVec) const {
+
+        outVec.setZero();
+        for (Index slot = 0; slot < rowIndices.size(); ++slot) {
+            if (rowIndices(slot) == 0)
+                continue;
+
+            Index row = static_cast<Index>(rowIndices(slot) - 1.);
+            Index col = static_cast<Index>(colIndices(slot) - 1.);
+            outVec(row) += values(slot) * inVec(col);
+            if (row != col)
+                outVec(col) += values(slot) * inVec(row);
+        }
+    }
+
+    /**
+     * @brief Return the diagonal of \f$ X^T X \f$
+     */
+    inline ColumnVector gramDiagonal() const {
+        ColumnVector diagonal(ColumnVector::Zero(widthOfX));
+        for (Index slot = 0; slot < rowIndices.size(); ++slot)
+            if (rowIndices(slot) != 0 && rowIndices(slot) == colIndices(slot))
+                diagonal(static_cast<Index>(rowIndices(slot) - 1.))
+                    = values(slot);
+        return diagonal;
+    }
+
+private:
+    static inline uint64_t arraySize(const uint32_t inWidthOfX,
+        const uint64_t inCapacity) {
+
+        return 6 + static_cast<uint64_t>(inWidthOfX) + 3 * inCapacity;
+    }
+
+    static inline uint64_t hash(uint32_t inRow, uint32_t inCol) {
+        // Finalization step of MurmurHash3, applied to the packed indices
+        uint64_t key = (static_cast<uint64_t>(inRow) << 32) | inCol;
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return key;
+    }
+
+    /**
+     * @brief Return the slot containing (inRow, inCol), or the empty slot
+     *     where it would be inserted
+     */
+    inline Index findSlot(uint32_t inRow, uint32_t inCol) const {
+        uint64_t mask = capacity - 1;
+        uint64_t slot = hash(inRow, inCol) & mask;
+        double row = static_cast<double>(inRow) + 1.;
+        double col = static_cast<double>(inCol) + 1.;
+
+        while (rowIndices(slot) != 0
+            && (rowIndices(slot) != row || colIndices(slot) != col))
+            slot = (slot + 1) & mask;
+        return static_cast<Index>(slot);
+    }
+
+    /**
+     * @brief Move the state into a new array with a larger hash table
+     */
+    void grow(const Allocator &inAllocator, uint64_t inCapacity) {
+        Handle oldStorage = mStorage;
+        uint32_t oldWidthOfX = widthOfX;
+        uint64_t oldCapacity = capacity;
+        const double* oldRowIndices = &oldStorage[6 + oldWidthOfX];
+        const double* oldColIndices = oldRowIndices + oldCapacity;
+        const double* oldValues = oldColIndices + oldCapacity;
+
+        initialize(inAllocator, oldWidthOfX, inCapacity);
+        for (size_t i = 1; i < 6 + static_cast<size_t>(oldWidthOfX); ++i)
+            if (i != 3)
+                mStorage[i] = oldStorage[i];
+        numEntries = 0;
+
+        for (uint64_t oldSlot = 0; oldSlot < oldCapacity; ++oldSlot) {
+            if (oldRowIndices[oldSlot] == 0)
+                continue;
+
+            Index slot = findSlot(
+                static_cast<uint32_t>(oldRowIndices[oldSlot] - 1.),
+                static_cast<uint32_t>(oldColIndices[oldSlot] - 1.));
+            rowIndices(slot) = oldRowIndices[oldSlot];
+            colIndices(slot) = oldColIndices[oldSlot];
+            values(slot) = oldValues[oldSlot];
+            numEntries++;
+        }
+    }
+
+    /**
+     * @brief Rebind to a new storage array
+     *
+     * @param inWidthOfX The number of independent variables.
+     * @param inCapacity The number of slots in the hash table.
+     *
+     * Array layout:
+     * - 0: widthOfX (number of independent variables)
+     * - 1: numRows (number of rows already processed)
+     * - 2: numEntries (number of occupied slots in the hash table)
+     * - 3: capacity (number of slots in the hash table)
+     * - 4: y_sum (sum of dependent variables)
+     * - 5: y_square_sum (sum of squares of dependent variables)
+     * - 6: X_transp_Y (X^T y)
+     * - 6 + widthOfX: rowIndices (row index + 1 of each slot, 0 if empty)
+     * - 6 + widthOfX + capacity: colIndices (column index + 1 of each slot)
+     * - 6 + widthOfX + 2 * capacity: values (value of each slot)
+     */
+    void rebind(uint32_t inWidthOfX = 0, uint64_t inCapacity = 0) {
+        widthOfX.rebind(&mStorage[0]);
+        numRows.rebind(&mStorage[1]);
+        numEntries.rebind(&mStorage[2]);
+        capacity.rebind(&mStorage[3]);
+        y_sum.rebind(&mStorage[4]);
+        y_square_sum.rebind(&mStorage[5]);
+        X_transp_Y.rebind(&mStorage[6], inWidthOfX);
+        rowIndices.rebind(&mStorage[6 + inWidthOfX], inCapacity);
+        colIndices.rebind(&mStorage[6 + inWidthOfX + inCapacity], inCapacity);
+        values.rebind(&mStorage[6 + inWidthOfX + 2 * inCapacity], inCapacity);
+    }
+
+    Handle mStorage;
+
+public:
+    typename HandleTraits<Handle>::ReferenceToUInt32 widthOfX;
+    typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
+    typename HandleTraits<Handle>::ReferenceToUInt64 numEntries;
+    typename HandleTraits<Handle>::ReferenceToUInt64 capacity;
+    typename HandleTraits<Handle>::ReferenceToDouble y_sum;
+    typename HandleTraits<Handle>::ReferenceToDouble y_square_sum;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap X_transp_Y;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap rowIndices;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap colIndices;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap values;
+};
+
+/**
+ * @brief Initial number of hash-table slots
+ */
+const uint64_t kLinRegrSparseInitialCapacity = 1024;
+
+AnyType
+linregr_sparse_transition::run(AnyType &args) {
+    LinRegrSparseTransitionState<MutableArrayHandle<double> > state = args[0];
+    double y = args[1].getAs<double>();
+    SparseColumnVector x = args[2].getAs<SparseColumnVector>();
+
+    if (!std::isfinite(y))
+        throw std::domain_error("Dependent variables are not finite.");
+    for (SparseColumnVector::InnerIterator it(x); it; ++it)
+        if (!std::isfinite(it.value()))
+            throw std::domain_error("Design matrix is not finite.");
+
+    if (state.numRows == 0)
+        state.initialize(*this, static_cast<uint32_t>(x.size()),
+            kLinRegrSparseInitialCapacity);
+    else if (state.widthOfX != static_cast<uint32_t>(x.size()))
+        throw std::runtime_error("Inconsistent numbers of independent "
+            "variables.");
+
+    state.numRows++;
+    state.y_sum += y;
+    state.y_square_sum += y * y;
+
+    // Only the lower triangular part of X^T X is stored
+    for (SparseColumnVector::InnerIterator it(x); it; ++it) {
+        state.X_transp_Y(it.index()) += it.value() * y;
+        for (SparseColumnVector::InnerIterator jt(x);
+            jt && jt.index() <= it.index(); ++jt)
+            state.addToGram(*this, static_cast<uint32_t>(it.index()),
+                static_cast<uint32_t>(jt.index()), it.value() * jt.value());
+    }
+    return state;
+}
+
+AnyType
+linregr_sparse_merge_states::run(AnyType &args) {
+    LinRegrSparseTransitionState<MutableArrayHandle<double> > stateLeft
+        = args[0];
+    LinRegrSparseTransitionState<ArrayHandle<double> > stateRight = args[1];
+
+    // We first handle the trivial case where this function is called with one
+    // of the states being the initial state
+    if (stateLeft.numRows == 0)
+        return stateRight;
+    else if (stateRight.numRows == 0)
+        return stateLeft;
+
+    stateLeft.merge(*this, stateRight);
+    return stateLeft;
+}
+
+AnyType
+linregr_sparse_final::run(AnyType &args) {
+    LinRegrSparseTransitionState<ArrayHandle<double> > state = args[0];
+
+    // If we haven't seen any data, just return Null. This is the standard
+    // behavior of aggregate function on empty data sets (compare, e.g.,
+    // how PostgreSQL handles sum or avg on empty inputs)
+    if (state.numRows == 0)
+        return Null();
+
+    // Solve X^T X c = X^T y with the Jacobi-preconditioned conjugate-gradient
+    // method. Variables that never occur have a zero diagonal entry. Since
+    // the corresponding entry of X^T y is 0, too, they remain at 0.
+    const Index widthOfX = state.widthOfX;
+    const double kTolerance = 1e-10;
+    ColumnVector inverseDiagonal = state.gramDiagonal();
+    for (Index i = 0; i < widthOfX; ++i)
+        inverseDiagonal(i) = inverseDiagonal(i) > 0
+            ? 1. / inverseDiagonal(i) : 1.;
+
+    MutableNativeColumnVector coef(
+        allocateArray<double>(widthOfX));
+    ColumnVector residual = state.X_transp_Y;
+    ColumnVector preconditioned = inverseDiagonal.cwiseProduct(residual);
+    ColumnVector direction = preconditioned;
+    ColumnVector gramTimesDirection(widthOfX);
+    double residualTimesPreconditioned = dot(residual, preconditioned);
+    double rhsNorm = state.X_transp_Y.norm();
+    double residualNorm = rhsNorm;
+    int32_t iteration = 0;
+
+    while (iteration < widthOfX && residualNorm > kTolerance * rhsNorm) {
+        state.gramTimes(direction, gramTimesDirection);
+        double curvature = dot(direction, gramTimesDirection);
+        if (!(curvature > 0))
+            break;
+
+        double alpha = residualTimesPreconditioned / curvature;
+        coef += alpha * direction;
+        residual -= alpha * gramTimesDirection;
+        residualNorm = residual.norm();
+        iteration++;
+
+        preconditioned = inverseDiagonal.cwiseProduct(residual);
+        double newResidualTimesPreconditioned = dot(residual, preconditioned);
+        direction = preconditioned + (newResidualTimesPreconditioned
+            / residualTimesPreconditioned) * direction;
+        residualTimesPreconditioned = newResidualTimesPreconditioned;
+    }
+
+    // Explained and total sum of squares, see LinearRegression::compute()
+    double ess = dot(state.X_transp_Y, coef)
+        - (state.y_sum * state.y_sum / static_cast<double>(state.numRows));
+    double tss = state.y_square_sum
+        - (state.y_sum * state.y_sum / static_cast<double>(state.numRows));
+    if (tss < 0)
+        tss = 0;
+    if (ess < 0)
+        ess = 0;
+    if (ess > tss)
+        ess = tss;
+    double r2 = (tss == 0 ? 1 : ess / tss);
+
+    AnyType tuple;
+    tuple << coef << r2 << static_cast<int64_t>(state.numRows)
+        << static_cast<int64_t>(state.numEntries) << iteration
+        << residualNorm;
+    return tuple;
+}
+
+} // namespace regress
+
+} // namespace modules
+
+} // namespace madlib
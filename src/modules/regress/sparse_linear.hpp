@@ -0,0 +1,20 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file sparse_linear.hpp
+ *
+ *//* ----------------------------------------------------------------------- */
+
+/**
+ * @brief Sparse linear regression: Transition function
+ */
+DECLARE_UDF(regress, linregr_sparse_transition)
+
+/**
+ * @brief Sparse linear regression: State merge function
+ */
+DECLARE_UDF(regress, linregr_sparse_merge_states)
+
+/**
+ * @brief Sparse linear regression: Final function
+ */
+DECLARE_UDF(regress, linregr_sparse_final)
@@ -0,0 +1,319 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file GroupArena.hpp
+ *
+ * @brief Transition state holding one fixed-size slot per group
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_SHARED_GROUP_ARENA_HPP_
+#define MADLIB_SHARED_GROUP_ARENA_HPP_
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace madlib {
+
+namespace modules {
+
+/**
+ * @brief Hash-indexed arena of per-group states inside one DOUBLE PRECISION
+ *     array
+ *
+ * Grouped aggregates keep the state of all groups in a single transition
+ * value. Each group owns one slot of <tt>Group<Handle>::slotSize(widthOfX)</tt>
+ * consecutive values, the first of which is the group key. Slots are stored in
+ * the order in which groups are first seen, and an open-addressing hash table
+ * (with linear probing) maps keys to slots, so that each row takes expected
+ * constant time to find its group.
+ *
+ * The template argument \c Group is a view on a slot. It has to provide
+ * - <tt>static uint32_t slotSize(uint16_t inWidthOfX)</tt>
+ * - <tt>void rebind(DoublePtr inSlot, uint16_t inWidthOfX)</tt>
+ *
+ * Once all slots are used, the capacity is doubled. This reallocates the
+ * array, so callers must return the arena (and not the original argument)
+ * from the transition function.
+ *
+ * Group keys are stored as DOUBLE PRECISION values, so they must not exceed
+ * \f$ 2^{53} \f$ in absolute value.
+ *
+ * Note: We assume that the DOUBLE PRECISION array is initialized by the
+ * database with length at least kHeaderSize, and all elemenets are 0.
+ */
+template <class Handle, template <class> class Group>
+class GroupArena {
+    template <class OtherHandle, template <class> class OtherGroup>
+    friend class GroupArena;
+
+public:
+    typedef typename HandleTraits<Handle>::DoublePtr DoublePtr;
+
+    /**
+     * @brief Number of values before the hash table
+     */
+    static const uint32_t kHeaderSize = 6;
+
+    /**
+     * @brief Capacity of a newly initialized arena
+     */
+    static const uint64_t kInitialCapacity = 16;
+
+    /**
+     * @brief Largest absolute value of a group key
+     */
+    static const int64_t kMaxKey = (static_cast<int64_t>(1) << 53);
+
+    /**
+     * @brief Maximum number of bytes of the array
+     *
+     * The backend cannot allocate more than 1GB at once (MaxAllocSize). We
+     * keep some headroom for the array header.
+     */
+    static const uint64_t kMaxArrayBytes = (static_cast<uint64_t>(1) << 30)
+        - 1024;
+
+    GroupArena(const AnyType &inArray)
+        : mStorage(inArray.getAs<Handle>()) {
+
+        rebind();
+    }
+
+    /**
+     * @brief Convert to backend representation
+     *
+     * We define this function so that we can use State in the
+     * argument list and as a return type.
+     */
+    inline operator AnyType() const {
+        return mStorage;
+    }
+
+    /**
+     * @brief Initialize an empty arena
+     *
+     * This function is only called for the first row.
+     */
+    inline void initialize(const Allocator &inAllocator, uint16_t inWidthOfX) {
+        allocate(inAllocator, inWidthOfX, kInitialCapacity);
+    }
+
+    /**
+     * @brief Initialize the arena as a copy of another arena
+     *
+     * This is used to start an iteration from the previous state.
+     */
+    template <class OtherHandle>
+    inline void initialize(const Allocator &inAllocator,
+        const GroupArena<OtherHandle, Group> &inOtherArena) {
+
+        mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
+            dbal::DoZero, dbal::ThrowBadAlloc>(inOtherArena.mStorage.size());
+        std::copy(inOtherArena.mStorage.ptr(),
+            inOtherArena.mStorage.ptr() + inOtherArena.mStorage.size(),
+            mStorage.ptr());
+        rebind();
+    }
+
+    /**
+     * @brief Bind \c outGroup to the slot of the i-th group (in the order in
+     *     which groups were first seen)
+     */
+    inline void group(uint64_t inIndex, Group<Handle> &outGroup) {
+        outGroup.rebind(slot(inIndex), widthOfX);
+    }
+
+    /**
+     * @brief Bind \c outGroup to the slot of the group with the given key
+     *
+     * @return Whether the group exists
+     */
+    inline bool find(int64_t inKey, Group<Handle> &outGroup) {
+        uint64_t position;
+        uint64_t index;
+        if (!lookup(inKey, position, index))
+            return false;
+
+        outGroup.rebind(slot(index), widthOfX);
+        return true;
+    }
+
+    /**
+     * @brief Bind \c outGroup to the slot of the group with the given key,
+     *     creating a zero slot if the group does not exist yet
+     *
+     * @return Whether the group was created
+     */
+    bool insert(const Allocator &inAllocator, int64_t inKey,
+        Group<Handle> &outGroup) {
+
+        uint64_t position;
+        uint64_t index;
+        if (lookup(inKey, position, index)) {
+            outGroup.rebind(slot(index), widthOfX);
+            return false;
+        }
+
+        if (inKey > kMaxKey || inKey < -kMaxKey)
+            throw std::domain_error("Group keys must be between -2^53 and "
+                "2^53.");
+
+        if (numGroups == capacity) {
+            grow(inAllocator);
+            lookup(inKey, position, index);
+        }
+
+        index = numGroups;
+        numGroups = index + 1;
+        mStorage[kHeaderSize + position] = static_cast<double>(index + 1);
+
+        DoublePtr newSlot = slot(index);
+        newSlot[0] = static_cast<double>(inKey);
+        outGroup.rebind(newSlot, widthOfX);
+        return true;
+    }
+
+private:
+    static inline uint64_t arraySize(uint16_t inWidthOfX, uint64_t inCapacity) {
+        return kHeaderSize + 2 * inCapacity
+            + inCapacity * Group<Handle>::slotSize(inWidthOfX);
+    }
+
+    /**
+     * @brief Mix the bits of a key (finalizer of MurmurHash3)
+     */
+    static inline uint64_t hash(int64_t inKey) {
+        uint64_t h = static_cast<uint64_t>(inKey);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    inline DoublePtr slot(uint64_t inIndex) {
+        return &mStorage[kHeaderSize + 2 * capacity
+            + inIndex * Group<Handle>::slotSize(widthOfX)];
+    }
+
+    /**
+     * @brief Find the hash-table position of a key
+     *
+     * @param outPosition The position of the key in the hash table, or the
+     *     first empty position if the key is not contained
+     * @param outIndex The index of the slot of the key (only if contained)
+     * @return Whether the key is contained
+     */
+    bool lookup(int64_t inKey, uint64_t &outPosition, uint64_t &outIndex) {
+        uint64_t tableSize = 2 * capacity;
+        if (tableSize == 0)
+            return false;
+
+        // The table size is a power of 2 and the table is at most half full,
+        // so the probe sequence always reaches an empty position.
+        uint64_t mask = tableSize - 1;
+        for (outPosition = hash(inKey) & mask; ;
+            outPosition = (outPosition + 1) & mask) {
+
+            double entry = mStorage[kHeaderSize + outPosition];
+            if (entry == 0)
+                return false;
+
+            outIndex = static_cast<uint64_t>(entry) - 1;
+            if (static_cast<int64_t>(slot(outIndex)[0]) == inKey)
+                return true;
+        }
+    }
+
+    /**
+     * @brief Allocate a new array, keeping widthOfX, numRows,
+     *     numActiveGroups, and precision as they are
+     */
+    void allocate(const Allocator &inAllocator, uint16_t inWidthOfX,
+        uint64_t inCapacity) {
+
+        uint64_t size = arraySize(inWidthOfX, inCapacity);
+        if (size > kMaxArrayBytes / sizeof(double))
+            throw std::runtime_error("Too many groups for a single transition "
+                "state (limited to 1GB).");
+
+        uint64_t oldNumRows = static_cast<uint64_t>(numRows);
+        uint64_t oldNumActiveGroups = static_cast<uint64_t>(numActiveGroups);
+        double oldPrecision = precision;
+
+        mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
+            dbal::DoZero, dbal::ThrowBadAlloc>(size);
+        rebind();
+        widthOfX = inWidthOfX;
+        capacity = inCapacity;
+        numRows = oldNumRows;
+        numActiveGroups = oldNumActiveGroups;
+        precision = oldPrecision;
+    }
+
+    /**
+     * @brief Double the capacity, and rebuild the hash table
+     */
+    void grow(const Allocator &inAllocator) {
+        Handle oldStorage = mStorage;
+        uint64_t oldCapacity = capacity;
+        uint64_t oldNumGroups = numGroups;
+        uint32_t slotSize = Group<Handle>::slotSize(widthOfX);
+
+        allocate(inAllocator, widthOfX, 2 * oldCapacity);
+        std::copy(
+            oldStorage.ptr() + kHeaderSize + 2 * oldCapacity,
+            oldStorage.ptr() + kHeaderSize + 2 * oldCapacity
+                + oldNumGroups * slotSize,
+            slot(0));
+
+        uint64_t position;
+        uint64_t index;
+        for (uint64_t i = 0; i < oldNumGroups; ++i) {
+            lookup(static_cast<int64_t>(slot(i)[0]), position, index);
+            mStorage[kHeaderSize + position] = static_cast<double>(i + 1);
+        }
+        numGroups = oldNumGroups;
+    }
+
+    /**
+     * @brief Rebind to the storage array
+     *
+     * Array layout:
+     * - 0: widthOfX (number of independent variables)
+     * - 1: capacity (number of slots)
+     * - 2: numGroups (number of slots in use)
+     * - 3: numRows (number of rows already processed in this iteration)
+     * - 4: numActiveGroups (number of groups that have not converged yet,
+     *   only used by iterative methods)
+     * - 5: precision (convergence threshold, only used by iterative methods)
+     * - 6: hash table (2 * capacity entries: 0 if empty, otherwise 1 + the
+     *   index of the slot)
+     * - 6 + 2 * capacity: slots (capacity * slotSize values)
+     */
+    void rebind() {
+        widthOfX.rebind(&mStorage[0]);
+        capacity.rebind(&mStorage[1]);
+        numGroups.rebind(&mStorage[2]);
+        numRows.rebind(&mStorage[3]);
+        numActiveGroups.rebind(&mStorage[4]);
+        precision.rebind(&mStorage[5]);
+    }
+
+    Handle mStorage;
+
+public:
+    typename HandleTraits<Handle>::ReferenceToUInt16 widthOfX;
+    typename HandleTraits<Handle>::ReferenceToUInt64 capacity;
+    typename HandleTraits<Handle>::ReferenceToUInt64 numGroups;
+    typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
+    typename HandleTraits<Handle>::ReferenceToUInt64 numActiveGroups;
+    typename HandleTraits<Handle>::ReferenceToDouble precision;
+};
+
+} // namespace modules
+
+} // namespace madlib
+
+#endif
@@ -0,0 +1,395 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file LBFGS.cpp
+ *
+ * @brief Limited-memory BFGS method
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#include <dbconnector/dbconnector.hpp>
+
+#include "LBFGS.hpp"
+
+namespace madlib {
+
+// Use Eigen
+using namespace dbal::eigen_integration;
+
+namespace modules {
+
+void LBFGS::mcstep(double& stx, double& fx, double& dx,
+                   double& sty, double& fy, double& dy,
+                   double& stp, double fp, double dp, bool& brackt,
+                   double stmin, double stmax, int& info)
+{
+    bool bound;
+    double gamma, p, q, r, sgnd, stpc, stpf, stpq, theta, s;
+
+    info = 0;
+
+    if ((brackt && ((stp <= std::min(stx, sty)) || (stp >= std::max(stx, sty)))) ||
+            (dx * (stp - stx) >= 0) || (stmax < stmin)) {
+        return;
+    }
+
+    sgnd = dp*(dx/fabs(dx));
+    if (fp > fx) {
+        info = 1;
+        bound = true;
+        theta = 3.0 * (fx - fp) / (stp - stx) + dx + dp;
+        s = std::max(fabs(theta), std::max(fabs(dx), fabs(dp)));
+        gamma = s * sqrt((theta / s) * (theta / s) - (dx / s) * (dp / s));
+        if (stp < stx) {
+            gamma = -gamma;
+        }
+        p = gamma - dx + theta;
+        q = gamma - dx + gamma + dp;
+        r = p / q;
+        stpc = stx + r * (stp - stx);
+        stpq = stx + dx/((fx - fp)/(stp - stx) + dx)/2 * (stp - stx);
+        if (fabs(stpc - stx) < fabs(stpq - stx)) {
+            stpf = stpc;
+        } else {
+            stpf = stpc + (stpq - stpc)/2;
+        }
+        brackt = true;
+
+    } else if (sgnd < 0.0) {
+        info = 2;
+        bound = false;
+        theta = 3.0 * (fx - fp) / (stp - stx) + dx + dp;
+        s = std::max(fabs(theta), std::max(fabs(dx), fabs(dp)));
+        gamma = s * sqrt((theta / s) * (theta / s) - (dx / s) * (dp / s));
+        if (stp > stx) {
+            gamma = -gamma;
+        }
+        p = gamma - dp + theta;
+        q = gamma - dp + gamma + dx;
+        r = p / q;
+        stpc = stp + r * (stx - stp);
+        stpq = stp + dp / (dp - dx) * (stx - stp);
+        stpf = (fabs(stpc - stp) > fabs(stpq - stp)) ? stpc : stpq;
+        brackt = true;
+
+    } else if (fabs(dp) < fabs(dx)) {
+        info = 3;
+        bound = true;
+        theta = 3.0 * (fx - fp) / (stp - stx) + dx + dp;
+        s = std::max(fabs(theta), std::max(fabs(dx), fabs(dp)));
+        gamma = s * sqrt(std::max(0.0, (theta/s)*(theta/s) - (dx/s)*(dp/s)));
+        if (stp > stx) {
+            gamma = -gamma;
+        }
+        p = gamma - dp + theta;
+        q = gamma + (dx - dp) + gamma;
+        r = p / q;
+        if ((r < 0.0) && (gamma != 0.0)) {
+            stpc = stp + r * (stx - stp);
+        } else {
+            stpc = (stp > stx) ? stmax : stmin;
+        }
+
+        stpq = stp + dp / (dp - dx) * (stx - stp);
+        if (brackt) {
+            stpf = (fabs(stp - stpc) < fabs(stp - stpq)) ? stpc : stpq;
+        } else {
+            stpf = (fabs(stp - stpc) > fabs(stp - stpq)) ? stpc : stpq;
+        }
+
+    } else {
+        info = 4;
+        bound = false;
+        if (brackt) {
+            theta = 3.0 * (fp - fy) / (sty - stp) + dy + dp;
+            s = std::max(fabs(theta), std::max(fabs(dy), fabs(dp)));
+            gamma = s * sqrt((theta/s)*(theta/s) - (dy/s)*(dp/s));
+            if (stp > sty) {
+                gamma = -gamma;
+            }
+            p = gamma - dp + theta;
+            q = gamma - dp + gamma + dy;
+            r = p / q;
+            stpc = stp + r * (sty - stp);
+            stpf = stpc;
+        } else {
+            stpf = (stp > stx) ? stmax : stmin;
+        }
+    }
+
+    if (fp > fx) {
+        sty = stp;
+        fy = fp;
+        dy = dp;
+    } else {
+        if (sgnd < 0.0) {
+            sty = stx;
+            fy = fx;
+            dy = dx;
+        }
+        stx = stp;
+        fx = fp;
+        dx = dp;
+    }
+
+    stp = std::max(stmin, std::min(stmax, stpf));
+    if (brackt && bound) {
+        if (sty > stx) {
+            stp = std::min(stx + 0.66*(sty - stx), stp);
+        } else {
+            stp = std::max(stx + 0.66*(sty - stx), stp);
+        }
+    }
+
+    return;
+}
+
+void LBFGS::mcsrch(int n, Eigen::VectorXd& x, double f, Eigen::VectorXd& g, const Eigen::VectorXd& s, double& stp, double ftol, double xtol, int maxfev, int& info, int& nfev, Eigen::VectorXd& wa)
+{
+    double stpmin = 1e-20;
+    double stpmax = 1e20;
+    double p5 = 0.5;
+    double p66 = 0.66;
+    double xtrapf = 4.0;
+    double gtol = 0.9;
+
+    if(info != -1) {
+        infoc = 1;
+        if (n <= 0 || stp <= 0 || ftol < 0 || gtol < 0 || xtol < 0 || stpmin < 0 || stpmax < stpmin || maxfev <= 0 )
+            return;
+
+        dginit = g.dot(s);
+        if (dginit >= 0.0) {
+            // The search direction is not a descent direction
+            info = 7;
+            return;
+        }
+
+        brackt = false;
+        stage1 = true;
+        nfev = 0;
+        finit = f;
+        dgtest = ftol * dginit;
+        width = stpmax - stpmin;
+        width1 = width/p5;
+
+        wa = x;
+
+        stx = 0.0;
+        fx = finit;
+        dgx = dginit;
+        sty = 0.0;
+        fy = finit;
+        dgy = dginit;
+    }
+
+    while(true)
+    {
+        if(info != -1)
+        {
+            if (brackt) {
+                if (stx < sty) {
+                    stmin = stx;
+                    stmax = sty;
+                } else {
+                    stmin = sty;
+                    stmax = stx;
+                }
+            } else {
+                stmin = stx;
+                stmax = stp + xtrapf * (stp - stx);
+            }
+
+            if (stp > stpmax) {
+                stp = stpmax;
+            }
+            if (stp < stpmin) {
+                stp = stpmin;
+            }
+            if ((brackt && ((stp <= stmin) || (stp >= stmax))) || (nfev == maxfev - 1) ||
+                    (!infoc) || (brackt && ((stmax - stmin) <= xtol * stmax))) {
+                stp = stx;
+            }
+
+            x = wa + stp * s;
+            info = -1;
+            return;
+        }
+        info = 0;
+        nfev= nfev + 1;
+        dg = g.dot(s);
+        ftest1 = finit + stp * dgtest;
+
+        if ((brackt && ((stp <= stmin) || (stp >= stmax))) || (!infoc)) {
+            info = 6;
+        }
+        if ((stp == stpmax) && (f <= ftest1) && (dg <= dgtest)) {
+            info = 5;
+        }
+        if ((stp == stpmin) && ((f >= ftest1) || (dg >= dgtest))) {
+            info = 4;
+        }
+        if (nfev >= maxfev) {
+            info = 3;
+        }
+        if (brackt && (stmax - stmin <= xtol * stmax)) {
+            info = 2;
+        }
+        if ((f <= ftest1) && (fabs(dg) <= -gtol * dginit)) {
+            info = 1;
+        }
+        if (info !=0 )
+            return ;
+
+
+        if ( stage1 && f <= ftest1 && dg >= std::min(ftol , gtol) * dginit ) stage1 = false;
+
+        if (stage1 && f <= fx && f > ftest1) {
+            fm = f - stp * dgtest;
+            fxm = fx - stx * dgtest;
+            fym = fy - sty * dgtest;
+            dgm = dg - dgtest;
+            dgxm = dgx - dgtest;
+            dgym = dgy - dgtest;
+            mcstep(stx, fxm, dgxm, sty, fym, dgym, stp, fm, dgm, brackt, stmin, stmax, infoc);
+            fx = fxm + stx * dgtest;
+            fy = fym + sty * dgtest;
+            dgx = dgxm + dgtest;
+            dgy = dgym + dgtest;
+        } else {
+            mcstep(stx, fx, dgx, sty, fy, dgy, stp, f, dg, brackt, stmin, stmax, infoc);
+        }
+
+        if (brackt) {
+            if (fabs(sty - stx) >= p66 * width1) {
+                stp = stx + p5 * (sty - stx);
+            }
+            width1 = width;
+            width = fabs(sty - stx);
+        }
+    }
+}
+
+
+
+void LBFGS::lbfgs(int n, int m, double f, Eigen::VectorXd g, double eps , double xtol)
+{
+    bool execute_entire_while_loop = false;
+    if(iflag == 0) {
+        iter=0;
+        if ( n <= 0 || m <= 0 )
+        {
+            iflag= -3;
+        }
+
+        nfun= 1;
+        point = 0;
+        finish = false;
+        ispt = n + 2*m;
+        iypt = ispt + n*m;
+        npt = 0;
+        w.segment(ispt, n) = (-g).cwiseProduct(diag);
+        stp1 = 1.0 / g.norm();
+        ftol= 0.0001;
+        maxfev= 20;
+        execute_entire_while_loop = true;
+    }
+    while(true) {
+        if(execute_entire_while_loop) {
+            iter++;
+            info = 0;
+            bound=iter-1;
+            if (iter!=1) {
+                if (iter > m) bound = m;
+                double ys = w.segment(iypt + npt, n).dot(w.segment(ispt + npt, n));
+                double yy = w.segment(iypt + npt, n).squaredNorm();
+                diag.setConstant(ys / yy);
+                cp = point;
+                if (point ==0 ) cp =m;
+                w[n + cp-1] = 1.0 / ys;
+                w.head(n) = -g;
+                cp = point;
+                for (int i = 0; i < bound; i++) {
+                    cp -= 1;
+                    if (cp == -1) {
+                        cp = m - 1;
+                    }
+                    sq = w.segment(ispt + cp *n,n).dot(w.head(n));
+                    inmc = n + m + cp;
+                    iycn = iypt + cp * n;
+                    w[inmc] = sq * w[n + cp];
+                    w.head(n) -= w[inmc] * w.segment(iycn, n);
+                }
+                w.head(n)=w.head(n).cwiseProduct(diag);
+
+                for (int i = 0; i < bound; i++) {
+                    yr = w.segment(iypt + cp * n, n).dot(w.head(n));
+                    inmc = n + m + cp;
+                    beta = w[inmc] - w[n + cp] * yr;
+                    iscn = ispt + cp * n;
+                    w.head(n) += beta * w.segment(iscn, n);
+                    cp += 1;
+                    if (cp == m) {
+                        cp = 0;
+                    }
+                }
+                w.segment(ispt + point * n, n) = w.head(n);
+            }
+            nfev = 0;
+            stp = (iter == 1) ? stp1 : 1.0;
+            w.head(n) = g;
+        }
+        mcsrch(n, x, f, g, w.segment(ispt + point * n, n), stp, ftol, xtol, maxfev, info, nfev, diag);
+        if(info == -1) {
+            iflag = 1;
+            return;
+        } else if (info == 7) {
+            iflag = -4;
+            return;
+        } else {
+            iflag = -1;
+        }
+        nfun = nfun + nfev;
+        npt = point * n;
+        w.segment(ispt + npt,n) *=stp;
+        w.segment(iypt + npt,n) =g - w.head(n);
+        point = point + 1;
+        if (point == m) {
+            point = 0;
+        }
+        if(g.norm()/std::max(1.0,x.norm())<=eps) {
+            finish = true;
+        }
+        if (finish) {
+            iflag = 0;
+            return;
+        }
+        execute_entire_while_loop = true;
+    }
+}
+
+/**
+ * @brief Throw an exception if the last call to lbfgs() failed
+ */
+void LBFGS::check_status() const {
+    switch(iflag)
+    {
+    case -1:
+        throw std::logic_error("The line search rountine mcsch failed");
+        break;
+    case -2:
+        throw std::logic_error("The i-th diagonal element of the diagonal inverse Hessian"
+                               "approximation, given in DIAG, is not positive");
+        break;
+    case -3:
+        throw std::logic_error("Improper input parameters for LBFGS n or m are not positive");
+        break;
+    case -4:
+        throw std::logic_error("The search direction of LBFGS is not a descent "
+                               "direction");
+        break;
+    }
+}
+
+} // namespace modules
+
+} // namespace madlib
@@ -0,0 +1,220 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file LBFGS.hpp
+ *
+ * @brief Limited-memory BFGS method, restartable across aggregate calls
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_SHARED_LBFGS_HPP_
+#define MADLIB_SHARED_LBFGS_HPP_
+
+namespace madlib {
+
+namespace modules {
+
+/**
+ * @brief Limited-memory Broyden-Fletcher-Goldfarb-Shanno (L-BFGS) method for
+ *     large-scale unconstrained minimization
+ *
+ * This class is a translation of the Fortran code written by Jorge Nocedal.
+ * Each call to lbfgs() consumes one function value and gradient and returns
+ * the point at which the next function value and gradient are needed. In
+ * between calls, the complete state of the method (including the line search)
+ * is kept in a transition state, so that each evaluation can be done by one
+ * aggregate-function call.
+ *
+ * A transition state used with this class must have the following members:
+ * - <tt>coef</tt>: Current point (\f$ n \f$ values)
+ * - <tt>diag</tt>: Diagonal of the initial inverse Hessian approximation
+ *   (\f$ n \f$ values, all 1 before the first call)
+ * - <tt>ws</tt>: Work space (<tt>workspaceSize(n, m)</tt> values)
+ * - <tt>lbfgs_state</tt>: Scalars of the L-BFGS method
+ *   (<tt>kLBFGSStateSize</tt> values)
+ * - <tt>mcsrch_state</tt>: Scalars of the line search
+ *   (<tt>kLineSearchStateSize</tt> values)
+ *
+ * All members are zero before the first call.
+ */
+class LBFGS {
+public:
+    /**
+     * @brief Number of scalars of the L-BFGS method kept in the state
+     */
+    static const uint32_t kLBFGSStateSize = 21;
+
+    /**
+     * @brief Number of scalars of the line search kept in the state
+     */
+    static const uint32_t kLineSearchStateSize = 25;
+
+    /**
+     * @brief Size of the work space for \f$ n \f$ variables and \f$ m \f$
+     *     corrections
+     */
+    static inline uint32_t workspaceSize(uint32_t n, uint32_t m) {
+        return n * (2 * m + 1) + 2 * m;
+    }
+
+    /**
+     * @brief Whether the method has terminated with the last call to lbfgs()
+     *
+     * The method starts from scratch if lbfgs() is called again, so callers
+     * should not call it again once this returns true.
+     */
+    template <class Vector>
+    static inline bool converged(const Vector &inLBFGSState) {
+        return static_cast<int>(inLBFGSState(6)) == 0;
+    }
+
+    // shared variable in lbfgs
+    double stp1, ftol, stp, sq, yr, beta;
+    // iflag A return with <code>iflag &lt; 0</code> indicates an error,
+    // and <code>iflag = 0</code> indicates that the routine has
+    // terminated without detecting errors. On a return with
+    // <code>iflag = 1</code>, the user must evaluate the function
+    // <code>f</code> and gradient <code>g</code>. On a return with
+    // iflag is negative , lbfgs failed (-4: the search direction is not a
+    // descent direction, see check_status())
+
+    int  iflag, iter, nfun, point, ispt, iypt, maxfev, info, bound, npt, cp, nfev, inmc, iycn, iscn;
+    // shared varibles in mcscrch
+    int infoc;
+    double dg, dgm, dginit, dgtest, dgx, dgxm, dgy, dgym, finit, ftest1, fm, fx, fxm, fy, fym, p5, p66, stx, sty, stmin, stmax, width, width1, xtrapf;
+    bool brackt, stage1, finish;
+
+    dbal::eigen_integration::ColumnVector w;//
+    dbal::eigen_integration::ColumnVector x;// solution vector
+    dbal::eigen_integration::ColumnVector diag;
+
+    template <class State>
+    LBFGS(State &state);
+    template <class State>
+    void save_state(State &state);
+    void mcstep (double&, double& , double&, double&, double& , double&, double&, double, double, bool&, double, double, int&);
+    void mcsrch (int, Eigen::VectorXd&, double, Eigen::VectorXd&, const Eigen::VectorXd&, double&, double, double, int, int&, int&, Eigen::VectorXd&);
+    void lbfgs(int, int, double, Eigen::VectorXd, double, double);
+    void check_status() const;
+};
+
+/**
+ *@brief initialize state of current lbfgs iteration with the state of last iteration
+ */
+template <class State>
+LBFGS::LBFGS(State &state) {
+    w = state.ws;
+    diag = state.diag;
+    x = state.coef;
+
+    stp1 = state.lbfgs_state(0);
+    ftol = state.lbfgs_state(1);
+    stp = state.lbfgs_state(2);
+    sq = state.lbfgs_state(3);
+    yr = state.lbfgs_state(4);
+    beta = state.lbfgs_state(5);
+    iflag = static_cast<int>(state.lbfgs_state(6));
+    iter = static_cast<int>(state.lbfgs_state(7));
+    nfun = static_cast<int>(state.lbfgs_state(8));
+    point = static_cast<int>(state.lbfgs_state(9));
+    ispt = static_cast<int>(state.lbfgs_state(10));
+    iypt = static_cast<int>(state.lbfgs_state(11));
+    maxfev = static_cast<int>(state.lbfgs_state(12));
+    info = static_cast<int>(state.lbfgs_state(13));
+    bound = static_cast<int>(state.lbfgs_state(14));
+    npt = static_cast<int>(state.lbfgs_state(15));
+    cp = static_cast<int>(state.lbfgs_state(16));
+    nfev = static_cast<int>(state.lbfgs_state(17));
+    inmc = static_cast<int>(state.lbfgs_state(18));
+    iycn = static_cast<int>(state.lbfgs_state(19));
+    iscn = static_cast<int>(state.lbfgs_state(20));
+
+    infoc = static_cast<int>(state.mcsrch_state(0));
+    dg = state.mcsrch_state(1);
+    dgm = state.mcsrch_state(2);
+    dginit = state.mcsrch_state(3);
+    dgtest = state.mcsrch_state(4);
+    dgx = state.mcsrch_state(5);
+    dgxm = state.mcsrch_state(6);
+    dgy = state.mcsrch_state(7);
+    dgym = state.mcsrch_state(8);
+    finit = state.mcsrch_state(9);
+    ftest1 = state.mcsrch_state(10);
+    fm = state.mcsrch_state(11);
+    fx = state.mcsrch_state(12);
+    fxm = state.mcsrch_state(13);
+    fy = state.mcsrch_state(14);
+    fym = state.mcsrch_state(15);
+    stx = state.mcsrch_state(16);
+    sty = state.mcsrch_state(17);
+    stmin = state.mcsrch_state(18);
+    stmax = state.mcsrch_state(19);
+    width = state.mcsrch_state(20);
+    width1 = state.mcsrch_state(21);
+    brackt = (state.mcsrch_state(22) == 1.0 ? true: false);
+    stage1 = (state.mcsrch_state(23) == 1.0 ? true: false);
+    finish = (state.mcsrch_state(24) == 1.0 ? true: false);
+}
+
+/**
+ *@brief save current lbfgs state for the next lbfgs iteration
+ */
+template <class State>
+void LBFGS::save_state(State &state) {
+    state.ws = w ;
+    state.diag = diag ;
+    state.coef = x ;
+
+    state.lbfgs_state(0) = stp1;
+    state.lbfgs_state(1) = ftol;
+    state.lbfgs_state(2) = stp;
+    state.lbfgs_state(3) = sq;
+    state.lbfgs_state(4) = yr;
+    state.lbfgs_state(5) = beta;
+    state.lbfgs_state(6) = iflag;
+    state.lbfgs_state(7) = iter;
+    state.lbfgs_state(8) = nfun;
+    state.lbfgs_state(9) = point;
+    state.lbfgs_state(10) = ispt;
+    state.lbfgs_state(11) = iypt;
+    state.lbfgs_state(12) = maxfev;
+    state.lbfgs_state(13) = info;
+    state.lbfgs_state(14) = bound;
+    state.lbfgs_state(15) = npt;
+    state.lbfgs_state(16) = cp;
+    state.lbfgs_state(17) = nfev;
+    state.lbfgs_state(18) = inmc;
+    state.lbfgs_state(19) = iycn;
+    state.lbfgs_state(20) = iscn;
+
+    state.mcsrch_state(0) = infoc;
+    state.mcsrch_state(1) =  dg;
+    state.mcsrch_state(2) = dgm;
+    state.mcsrch_state(3) = dginit;
+    state.mcsrch_state(4) = dgtest;
+    state.mcsrch_state(5) = dgx;
+    state.mcsrch_state(6) = dgxm;
+    state.mcsrch_state(7) = dgy;
+    state.mcsrch_state(8) = dgym;
+    state.mcsrch_state(9) = finit;
+    state.mcsrch_state(10) = ftest1;
+    state.mcsrch_state(11) = fm;
+    state.mcsrch_state(12) = fx;
+    state.mcsrch_state(13) = fxm;
+    state.mcsrch_state(14) = fy;
+    state.mcsrch_state(15) = fym;
+    state.mcsrch_state(16) = stx;
+    state.mcsrch_state(17) = sty;
+    state.mcsrch_state(18) = stmin;
+    state.mcsrch_state(19) = stmax;
+    state.mcsrch_state(20) = width;
+    state.mcsrch_state(21) = width1;
+    state.mcsrch_state(22) = (brackt == true ? 1.0 : 0.0);
+    state.mcsrch_state(23) = (stage1 == true ? 1.0 : 0.0);
+    state.mcsrch_state(24) = (finish == true ? 1.0 : 0.0);
+}
+
+} // namespace modules
+
+} // namespace madlib
+
+#endif
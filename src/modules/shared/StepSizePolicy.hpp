@@ -0,0 +1,143 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file StepSizePolicy.hpp
+ *
+ * @brief Step-size policies for incremental gradient methods
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_SHARED_STEP_SIZE_POLICY_HPP_
+#define MADLIB_SHARED_STEP_SIZE_POLICY_HPP_
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace madlib {
+
+namespace modules {
+
+/**
+ * @brief Step-size policy of an incremental gradient method
+ *
+ * Transition states store the policy as a double, so the numeric values must
+ * not change.
+ *
+ * - kConstantStepSize: Step size \f$ \eta_0 \f$ throughout
+ * - kInverseStepSize: Step size \f$ \eta_0 / (1 + k) \f$ in the pass
+ *   \f$ k = 0, 1, \dots \f$ over the data
+ * - kAdaGradStepSize: Step size \f$ \eta_0 / \sqrt{G_i} \f$ for coordinate
+ *   \f$ i \f$, where \f$ G_i \f$ is the sum of the squares of all gradient
+ *   components \f$ i \f$ seen so far (AdaGrad)
+ * - kAveragingStepSize: Step size \f$ \eta_0 / \sqrt{1 + k} \f$ in pass
+ *   \f$ k \f$. The model returned is the average of all iterates
+ *   (Polyak-Ruppert averaging), which compensates for the slower decay. If
+ *   the gradient of a single row is sparse (as for low-rank matrix
+ *   factorization), only the iterates at the end of each pass are averaged.
+ */
+enum StepSizePolicy {
+    kConstantStepSize = 0,
+    kInverseStepSize,
+    kAdaGradStepSize,
+    kAveragingStepSize
+};
+
+/**
+ * @brief Small constant added to the AdaGrad denominator, so that coordinates
+ *     with no gradient so far do not cause a division by zero
+ */
+const double kAdaGradEpsilon = 1e-8;
+
+/**
+ * @brief Parse the name of a step-size policy as passed from SQL
+ */
+inline
+StepSizePolicy
+stepSizePolicyFromString(const char *inName) {
+    if (std::strcmp(inName, "constant") == 0)
+        return kConstantStepSize;
+    else if (std::strcmp(inName, "inverse") == 0)
+        return kInverseStepSize;
+    else if (std::strcmp(inName, "adagrad") == 0)
+        return kAdaGradStepSize;
+    else if (std::strcmp(inName, "averaging") == 0)
+        return kAveragingStepSize;
+
+    throw std::invalid_argument("Invalid parameter: stepsize_policy must be "
+        "one of 'constant', 'inverse', 'adagrad', or 'averaging'");
+}
+
+/**
+ * @brief Whether the policy needs one auxiliary value per model coefficient
+ *
+ * AdaGrad keeps the sums of squared gradient components, and Polyak-Ruppert
+ * averaging keeps the averaged model. Transition states only allocate space
+ * for the auxiliary values if the policy needs them.
+ */
+inline
+bool
+hasAccumulator(StepSizePolicy inPolicy) {
+    return inPolicy == kAdaGradStepSize || inPolicy == kAveragingStepSize;
+}
+
+/**
+ * @brief Global step size in a pass over the data
+ *
+ * @param inPolicy The step-size policy
+ * @param inInitialStepSize The initial step size \f$ \eta_0 \f$
+ * @param inNumPasses The number \f$ k \f$ of passes over the data completed
+ *     so far
+ *
+ * For AdaGrad, the caller still has to scale each coordinate individually.
+ */
+inline
+double
+scheduledStepSize(StepSizePolicy inPolicy, double inInitialStepSize,
+    uint64_t inNumPasses) {
+
+    switch (inPolicy) {
+        case kInverseStepSize:
+            return inInitialStepSize / (1. + static_cast<double>(inNumPasses));
+        case kAveragingStepSize:
+            return inInitialStepSize
+                / std::sqrt(1. + static_cast<double>(inNumPasses));
+        default:
+            return inInitialStepSize;
+    }
+}
+
+/**
+ * @brief Fold the iterates of one pass into the averaged model
+ *
+ * @param ioAverage Average of the iterates of all previous passes. Will be
+ *     updated to the average of all iterates including this pass.
+ * @param ioSumOfIterates Sum of the iterates of this pass. Will be reset to
+ *     zero.
+ * @param inNumPreviousUpdates Number of iterates in all previous passes
+ * @param inNumUpdates Number of iterates in this pass
+ *
+ * This only uses scalar multiplication and addition, so that it works both for
+ * Eigen vectors and for composite models.
+ */
+template <class Average, class Sum>
+inline
+void
+foldAverage(Average &ioAverage, Sum &ioSumOfIterates,
+    uint64_t inNumPreviousUpdates, uint64_t inNumUpdates) {
+
+    double totalNumUpdates = static_cast<double>(inNumPreviousUpdates)
+        + static_cast<double>(inNumUpdates);
+    if (totalNumUpdates == 0)
+        return;
+
+    ioAverage *= static_cast<double>(inNumPreviousUpdates) / totalNumUpdates;
+    ioSumOfIterates *= 1. / totalNumUpdates;
+    ioAverage += ioSumOfIterates;
+    ioSumOfIterates *= 0.;
+}
+
+} // namespace modules
+
+} // namespace madlib
+
+#endif
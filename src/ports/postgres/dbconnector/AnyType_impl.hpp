@@ -360,6 +360,98 @@ AnyType::operator<<(const AnyType &inValue) {
     return *this;
 }
 
+/**
+ * @brief Return the user-defined cross-call context of the current function
+ *
+ * Functions may keep state across calls within the same query (e.g., a
+ * converted model that is passed to the function again and again). The context
+ * is stored in SystemInformation::user_fctx, which is only available to the
+ * entry function of the C++ AL and if that function is not set-returning (in
+ * which case the field is already used by the AL).
+ *
+ * @returns The context previously allocated with allocateUserFunctionContext()
+ *     or NULL if there is none or no context is available to this function.
+ */
+inline
+void *
+AnyType::getUserFunctionContext() const {
+    consistencyCheck();
+
+    if (mContentType != FunctionComposite || fcinfo->flinfo->fn_retset
+        || mSysInfo->entryFuncOID != fcinfo->flinfo->fn_oid)
+        return NULL;
+
+    return mSysInfo->user_fctx;
+}
+
+/**
+ * @brief Allocate a new user-defined cross-call context for the current
+ *     function
+ *
+ * The memory is zero-initialized and lives until the end of the current query.
+ * It is never freed explicitly, so callers should only reallocate if the
+ * existing context is too small.
+ *
+ * @returns The new context or NULL if no context is available to this
+ *     function (see getUserFunctionContext()).
+ */
+inline
+void *
+AnyType::allocateUserFunctionContext(size_t inSize) const {
+    consistencyCheck();
+
+    if (mContentType != FunctionComposite || fcinfo->flinfo->fn_retset
+        || mSysInfo->entryFuncOID != fcinfo->flinfo->fn_oid)
+        return NULL;
+
+    mSysInfo->user_fctx = madlib_MemoryContextAllocZero(
+        mSysInfo->cacheContext, inSize);
+    return mSysInfo->user_fctx;
+}
+
+/**
+ * @brief Return the unconverted backend representation of a scalar value
+ *
+ * For variable-length types, this is the varlena as passed by the backend,
+ * i.e., it is neither detoasted nor decompressed. It is therefore cheap to
+ * compare against a previously seen value.
+ */
+inline
+const void *
+AnyType::getRawValue() const {
+    consistencyCheck();
+
+    if (mContentType != Scalar || mSysInfo == NULL || !mContent.empty())
+        throw std::invalid_argument("Raw values are only available for "
+            "scalar values passed by the backend.");
+
+    return mSysInfo->typeInformation(mTypeID)->byval
+        ? static_cast<const void*>(&mDatum)
+        : static_cast<const void*>(DatumGetPointer(mDatum));
+}
+
+/**
+ * @brief Return the size (in bytes) of the value returned by getRawValue()
+ */
+inline
+size_t
+AnyType::getRawValueSize() const {
+    consistencyCheck();
+
+    if (mContentType != Scalar || mSysInfo == NULL || !mContent.empty())
+        throw std::invalid_argument("Raw values are only available for "
+            "scalar values passed by the backend.");
+
+    TypeInformation* typeInfo = mSysInfo->typeInformation(mTypeID);
+    if (typeInfo->byval)
+        return sizeof(Datum);
+    else if (typeInfo->len == -1)
+        return VARSIZE_ANY(DatumGetPointer(mDatum));
+    else if (typeInfo->len == -2)
+        return std::strlen(DatumGetCString(mDatum)) + 1;
+    return static_cast<size_t>(typeInfo->len);
+}
+
 /**
  * @brief Return a PostgreSQL Datum representing the current object
  *
@@ -41,6 +41,11 @@ public:
     bool isComposite() const;
     AnyType& operator<<(const AnyType& inValue);
 
+    void *getUserFunctionContext() const;
+    void *allocateUserFunctionContext(size_t inSize) const;
+    const void *getRawValue() const;
+    size_t getRawValueSize() const;
+
 protected:
     /**
      * @brief RAII class to temporarily change \c sLazyConversionToDatum
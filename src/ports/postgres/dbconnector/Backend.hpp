@@ -99,6 +99,12 @@ MADLIB_WRAP_VOID_PG_FUNC(
     (typid, typlen, typbyval, typalign)
     )
 
+MADLIB_WRAP_VOID_PG_FUNC(
+    deconstruct_array,
+    (ArrayType* array, Oid elmtype, int elmlen, bool elmbyval, char elmalign,
+        Datum** elemsp, bool** nullsp, int* nelemsp),
+    (array, elmtype, elmlen, elmbyval, elmalign, elemsp, nullsp, nelemsp))
+
 inline
 void
 madlib_InitFunctionCallInfoData(FunctionCallInfoData& fcinfo, FmgrInfo* flinfo,